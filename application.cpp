@@ -1,27 +1,29 @@
-#include <sys/sysinfo.h>
+#include <algorithm>
 
 #include "application.h"
 #include "threadpool.h"
 
 std::shared_ptr<Application> Application::_current = {nullptr};
 
-Application::Application() : _status{0} {
+Application::Application(const ThreadPoolOptions &options) : _status{0} {
     if (_current) {
         throw std::runtime_error("Application already created");
     }
 
-    // Get number of cores in the system
-    size_t looperCount = static_cast<size_t>(get_nprocs());
+    // One looper per CPU the process may use, so a container's cpuset and quota are not oversubscribed
+    size_t looperCount = options.loopers != 0 ? options.loopers : Topology::detect().getRecommendedLooperCount();
 
     // Create new thread pool that will create looperCount-1 looper threads and use current thread for looper also
-    _pool = std::shared_ptr<ThreadPool>(new ThreadPool(looperCount - 1, true));
+    _pool = std::shared_ptr<ThreadPool>(new ThreadPool(looperCount - 1, true, options));
+    _domains.push_back(_pool);
+    _domainNames.push_back("main");
 
     setMainThreadPool(_pool);
 }
 
-std::shared_ptr<Application> Application::create() {
+std::shared_ptr<Application> Application::create(const ThreadPoolOptions &options) {
     if (_current == nullptr)
-        _current = std::shared_ptr<Application>(new Application());
+        _current = std::shared_ptr<Application>(new Application(options));
     return _current;
 }
 
@@ -30,21 +32,129 @@ std::shared_ptr<Application> Application::getInstance() {
 }
 
 int Application::exec() {
+    // Domain pools run their loopers in threads of their own
+    for (size_t i = 1; i < _domains.size(); ++i) {
+        _domains[i]->start();
+    }
+
     // Start thread pool
     _pool->start();
+
+    for (size_t i = _domains.size() - 1; i > 0; --i) {
+        _domains[i]->stop();
+    }
     return _status;
 }
 
+DomainId Application::addDomain(const std::string &name, const ThreadPoolOptions &options) {
+    if (std::find(_domainNames.begin(), _domainNames.end(), name) != _domainNames.end()) {
+        throw std::runtime_error("Domain " + name + " already exists");
+    }
+    if (_domains.size() >= MAX_DOMAINS) {
+        throw std::runtime_error("Too many domains");
+    }
+
+    // Pinned pools take CPUs one after another, so the domain gets those left by the pools before it. With
+    // none left its loopers are not pinned and it defaults to a single looper instead of one per CPU
+    auto topology = Topology::detect();
+    size_t taken = 0;
+    for (auto &pool : _domains) {
+        if (pool->getOptions().pinLoopers) {
+            taken += pool->getLooperCapacity();
+        }
+    }
+    const auto &cpus = topology.getCpus();
+    std::vector<CpuInfo> rest(cpus.begin() + static_cast<ptrdiff_t>(std::min(taken, cpus.size())), cpus.end());
+
+    auto poolOptions = options;
+    size_t looperCount = 1;
+    if (rest.empty()) {
+        poolOptions.pinLoopers = false;
+    }
+    else {
+        topology = Topology(std::move(rest), topology.getCpuQuota());
+        looperCount = topology.getRecommendedLooperCount();
+    }
+    if (options.loopers != 0) {
+        looperCount = options.loopers;
+    }
+
+    auto domain = static_cast<DomainId>(_domains.size());
+    auto pool = std::shared_ptr<ThreadPool>(new ThreadPool(looperCount, false, poolOptions, domain, std::move(topology)));
+    setThreadPool(domain, pool);
+    _domains.push_back(std::move(pool));
+    _domainNames.push_back(name);
+    return domain;
+}
+
+DomainId Application::getDomain(const std::string &name) const {
+    auto it = std::find(_domainNames.begin(), _domainNames.end(), name);
+    if (it == _domainNames.end()) {
+        throw std::runtime_error("Domain " + name + " doesn't exist");
+    }
+    return static_cast<DomainId>(it - _domainNames.begin());
+}
+
+std::shared_ptr<ThreadPool> Application::getPool(DomainId domain) const {
+    auto index = static_cast<size_t>(domain);
+    if (index >= _domains.size()) {
+        throw std::runtime_error("Domain " + std::to_string(index) + " doesn't exist");
+    }
+    return _domains[index];
+}
+
 TaskWatcher Application::addTask(std::function<void()> fun) {
     return TaskWatcher(_pool->addTask(new Task(fun)));
 }
 
+TaskWatcher Application::addTask(std::function<void()> fun, CancellationToken token) {
+    TaskRef task(new Task(fun));
+    task->setCancellationToken(std::move(token));
+    return TaskWatcher(_pool->addTask(std::move(task)));
+}
+
 TaskWatcher Application::addTask(Task *task) {
     return TaskWatcher(_pool->addTask(task));
 }
 
-TaskWatcher Application::addTask(const std::shared_ptr<Task> &task) {
-    return TaskWatcher(_pool->addTask(task));
+TaskWatcher Application::addTask(TaskRef task) {
+    return TaskWatcher(_pool->addTask(std::move(task)));
+}
+
+TaskWatcher Application::addTask(DomainId domain, std::function<void()> fun) {
+    return TaskWatcher(_pool->addTask(new Task(fun, TaskPolicy{domain})));
+}
+
+TaskWatcher Application::addTaskNext(TaskRef task) {
+    return TaskWatcher(_pool->addTaskNext(std::move(task)));
+}
+
+TaskWatcher Application::addTaskAfter(TaskClock::duration delay, std::function<void()> fun) {
+    return addTaskAfter(delay, TaskRef(new Task(fun)));
+}
+
+TaskWatcher Application::addTaskAfter(TaskClock::duration delay, TaskRef task) {
+    return TaskWatcher(_pool->addTaskAfter(std::move(task), delay));
+}
+
+TaskWatcher Application::addTaskAt(TaskClock::time_point time, std::function<void()> fun) {
+    return addTaskAt(time, TaskRef(new Task(fun)));
+}
+
+TaskWatcher Application::addTaskAt(TaskClock::time_point time, TaskRef task) {
+    return TaskWatcher(_pool->addTaskAt(std::move(task), time));
+}
+
+TaskWatcher Application::addPeriodic(TaskClock::duration interval, std::function<void()> fun) {
+    return addPeriodic(interval, TaskRef(new Task(fun)));
+}
+
+TaskWatcher Application::addPeriodic(TaskClock::duration interval, TaskRef task) {
+    return TaskWatcher(_pool->addPeriodic(std::move(task), interval));
+}
+
+ThreadPoolMetrics Application::getMetrics(DomainId domain) const {
+    return getPool(domain)->getMetrics();
 }
 
 int Application::getThreadId() {
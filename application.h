@@ -1,11 +1,15 @@
 #ifndef APPLICATION_H
 #define APPLICATION_H
 
+#include <string>
+#include <vector>
+
 #include "threadpool.h"
 
 // Some defines to ease usage
 #define App Application::getInstance()
 #define async __app_async_proxy() += [&]()
+#define async_on(domain) __app_async_proxy(domain) += [&]()
 #define async_event __app_async_event_proxy() *
 
 // Singletone class for high-level async operations
@@ -14,37 +18,107 @@ class Application {
 
     std::shared_ptr<ThreadPool> _pool;
 
+    // Pools of executor domains indexed by DomainId, the main pool comes first
+    std::vector<std::shared_ptr<ThreadPool>> _domains;
+    std::vector<std::string> _domainNames;
+
     // Return code is stored here
     std::atomic_int _status;
 
-    Application();
+    Application(const ThreadPoolOptions& options);
 
 public:
-    static std::shared_ptr<Application> create();
+    static std::shared_ptr<Application> create(const ThreadPoolOptions& options = {});
 
     static std::shared_ptr<Application> getInstance();
 
     // Creates termination task to finish the app
     void exit(int status);
 
-    // Starts application loopers, blocking call
+    // Starts application loopers, blocking call. Domain pools are stopped after the main one
     int exec();
 
+    // Adds an executor domain: thread pool of its own size, idle strategy and queue, e.g. for blocking calls
+    // or latency-critical handlers. Tasks get there through TaskPolicy::domain. Has to be called before exec().
+    // Pinned loopers go to the CPUs left by the domains added before, and by default there is one looper per
+    // such CPU. When the earlier domains use up all CPUs, the new one gets a single unpinned looper by default
+    DomainId addDomain(const std::string &name, const ThreadPoolOptions &options = {});
+
+    // Throws if there is no such domain. Main domain is called "main"
+    DomainId getDomain(const std::string &name) const;
+
+    std::shared_ptr<ThreadPool> getPool(DomainId domain = DomainId::MAIN) const;
+
     TaskWatcher addTask(std::function<void()> fun);
 
+    // Task is dropped once the token is canceled, the function can poll the token to stop early
+    TaskWatcher addTask(std::function<void()> fun, CancellationToken token);
+
     TaskWatcher addTask(Task *task);
 
-    TaskWatcher addTask(const std::shared_ptr<Task> &task);
+    TaskWatcher addTask(TaskRef task);
+
+    // Runs the function on a looper of `domain`
+    TaskWatcher addTask(DomainId domain, std::function<void()> fun);
+
+    // Runs task right after the current one on the same looper, see ThreadPool::addTaskNext
+    TaskWatcher addTaskNext(TaskRef task);
+
+    // Runs task once after `delay`. Looper thread is not occupied while waiting
+    TaskWatcher addTaskAfter(TaskClock::duration delay, std::function<void()> fun);
+
+    TaskWatcher addTaskAfter(TaskClock::duration delay, TaskRef task);
+
+    // Runs task once at `time`
+    TaskWatcher addTaskAt(TaskClock::time_point time, std::function<void()> fun);
+
+    TaskWatcher addTaskAt(TaskClock::time_point time, TaskRef task);
+
+    // Runs task every `interval` until it is canceled
+    TaskWatcher addPeriodic(TaskClock::duration interval, std::function<void()> fun);
+
+    TaskWatcher addPeriodic(TaskClock::duration interval, TaskRef task);
+
+    // Adds a range of callables, Task* or TaskRef as one batch
+    template<class Range>
+    std::vector<TaskWatcher> addTasks(const Range &range) {
+        std::vector<TaskRef> tasks;
+        for (auto &&item : range) {
+            using Item = std::decay_t<decltype(item)>;
+            if constexpr (std::is_same_v<Item, TaskRef>) {
+                tasks.push_back(item);
+            }
+            else if constexpr (std::is_convertible_v<Item, Task*>) {
+                tasks.emplace_back(item);
+            }
+            else {
+                tasks.emplace_back(new Task(item));
+            }
+        }
+        _pool->addTasks(tasks);
+        return std::vector<TaskWatcher>(tasks.begin(), tasks.end());
+    }
 
     // Add arbitary callable to execution queue
     template<class Callable, class... Args>
+        requires (!std::is_same_v<std::decay_t<Callable>, DomainId>)
     auto add(Callable&& callable, Args&&... args) {
         auto f = std::bind(std::forward<Callable>(callable), std::forward<Args>(args)...);
         return addTask(new Task(f));
     }
 
+    // Same on a looper of `domain`
+    template<class Callable, class... Args>
+    auto add(DomainId domain, Callable&& callable, Args&&... args) {
+        auto f = std::bind(std::forward<Callable>(callable), std::forward<Args>(args)...);
+        return addTask(new Task(f, TaskPolicy{domain}));
+    }
+
     int getThreadId();
 
+    // Scheduler counters of the domain pool, cheap enough to poll while it runs
+    ThreadPoolMetrics getMetrics(DomainId domain = DomainId::MAIN) const;
+
     // Reschedules *current* task with same policies (literally pushes to task queue)
     void rescheduleTask();
 
@@ -54,9 +128,14 @@ public:
 
 // Wrapper class to enable += operator for adding new tasks
 class __app_async_proxy {
+    DomainId _domain;
+
 public:
+    explicit __app_async_proxy(DomainId domain = DomainId::MAIN) noexcept
+        : _domain{domain} {}
+
     auto operator+=(std::function<void()> __f) {
-        return App->getInstance()->addTask(__f);
+        return App->getInstance()->addTask(_domain, __f);
     }
 };
 
@@ -0,0 +1,351 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "asyncfile.h"
+
+namespace {
+
+enum class FileOpType { OPEN, READ, READV, WRITE, FSYNC, FDATASYNC };
+
+// Operation in flight, owned by whoever runs it: the ring, an offload thread or the looper finishing it
+struct FileOp : IoCompletion {
+    FileOpType type;
+    int fd{-1};
+    void *buffer{nullptr};
+    size_t size{0};
+    off_t offset{0};
+    // Buffer which may be registered with the submitting looper's ring
+    const IoBuffer *fixed{nullptr};
+    const iovec *vectors{nullptr};
+    int count{0};
+    std::string path;
+    int flags{0};
+    mode_t mode{0};
+    DomainId domain{DomainId::MAIN};
+    Looper *looper{nullptr};
+    TaskRef task;
+
+    FileOp(FileOpType opType, int file) noexcept
+        : IoCompletion{nullptr}, type{opType}, fd{file} {}
+};
+
+// Runs blocking calls for kernels without io_uring and for operations which don't fit into a full ring
+class OffloadThreads {
+    static constexpr size_t THREAD_COUNT = 4;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::deque<std::function<void()>> _jobs;
+    std::vector<std::thread> _threads;
+    bool _isStopped{false};
+
+public:
+    static OffloadThreads &getInstance() {
+        static OffloadThreads instance;
+        return instance;
+    }
+
+    ~OffloadThreads() {
+        {
+            std::lock_guard lock(_mutex);
+            _isStopped = true;
+        }
+        _wake.notify_all();
+        for (auto &thread : _threads) {
+            thread.join();
+        }
+    }
+
+    // Threads are started by the first job, pools with io_uring usually never need them. They are spawned from
+    // a looper and would inherit its pinning, so they spread over `cpus` instead
+    void add(std::function<void()> job, const std::vector<CpuInfo> &cpus) {
+        {
+            std::lock_guard lock(_mutex);
+            if (_threads.empty()) {
+                for (size_t i = 0; i < THREAD_COUNT; ++i) {
+                    _threads.emplace_back([this, cpus]() {
+                        Topology::pinThread(cpus);
+                        run();
+                    });
+                }
+            }
+            _jobs.push_back(std::move(job));
+        }
+        _wake.notify_one();
+    }
+
+private:
+    void run() {
+        std::unique_lock lock(_mutex);
+        while (true) {
+            _wake.wait(lock, [this]() { return _isStopped || !_jobs.empty(); });
+            if (_isStopped) {
+                return;
+            }
+            auto job = std::move(_jobs.front());
+            _jobs.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+};
+
+// Continuations and offloaded results go to the submitting looper
+TaskPolicy looperPolicy(Looper *looper) noexcept {
+    TaskPolicy policy{TaskBindingPolicy::BOUND, looper->getIndex()};
+    policy.domain = looper->getPool()->getDomain();
+    return policy;
+}
+
+int32_t result(ssize_t value) noexcept {
+    return value < 0 ? -errno : static_cast<int32_t>(value);
+}
+
+int32_t perform(FileOp &op) noexcept {
+    switch (op.type) {
+        case FileOpType::OPEN:
+            return result(::open(op.path.c_str(), op.flags | O_CLOEXEC, op.mode));
+        case FileOpType::READ:
+            return result(pread(op.fd, op.buffer, op.size, op.offset));
+        case FileOpType::READV:
+            return result(preadv(op.fd, op.vectors, op.count, op.offset));
+        case FileOpType::WRITE:
+            return result(pwrite(op.fd, op.buffer, op.size, op.offset));
+        case FileOpType::FSYNC:
+            return result(::fsync(op.fd));
+        case FileOpType::FDATASYNC:
+            return result(fdatasync(op.fd));
+        default:
+            return -EINVAL;
+    }
+}
+
+void prepare(io_uring_sqe &sqe, const FileOp &op, const IoRing &ring) noexcept {
+    sqe.fd = op.fd;
+    sqe.off = static_cast<uint64_t>(op.offset);
+    switch (op.type) {
+        case FileOpType::OPEN:
+            sqe.opcode = IORING_OP_OPENAT;
+            sqe.fd = AT_FDCWD;
+            sqe.off = 0;
+            sqe.addr = reinterpret_cast<uint64_t>(op.path.c_str());
+            sqe.len = op.mode;
+            sqe.open_flags = static_cast<uint32_t>(op.flags | O_CLOEXEC);
+            break;
+        case FileOpType::READ:
+        case FileOpType::WRITE: {
+            auto fixed = op.fixed && ring.isRegistered(*op.fixed);
+            if (op.type == FileOpType::READ) {
+                sqe.opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            }
+            else {
+                sqe.opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            }
+            if (fixed) {
+                sqe.buf_index = static_cast<uint16_t>(op.fixed->getIndex());
+            }
+            sqe.addr = reinterpret_cast<uint64_t>(op.buffer);
+            // Result has to fit into the completion, the kernel transfers less than that at once anyway
+            sqe.len = static_cast<uint32_t>(std::min<size_t>(op.size, INT_MAX));
+            break;
+        }
+        case FileOpType::READV:
+            sqe.opcode = IORING_OP_READV;
+            sqe.addr = reinterpret_cast<uint64_t>(op.vectors);
+            sqe.len = static_cast<uint32_t>(op.count);
+            break;
+        case FileOpType::FSYNC:
+        case FileOpType::FDATASYNC:
+            sqe.opcode = IORING_OP_FSYNC;
+            sqe.off = 0;
+            sqe.fsync_flags = op.type == FileOpType::FDATASYNC ? IORING_FSYNC_DATASYNC : 0;
+            break;
+        default:
+            break;
+    }
+}
+
+// Resolves the promise on the submitting looper
+void finish(FileOp *op, int32_t value) {
+    std::unique_ptr<FileOp> owner(op);
+    if (op->type == FileOpType::OPEN) {
+        auto task = static_cast<ResolvableTask<AsyncFile>*>(op->task.get());
+        task->resolve(value >= 0 ? AsyncFile(value, op->domain) : AsyncFile::failed(-value));
+    }
+    else {
+        auto task = static_cast<ResolvableTask<IoResult>*>(op->task.get());
+        task->resolve(value >= 0 ? IoResult{value, 0} : IoResult{0, -value});
+    }
+}
+
+void complete(IoCompletion *completion, int32_t value) {
+    finish(static_cast<FileOp*>(completion), value);
+}
+
+void offload(FileOp *op) {
+    OffloadThreads::getInstance().add([op]() {
+        auto value = perform(*op);
+        op->looper->getPool()->addTask(new Task([op, value]() { finish(op, value); }, looperPolicy(op->looper)));
+    }, getThreadPool(op->domain)->getTopology().getCpus());
+}
+
+// Runs on the submitting looper
+void start(FileOp *op) {
+    // Canceled before it reached the looper
+    if (op->task->isCanceled()) {
+        delete op;
+        return;
+    }
+
+    auto ring = op->looper->getRing();
+    if (auto sqe = ring ? ring->prepare(op) : nullptr) {
+        prepare(*sqe, *op, *ring);
+    }
+    else {
+        offload(op);
+    }
+}
+
+template<class T>
+Promise<T> submit(FileOp *op, DomainId domain) {
+    auto looper = getThreadPool(domain)->getIoLooper();
+    op->complete = &complete;
+    op->domain = domain;
+    op->looper = looper;
+    op->task = TaskRef(new ResolvableTask<T>(looperPolicy(looper)));
+
+    // Operation may finish before this returns
+    auto task = op->task;
+    if (ThreadPool::getCurrentLooper() == looper) {
+        start(op);
+    }
+    else {
+        looper->getPool()->addTask(new Task([op]() { start(op); }, looperPolicy(looper)));
+    }
+    return Promise<T>::deferred(std::move(task));
+}
+
+}
+
+AsyncFile::AsyncFile(int fd, DomainId domain) noexcept
+    : _fd{fd}, _domain{domain} {}
+
+AsyncFile AsyncFile::failed(int error) noexcept {
+    AsyncFile file;
+    file._error = error;
+    return file;
+}
+
+AsyncFile::AsyncFile(AsyncFile &&other) noexcept
+    : _fd{other._fd}, _error{other._error}, _domain{other._domain} {
+    other._fd = -1;
+}
+
+AsyncFile &AsyncFile::operator=(AsyncFile &&other) noexcept {
+    if (this != &other) {
+        close();
+        _fd = other._fd;
+        _error = other._error;
+        _domain = other._domain;
+        other._fd = -1;
+    }
+    return *this;
+}
+
+AsyncFile::~AsyncFile() {
+    close();
+}
+
+Promise<AsyncFile> AsyncFile::open(const std::string &path, int flags, mode_t mode, DomainId domain) {
+    auto op = new FileOp(FileOpType::OPEN, -1);
+    op->path = path;
+    op->flags = flags;
+    op->mode = mode;
+    return submit<AsyncFile>(op, domain);
+}
+
+bool AsyncFile::isValid() const noexcept {
+    return _fd >= 0;
+}
+
+int AsyncFile::getError() const noexcept {
+    return _error;
+}
+
+int AsyncFile::getFd() const noexcept {
+    return _fd;
+}
+
+Promise<IoResult> AsyncFile::read(void *buffer, size_t size, off_t offset) {
+    auto op = new FileOp(FileOpType::READ, _fd);
+    op->buffer = buffer;
+    op->size = size;
+    op->offset = offset;
+    return submit<IoResult>(op, _domain);
+}
+
+Promise<IoResult> AsyncFile::read(IoBuffer &buffer, size_t size, off_t offset) {
+    auto op = new FileOp(FileOpType::READ, _fd);
+    op->buffer = buffer.data();
+    op->size = std::min(size, buffer.size());
+    op->offset = offset;
+    op->fixed = &buffer;
+    return submit<IoResult>(op, _domain);
+}
+
+Promise<IoResult> AsyncFile::readv(const iovec *vectors, int count, off_t offset) {
+    auto op = new FileOp(FileOpType::READV, _fd);
+    op->vectors = vectors;
+    op->count = count;
+    op->offset = offset;
+    return submit<IoResult>(op, _domain);
+}
+
+Promise<IoResult> AsyncFile::write(const void *buffer, size_t size, off_t offset) {
+    auto op = new FileOp(FileOpType::WRITE, _fd);
+    op->buffer = const_cast<void*>(buffer);
+    op->size = size;
+    op->offset = offset;
+    return submit<IoResult>(op, _domain);
+}
+
+Promise<IoResult> AsyncFile::write(const IoBuffer &buffer, size_t size, off_t offset) {
+    auto op = new FileOp(FileOpType::WRITE, _fd);
+    op->buffer = buffer.data();
+    op->size = std::min(size, buffer.size());
+    op->offset = offset;
+    op->fixed = &buffer;
+    return submit<IoResult>(op, _domain);
+}
+
+Promise<IoResult> AsyncFile::fsync(bool dataOnly) {
+    return submit<IoResult>(new FileOp(dataOnly ? FileOpType::FDATASYNC : FileOpType::FSYNC, _fd), _domain);
+}
+
+void AsyncFile::close() noexcept {
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+IoBuffer AsyncFile::getBuffer() {
+    if (auto looper = ThreadPool::getCurrentLooper(); looper && looper->getRing()) {
+        if (auto buffer = looper->getRing()->getBuffer(); buffer.isValid()) {
+            return buffer;
+        }
+    }
+    return IoBuffer(IoRing::DEFAULT_BUFFER_SIZE);
+}
@@ -0,0 +1,82 @@
+#ifndef ASYNCFILE_H
+#define ASYNCFILE_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <string>
+
+#include "promise.h"
+#include "reactor.h"
+#include "uring.h"
+
+// File descriptor whose I/O doesn't block loopers. An operation is submitted from the calling looper, or
+// from one of the pool in round-robin order when called outside of it, and its promise is resolved on that
+// looper, so continuations run there. Loopers batch operations into their io_uring, see IoRing. Without
+// io_uring, or when the ring is full, operations run as blocking calls on offload threads and the result
+// is passed back to the submitting looper. Requires ThreadPoolOptions::reactor
+//
+// Operations use explicit offsets, several of them may be in flight at once. Buffers and vectors have to
+// stay alive until the operation is finished. Result is the number of bytes transferred, reads and writes
+// may be short as with pread and pwrite
+class AsyncFile {
+    int _fd{-1};
+
+    // errno of the failed open
+    int _error{0};
+
+    // Operations from outside the pool go to loopers of this domain
+    DomainId _domain{DomainId::MAIN};
+
+public:
+    AsyncFile() noexcept = default;
+
+    // Takes ownership of `fd`
+    explicit AsyncFile(int fd, DomainId domain = DomainId::MAIN) noexcept;
+
+    // File which failed to open
+    static AsyncFile failed(int error) noexcept;
+
+    AsyncFile(AsyncFile &&other) noexcept;
+    AsyncFile &operator=(AsyncFile &&other) noexcept;
+
+    AsyncFile(const AsyncFile &) = delete;
+    AsyncFile &operator=(const AsyncFile &) = delete;
+
+    // Closes the file. Operations in flight keep the descriptor number only, so they have to be finished
+    ~AsyncFile();
+
+    // Opens `path` with open(2) `flags` and `mode`
+    static Promise<AsyncFile> open(const std::string &path, int flags, mode_t mode = 0644,
+                                   DomainId domain = DomainId::MAIN);
+
+    bool isValid() const noexcept;
+
+    int getError() const noexcept;
+
+    int getFd() const noexcept;
+
+    Promise<IoResult> read(void *buffer, size_t size, off_t offset);
+
+    // Reads into a buffer registered with the submitting looper's ring without pinning it again
+    Promise<IoResult> read(IoBuffer &buffer, size_t size, off_t offset);
+
+    // Scatter read into `count` caller buffers
+    Promise<IoResult> readv(const iovec *vectors, int count, off_t offset);
+
+    Promise<IoResult> write(const void *buffer, size_t size, off_t offset);
+
+    Promise<IoResult> write(const IoBuffer &buffer, size_t size, off_t offset);
+
+    // fdatasync when `dataOnly` is set, fsync otherwise
+    Promise<IoResult> fsync(bool dataOnly = false);
+
+    // Closes the descriptor right away
+    void close() noexcept;
+
+    // Buffer from the registered set of the current looper, or heap buffer of the default size when called
+    // outside of a looper or the set is used up
+    static IoBuffer getBuffer();
+};
+
+#endif // ASYNCFILE_H
@@ -0,0 +1,474 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "asyncsocket.h"
+
+namespace {
+
+std::runtime_error socketError(const std::string &what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+}
+
+// Socket state shared by its handle and the tasks working on it. Everything but `post()` runs on the owner
+// looper thread, so there are no locks
+class SocketCore : public IoWatch, public std::enable_shared_from_this<SocketCore> {
+    int _fd;
+    Looper *_looper;
+
+    // Pending operations, one per direction
+    TaskRef _accept;
+    TaskRef _connect;
+
+    // Nobody holds the socket until it is connected, it keeps itself alive meanwhile
+    std::shared_ptr<SocketCore> _connecting;
+
+    TaskRef _read;
+    void *_readBuffer{nullptr};
+    size_t _readSize{0};
+
+    TaskRef _write;
+    const char *_writeBuffer{nullptr};
+    size_t _writeSize{0};
+    size_t _written{0};
+
+public:
+    SocketCore(int fd, Looper *looper) noexcept
+        : IoWatch{&SocketCore::onReady}, _fd{fd}, _looper{looper} {}
+
+    ~SocketCore() {
+        if (_fd >= 0) {
+            ::close(_fd);
+        }
+    }
+
+    int getFd() const noexcept {
+        return _fd;
+    }
+
+    Looper *getLooper() const noexcept {
+        return _looper;
+    }
+
+    // Continuations run on the owner looper
+    TaskPolicy ownerPolicy() const noexcept {
+        TaskPolicy policy{TaskBindingPolicy::BOUND, _looper->getIndex()};
+        policy.domain = _looper->getPool()->getDomain();
+        return policy;
+    }
+
+    // Runs `function` on the owner looper: right away when called there, as a bound task otherwise
+    void post(std::function<void()> function) {
+        if (ThreadPool::getCurrentLooper() == _looper) {
+            function();
+        }
+        else {
+            _looper->getPool()->addTask(new Task(std::move(function), ownerPolicy()));
+        }
+    }
+
+    void watch() {
+        _looper->getReactor()->add(_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP, this);
+    }
+
+    void startAccept(TaskRef task) {
+        if (!start(_accept, task)) {
+            return;
+        }
+        tryAccept();
+    }
+
+    void startConnect(TaskRef task, const SocketAddress &address) {
+        _connect = std::move(task);
+        _connecting = shared_from_this();
+        auto error = ::connect(_fd, address.get(), address.getLength()) == 0 ? 0 : errno;
+        if (error == 0 || error == EINPROGRESS) {
+            // Registered after connect: an unconnected socket would report a hang up right away
+            watch();
+        }
+        finishConnect(error);
+    }
+
+    void startRead(TaskRef task, void *buffer, size_t size) {
+        if (!start(_read, task)) {
+            return;
+        }
+        _readBuffer = buffer;
+        _readSize = size;
+        tryRead();
+    }
+
+    void startWrite(TaskRef task, const void *buffer, size_t size) {
+        if (!start(_write, task)) {
+            return;
+        }
+        _writeBuffer = static_cast<const char*>(buffer);
+        _writeSize = size;
+        _written = 0;
+        tryWrite();
+    }
+
+    void close() {
+        if (_fd < 0) {
+            return;
+        }
+        _looper->getReactor()->remove(_fd, this);
+        ::close(_fd);
+        _fd = -1;
+
+        if (_connect) {
+            finishConnect(ECANCELED);
+        }
+        fail(_accept, ECANCELED);
+        fail(_read, ECANCELED);
+        fail(_write, ECANCELED);
+    }
+
+private:
+    static void onReady(IoWatch *watch, uint32_t events) {
+        // Continuation run inline may drop the last handle
+        auto self = static_cast<SocketCore*>(watch)->shared_from_this();
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            self->tryAccept();
+            self->tryRead();
+        }
+        if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            if (self->_connect) {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                getsockopt(self->_fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                self->finishConnect(error);
+            }
+            self->tryWrite();
+        }
+    }
+
+    // Makes `task` the pending operation of its kind, or finishes it right away if it can't be started
+    bool start(TaskRef &pending, TaskRef &task) {
+        if (_fd < 0 || pending) {
+            fail(task, _fd < 0 ? EBADF : EBUSY);
+            return false;
+        }
+        pending = std::move(task);
+        return true;
+    }
+
+    // Pending operation canceled through its promise is dropped without touching the socket
+    static bool isLive(TaskRef &pending) {
+        if (pending && pending->isCanceled()) {
+            pending = nullptr;
+        }
+        return static_cast<bool>(pending);
+    }
+
+    static void finish(TaskRef &pending, IoResult result) {
+        TaskRef task = std::move(pending);
+        static_cast<ResolvableTask<IoResult>*>(task.get())->resolve(result);
+    }
+
+    static void fail(TaskRef &pending, int error) {
+        if (!pending) {
+            return;
+        }
+        TaskRef task = std::move(pending);
+        if (auto io = dynamic_cast<ResolvableTask<IoResult>*>(task.get())) {
+            io->resolve(IoResult{0, error});
+        }
+        else {
+            static_cast<ResolvableTask<AsyncSocket>*>(task.get())->resolve(AsyncSocket(error));
+        }
+    }
+
+    void tryAccept() {
+        while (isLive(_accept)) {
+            auto fd = accept4(_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if (errno != EAGAIN) {
+                    fail(_accept, errno);
+                }
+                return;
+            }
+
+            auto core = std::make_shared<SocketCore>(fd, _looper);
+            core->watch();
+            TaskRef task = std::move(_accept);
+            static_cast<ResolvableTask<AsyncSocket>*>(task.get())->resolve(AsyncSocket(std::move(core)));
+        }
+    }
+
+    void finishConnect(int error) {
+        if (error == EINPROGRESS || error == EALREADY) {
+            return;
+        }
+        TaskRef task = std::move(_connect);
+        auto self = std::move(_connecting);
+        auto promise = static_cast<ResolvableTask<AsyncSocket>*>(task.get());
+        if (error != 0) {
+            if (_fd >= 0) {
+                close();
+            }
+            promise->resolve(AsyncSocket(error));
+        }
+        else {
+            promise->resolve(AsyncSocket(std::move(self)));
+        }
+    }
+
+    void tryRead() {
+        while (isLive(_read)) {
+            auto count = recv(_fd, _readBuffer, _readSize, 0);
+            if (count >= 0) {
+                finish(_read, IoResult{count, 0});
+            }
+            else if (errno != EINTR) {
+                if (errno != EAGAIN) {
+                    finish(_read, IoResult{0, errno});
+                }
+                return;
+            }
+        }
+    }
+
+    void tryWrite() {
+        while (isLive(_write)) {
+            if (_written == _writeSize) {
+                finish(_write, IoResult{static_cast<ssize_t>(_written), 0});
+                return;
+            }
+            auto count = send(_fd, _writeBuffer + _written, _writeSize - _written, MSG_NOSIGNAL);
+            if (count >= 0) {
+                _written += static_cast<size_t>(count);
+            }
+            else if (errno != EINTR) {
+                if (errno != EAGAIN) {
+                    finish(_write, IoResult{static_cast<ssize_t>(_written), errno});
+                }
+                return;
+            }
+        }
+    }
+};
+
+SocketAddress::SocketAddress(const sockaddr *address, socklen_t length)
+    : _length{length} {
+    std::memcpy(&_storage, address, std::min<size_t>(length, sizeof(_storage)));
+}
+
+SocketAddress SocketAddress::tcp(const std::string &host, uint16_t port) {
+    SocketAddress address;
+    auto v4 = reinterpret_cast<sockaddr_in*>(&address._storage);
+    auto v6 = reinterpret_cast<sockaddr_in6*>(&address._storage);
+    if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        v4->sin_port = htons(port);
+        address._length = sizeof(sockaddr_in);
+    }
+    else if (inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        v6->sin6_port = htons(port);
+        address._length = sizeof(sockaddr_in6);
+    }
+    else {
+        throw std::runtime_error("Invalid address " + host);
+    }
+    return address;
+}
+
+SocketAddress SocketAddress::local(const std::string &path) {
+    SocketAddress address;
+    auto un = reinterpret_cast<sockaddr_un*>(&address._storage);
+    if (path.size() >= sizeof(un->sun_path)) {
+        throw std::runtime_error("Socket path is too long: " + path);
+    }
+    un->sun_family = AF_UNIX;
+    std::memcpy(un->sun_path, path.c_str(), path.size() + 1);
+    address._length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + 1);
+    return address;
+}
+
+int SocketAddress::getFamily() const noexcept {
+    return _storage.ss_family;
+}
+
+uint16_t SocketAddress::getPort() const noexcept {
+    switch (_storage.ss_family) {
+        case AF_INET:
+            return ntohs(reinterpret_cast<const sockaddr_in*>(&_storage)->sin_port);
+        case AF_INET6:
+            return ntohs(reinterpret_cast<const sockaddr_in6*>(&_storage)->sin6_port);
+        default:
+            return 0;
+    }
+}
+
+const sockaddr *SocketAddress::get() const noexcept {
+    return reinterpret_cast<const sockaddr*>(&_storage);
+}
+
+socklen_t SocketAddress::getLength() const noexcept {
+    return _length;
+}
+
+AsyncSocket::AsyncSocket(std::shared_ptr<SocketCore> core) noexcept
+    : _core{std::move(core)} {}
+
+AsyncSocket::AsyncSocket(int error) noexcept
+    : _error{error} {}
+
+AsyncSocket &AsyncSocket::operator=(AsyncSocket &&other) noexcept {
+    if (this != &other) {
+        close();
+        _core = std::move(other._core);
+        _error = other._error;
+    }
+    return *this;
+}
+
+AsyncSocket::~AsyncSocket() {
+    close();
+}
+
+Promise<AsyncSocket> AsyncSocket::connect(const SocketAddress &address, DomainId domain) {
+    auto looper = getThreadPool(domain)->getIoLooper();
+    auto fd = socket(address.getFamily(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw socketError("Can't create socket");
+    }
+
+    auto core = std::make_shared<SocketCore>(fd, looper);
+    TaskRef task(new ResolvableTask<AsyncSocket>(core->ownerPolicy()));
+    core->post([core, task, address]() {
+        core->startConnect(task, address);
+    });
+    return Promise<AsyncSocket>::deferred(std::move(task));
+}
+
+bool AsyncSocket::isValid() const noexcept {
+    return _core != nullptr;
+}
+
+int AsyncSocket::getError() const noexcept {
+    return _error;
+}
+
+int AsyncSocket::getLooper() const noexcept {
+    return _core ? _core->getLooper()->getIndex() : -1;
+}
+
+Promise<IoResult> AsyncSocket::read(void *buffer, size_t size) {
+    if (!_core) {
+        throw std::runtime_error("Socket is not connected");
+    }
+    TaskRef task(new ResolvableTask<IoResult>(_core->ownerPolicy()));
+    _core->post([core = _core, task, buffer, size]() {
+        core->startRead(task, buffer, size);
+    });
+    return Promise<IoResult>::deferred(std::move(task));
+}
+
+Promise<IoResult> AsyncSocket::write(const void *buffer, size_t size) {
+    if (!_core) {
+        throw std::runtime_error("Socket is not connected");
+    }
+    TaskRef task(new ResolvableTask<IoResult>(_core->ownerPolicy()));
+    _core->post([core = _core, task, buffer, size]() {
+        core->startWrite(task, buffer, size);
+    });
+    return Promise<IoResult>::deferred(std::move(task));
+}
+
+void AsyncSocket::close() {
+    if (auto core = std::move(_core)) {
+        core->post([core]() {
+            core->close();
+        });
+    }
+}
+
+AsyncListener &AsyncListener::operator=(AsyncListener &&other) noexcept {
+    if (this != &other) {
+        close();
+        _core = std::move(other._core);
+    }
+    return *this;
+}
+
+AsyncListener::~AsyncListener() {
+    close();
+}
+
+AsyncListener AsyncListener::listen(const SocketAddress &address, int backlog, bool reusePort, DomainId domain) {
+    auto looper = getThreadPool(domain)->getIoLooper();
+    auto fd = socket(address.getFamily(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw socketError("Can't create socket");
+    }
+
+    AsyncListener listener;
+    listener._core = std::make_shared<SocketCore>(fd, looper);
+
+    int one = 1;
+    if (address.getFamily() != AF_UNIX) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (reusePort) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        }
+    }
+    if (bind(fd, address.get(), address.getLength()) != 0) {
+        throw socketError("Can't bind socket");
+    }
+    if (::listen(fd, backlog) != 0) {
+        throw socketError("Can't listen");
+    }
+
+    listener._core->post([core = listener._core]() {
+        core->watch();
+    });
+    return listener;
+}
+
+Promise<AsyncSocket> AsyncListener::accept() {
+    if (!_core) {
+        throw std::runtime_error("Listener is closed");
+    }
+    TaskRef task(new ResolvableTask<AsyncSocket>(_core->ownerPolicy()));
+    _core->post([core = _core, task]() {
+        core->startAccept(task);
+    });
+    return Promise<AsyncSocket>::deferred(std::move(task));
+}
+
+SocketAddress AsyncListener::getAddress() const {
+    if (!_core) {
+        return {};
+    }
+    sockaddr_storage storage{};
+    socklen_t length = sizeof(storage);
+    if (getsockname(_core->getFd(), reinterpret_cast<sockaddr*>(&storage), &length) != 0) {
+        throw socketError("Can't get socket address");
+    }
+    return SocketAddress(reinterpret_cast<const sockaddr*>(&storage), length);
+}
+
+int AsyncListener::getLooper() const noexcept {
+    return _core ? _core->getLooper()->getIndex() : -1;
+}
+
+void AsyncListener::close() {
+    if (auto core = std::move(_core)) {
+        core->post([core]() {
+            core->close();
+        });
+    }
+}
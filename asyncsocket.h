@@ -0,0 +1,124 @@
+#ifndef ASYNCSOCKET_H
+#define ASYNCSOCKET_H
+
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "promise.h"
+#include "reactor.h"
+
+class SocketCore;
+
+// Address of a TCP or Unix domain stream socket
+class SocketAddress {
+    sockaddr_storage _storage{};
+    socklen_t _length{0};
+
+public:
+    SocketAddress() = default;
+
+    SocketAddress(const sockaddr *address, socklen_t length);
+
+    // Numeric IPv4 or IPv6 address, no name resolution. Throws std::runtime_error if it can't be parsed
+    static SocketAddress tcp(const std::string &host, uint16_t port);
+
+    // Unix domain socket path, throws std::runtime_error if it is too long
+    static SocketAddress local(const std::string &path);
+
+    int getFamily() const noexcept;
+
+    // Port of TCP address, 0 for Unix domain one
+    uint16_t getPort() const noexcept;
+
+    const sockaddr *get() const noexcept;
+
+    socklen_t getLength() const noexcept;
+};
+
+// Non-blocking stream socket served by the reactor of one looper. The looper is chosen when the socket
+// is created: current one, or one of the pool in round-robin order when created outside of it. Operations
+// run there and so do their continuations, so the socket's data stays in one cache. Methods can be called
+// from any thread, they pass the work to the owner looper then.
+//
+// One read and one write can be pending at a time, another one finishes with EBUSY. Buffers have to stay
+// alive until the operation is finished. Requires ThreadPoolOptions::reactor
+class AsyncSocket {
+    std::shared_ptr<SocketCore> _core;
+
+    // errno of the failed connect or accept
+    int _error{0};
+
+    friend class SocketCore;
+
+public:
+    AsyncSocket() = default;
+
+    explicit AsyncSocket(std::shared_ptr<SocketCore> core) noexcept;
+
+    // Socket which failed to connect or to be accepted
+    explicit AsyncSocket(int error) noexcept;
+
+    AsyncSocket(AsyncSocket &&other) noexcept = default;
+    AsyncSocket &operator=(AsyncSocket &&other) noexcept;
+
+    AsyncSocket(const AsyncSocket &) = delete;
+    AsyncSocket &operator=(const AsyncSocket &) = delete;
+
+    // Closes the socket
+    ~AsyncSocket();
+
+    // Connects to `address`. Outside of the pool a looper of `domain` gets the socket
+    static Promise<AsyncSocket> connect(const SocketAddress &address, DomainId domain = DomainId::MAIN);
+
+    bool isValid() const noexcept;
+
+    int getError() const noexcept;
+
+    // Index of the owner looper within its pool, -1 for invalid socket
+    int getLooper() const noexcept;
+
+    // Reads what is available, up to `size` bytes. 0 bytes means the peer closed the connection
+    Promise<IoResult> read(void *buffer, size_t size);
+
+    // Writes all `size` bytes, finishes with an error if the connection breaks in between
+    Promise<IoResult> write(const void *buffer, size_t size);
+
+    // Pending operations finish with ECANCELED
+    void close();
+};
+
+// Listening socket, accepted connections belong to the listener's looper. Several listeners with `reusePort`,
+// e.g. one per looper, let the kernel spread connections between loopers
+class AsyncListener {
+    std::shared_ptr<SocketCore> _core;
+
+public:
+    AsyncListener() = default;
+
+    AsyncListener(AsyncListener &&other) noexcept = default;
+    AsyncListener &operator=(AsyncListener &&other) noexcept;
+
+    AsyncListener(const AsyncListener &) = delete;
+    AsyncListener &operator=(const AsyncListener &) = delete;
+
+    ~AsyncListener();
+
+    // Binds and listens right away. Throws std::runtime_error on failure
+    static AsyncListener listen(const SocketAddress &address, int backlog = 128, bool reusePort = false,
+                                DomainId domain = DomainId::MAIN);
+
+    // Next incoming connection. One accept can be pending at a time
+    Promise<AsyncSocket> accept();
+
+    // Bound address, e.g. to learn the port picked for port 0
+    SocketAddress getAddress() const;
+
+    int getLooper() const noexcept;
+
+    void close();
+};
+
+#endif // ASYNCSOCKET_H
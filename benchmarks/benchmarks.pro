@@ -0,0 +1,7 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    queuebench \
+    parallelbench \
+    schedbench \
+    filebench
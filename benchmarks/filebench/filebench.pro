@@ -0,0 +1,6 @@
+TEMPLATE = app
+TARGET = filebench
+
+include(../../eventpp.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,274 @@
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "application.h"
+#include "asyncfile.h"
+#include "promise.h"
+
+// File I/O throughput: tasks doing blocking pread/pwrite against AsyncFile on io_uring and on offload threads.
+// Every task or operation chain works on its own file in a temporary directory, one chunk at a time, so
+// the number of files is the I/O depth. Reads come from the page cache written just before, the write
+// benchmark with fdatasync shows the device. Application is a singleton, so every backend runs in its own
+// child process.
+//
+// Results go to stdout as JSON lines, one object per measurement:
+//   {"benchmark":"read","backend":"uring","loopers":4,"files":64,"chunk":65536,"value":2345.6,"unit":"MiB/s"}
+//
+// Usage: filebench [loopers, 0 is all CPUs] [scale, 1 is the default amount of data] [directory, $TMPDIR or /tmp]
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Backend { BLOCKING, THREADS, URING };
+
+struct Config {
+    size_t loopers;
+    size_t files;
+    size_t fileSize;
+    size_t chunk;
+    std::string directory;
+    Backend backend;
+};
+
+Config config;
+
+const char *backendName(Backend backend) {
+    switch (backend) {
+        case Backend::THREADS:
+            return "threads";
+        case Backend::URING:
+            return "uring";
+        case Backend::BLOCKING:
+        default:
+            return "blocking";
+    }
+}
+
+void report(const std::string &benchmark, double value, const char *unit) {
+    std::ostringstream line;
+    line << "{\"benchmark\":\"" << benchmark << "\",\"backend\":\"" << backendName(config.backend)
+         << "\",\"loopers\":" << getMainThreadPool()->getLooperCount() << ",\"files\":" << config.files
+         << ",\"chunk\":" << config.chunk << ",\"value\":" << value << ",\"unit\":\"" << unit << "\"}\n";
+    std::cout << line.str() << std::flush;
+}
+
+std::string filePath(size_t index) {
+    return config.directory + "/file" + std::to_string(index);
+}
+
+void waitFor(const std::atomic_size_t &counter, size_t expected) {
+    while (counter.load(std::memory_order_acquire) < expected) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+// Runs `benchmark` and reports throughput of all files
+template<class Benchmark>
+void measure(const std::string &name, Benchmark &&benchmark) {
+    std::atomic_size_t done{0};
+    std::atomic_size_t failed{0};
+    auto start = Clock::now();
+    benchmark(done, failed);
+    waitFor(done, config.files);
+    auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (failed != 0) {
+        std::cerr << name << ": " << failed << " files failed\n";
+    }
+    auto mib = static_cast<double>(config.files * config.fileSize) / (1024.0 * 1024.0);
+    report(name, mib / seconds, "MiB/s");
+}
+
+// Blocking calls inside tasks, the way files are handled without AsyncFile
+void blockingIo(const std::string &name, bool write, bool sync) {
+    measure(name, [write, sync](std::atomic_size_t &done, std::atomic_size_t &failed) {
+        for (size_t i = 0; i < config.files; ++i) {
+            App->addTask([i, write, sync, &done, &failed]() {
+                auto fd = open(filePath(i).c_str(), write ? O_CREAT | O_TRUNC | O_WRONLY : O_RDONLY, 0644);
+                std::vector<char> buffer(config.chunk, 'x');
+                auto ok = fd >= 0;
+                for (size_t offset = 0; ok && offset < config.fileSize; offset += config.chunk) {
+                    auto size = std::min(config.chunk, config.fileSize - offset);
+                    auto offsetArg = static_cast<off_t>(offset);
+                    ok = (write ? pwrite(fd, buffer.data(), size, offsetArg)
+                                : pread(fd, buffer.data(), size, offsetArg)) == static_cast<ssize_t>(size);
+                }
+                if (ok && sync) {
+                    ok = fdatasync(fd) == 0;
+                }
+                if (fd >= 0) {
+                    close(fd);
+                }
+                if (!ok) {
+                    ++failed;
+                }
+                ++done;
+            });
+        }
+    });
+}
+
+// Chain of AsyncFile operations on one file
+struct FileJob {
+    AsyncFile file;
+    IoBuffer buffer;
+    size_t offset{0};
+    bool write{false};
+    bool sync{false};
+    std::atomic_size_t *done{nullptr};
+    std::atomic_size_t *failed{nullptr};
+};
+
+void finish(const std::shared_ptr<FileJob> &job, bool ok) {
+    if (!ok) {
+        ++*job->failed;
+    }
+    ++*job->done;
+}
+
+void step(std::shared_ptr<FileJob> job) {
+    if (job->offset >= config.fileSize) {
+        if (!job->sync) {
+            finish(job, true);
+            return;
+        }
+        job->file.fsync(true).then([job](IoResult result) {
+            finish(job, static_cast<bool>(result));
+        });
+        return;
+    }
+
+    auto size = std::min(config.chunk, config.fileSize - job->offset);
+    auto offset = static_cast<off_t>(job->offset);
+    auto promise = job->write ? job->file.write(job->buffer, size, offset) : job->file.read(job->buffer, size, offset);
+    promise.then([job, size](IoResult result) {
+        if (!result || result.value != static_cast<ssize_t>(size)) {
+            finish(job, false);
+            return;
+        }
+        job->offset += size;
+        step(job);
+    });
+}
+
+void asyncIo(const std::string &name, bool write, bool sync) {
+    measure(name, [write, sync](std::atomic_size_t &done, std::atomic_size_t &failed) {
+        for (size_t i = 0; i < config.files; ++i) {
+            auto flags = write ? O_CREAT | O_TRUNC | O_WRONLY : O_RDONLY;
+            AsyncFile::open(filePath(i), flags).then([write, sync, &done, &failed](AsyncFile file) {
+                auto job = std::make_shared<FileJob>();
+                job->write = write;
+                job->sync = sync;
+                job->done = &done;
+                job->failed = &failed;
+                if (!file.isValid()) {
+                    finish(job, false);
+                    return;
+                }
+                job->file = std::move(file);
+
+                // Taken on the looper the file's operations are submitted from, so it is registered there
+                job->buffer = AsyncFile::getBuffer();
+                std::memset(job->buffer.data(), 'x', job->buffer.size());
+                step(job);
+            });
+        }
+    });
+}
+
+// Runs in a child process: starts the application and drives the benchmarks from another thread
+int runAll() {
+    ThreadPoolOptions options;
+    options.loopers = config.loopers;
+    options.reactor = config.backend != Backend::BLOCKING;
+    options.fileIo = config.backend == Backend::URING ? FileIoBackend::URING : FileIoBackend::THREADS;
+
+    std::shared_ptr<Application> app;
+    try {
+        app = Application::create(options);
+    }
+    catch (const std::runtime_error &error) {
+        std::cerr << backendName(config.backend) << " skipped: " << error.what() << "\n";
+        return 0;
+    }
+
+    std::thread driver([]() {
+        // Pool is running once the first task completes
+        std::atomic_size_t started{0};
+        App->addTask([&started]() noexcept { started = 1; });
+        waitFor(started, 1);
+
+        auto run = config.backend == Backend::BLOCKING ? blockingIo : asyncIo;
+        run("write", true, false);
+        run("read", false, false);
+        run("write_fdatasync", true, true);
+
+        App->exit(0);
+    });
+
+    auto status = app->exec();
+    driver.join();
+    return status;
+}
+
+}
+
+int main(int argc, char **argv) {
+    config.loopers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 0;
+    auto scale = argc > 2 ? std::max(0.001, std::atof(argv[2])) : 1.0;
+    config.files = 64;
+    config.chunk = IoRing::DEFAULT_BUFFER_SIZE;
+    config.fileSize = std::max(config.chunk, static_cast<size_t>(4.0 * 1024 * 1024 * scale) / config.chunk * config.chunk);
+
+    std::string base = argc > 3 ? argv[3] : (std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp");
+    std::string pattern = base + "/filebench.XXXXXX";
+    if (!mkdtemp(pattern.data())) {
+        std::cerr << "can't create directory in " << base << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    config.directory = pattern;
+
+    auto status = 0;
+    for (auto backend : {Backend::BLOCKING, Backend::THREADS, Backend::URING}) {
+        config.backend = backend;
+
+        // Nothing buffered may be duplicated by the child
+        std::cout.flush();
+        auto child = fork();
+        if (child < 0) {
+            std::cerr << "fork failed\n";
+            status = 1;
+            break;
+        }
+        if (child == 0) {
+            std::_Exit(runAll());
+        }
+
+        int childStatus = 0;
+        waitpid(child, &childStatus, 0);
+        if (!WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0) {
+            std::cerr << backendName(backend) << " benchmarks failed\n";
+            status = 1;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < config.files; ++i) {
+        unlink(filePath(i).c_str());
+    }
+    rmdir(config.directory.c_str());
+    return status;
+}
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+
+// Scaling benchmark of parallelFor and parallelReduce against a serial loop.
+// Every element gets a few dozen nanoseconds of math, the caller thread is counted as one of the workers.
+//
+// Usage: parallelbench [max threads] [elements] [grain, 0 is automatic]
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double work(double x) {
+    return std::sqrt(x) * std::sin(x) + std::log1p(x);
+}
+
+template<class F>
+double measure(F &&f, int repeats = 5) {
+    // Best of several runs, the first one also warms up the loopers
+    double best = 1e300;
+    for (int i = 0; i < repeats; ++i) {
+        auto start = Clock::now();
+        f();
+        std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+}
+
+int main(int argc, char **argv) {
+    size_t maxThreads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : std::max(2u, std::thread::hardware_concurrency());
+    size_t count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1 << 22;
+    size_t grain = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 0;
+
+    std::vector<double> input(count), output(count);
+    for (size_t i = 0; i < count; ++i) {
+        input[i] = static_cast<double>(i % 1000) + 0.5;
+    }
+
+    double serialSum = 0;
+    auto serialFor = measure([&]() {
+        for (size_t i = 0; i < count; ++i) {
+            output[i] = work(input[i]);
+        }
+    });
+    auto serialReduce = measure([&]() {
+        double sum = 0;
+        for (size_t i = 0; i < count; ++i) {
+            sum += work(input[i]);
+        }
+        serialSum = sum;
+    });
+
+    std::cout << "elements: " << count << ", grain: " << (grain ? std::to_string(grain) : "auto") << "\n";
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << std::setw(8) << "threads"
+              << std::setw(12) << "for ms" << std::setw(10) << "speedup"
+              << std::setw(12) << "reduce ms" << std::setw(10) << "speedup" << "\n";
+    std::cout << std::setw(8) << "serial"
+              << std::setw(12) << serialFor << std::setw(10) << 1.0
+              << std::setw(12) << serialReduce << std::setw(10) << 1.0 << "\n";
+
+    // 2, 4, 8... and max threads
+    for (size_t threads = 2; threads <= maxThreads; threads = threads == maxThreads ? threads + 1 : std::min(threads * 2, maxThreads)) {
+        // Caller helps with the work, so the pool has one looper less
+        auto pool = std::make_shared<ThreadPool>(threads - 1);
+        setMainThreadPool(pool);
+        pool->start();
+
+        auto forTime = measure([&]() {
+            parallelFor(size_t{0}, count, grain, [&](size_t i) {
+                output[i] = work(input[i]);
+            });
+        });
+
+        double sum = 0;
+        auto reduceTime = measure([&]() {
+            sum = parallelReduce(size_t{0}, count, 0.0, [&](size_t i) { return work(input[i]); },
+                                 [](double a, double b) { return a + b; }, grain);
+        });
+
+        pool->stop();
+        setMainThreadPool(nullptr);
+
+        // Summation order differs, so the sum is compared with a tolerance
+        if (std::abs(sum - serialSum) > 1e-6 * std::abs(serialSum)) {
+            std::cerr << "reduce result mismatch: " << sum << " vs " << serialSum << "\n";
+            return 1;
+        }
+
+        std::cout << std::setw(8) << threads
+                  << std::setw(12) << forTime << std::setw(10) << serialFor / forTime
+                  << std::setw(12) << reduceTime << std::setw(10) << serialReduce / reduceTime << "\n";
+    }
+
+    return 0;
+}
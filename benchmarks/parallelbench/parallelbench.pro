@@ -0,0 +1,6 @@
+TEMPLATE = app
+TARGET = parallelbench
+
+include(../../eventpp.pri)
+
+SOURCES += main.cpp
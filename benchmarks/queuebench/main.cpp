@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "taskqueue.h"
+#include "lockfreetaskqueue.h"
+
+// Contention benchmark of global task queue implementations.
+// P producers push tasks while C consumers remove them, throughput of the whole run is reported.
+//
+// Usage: queuebench [consumers] [tasks per run]
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double run(TaskQueueBase &queue, size_t producers, size_t consumers, size_t total) {
+    const size_t perProducer = total / producers;
+    const size_t expected = perProducer * producers;
+
+    std::atomic_bool go{false};
+    std::atomic_size_t consumed{0};
+    std::vector<std::thread> threads;
+
+    for (size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&queue, &go, perProducer]() noexcept {
+            // Every producer owns a small set of tasks, so refcounts are not shared between producers
+            std::vector<TaskRef> tasks;
+            for (size_t i = 0; i < 64; ++i) {
+                tasks.emplace_back(new Task());
+            }
+            while (!go) {
+                std::this_thread::yield();
+            }
+            for (size_t i = 0; i < perProducer; ++i) {
+                queue.push(tasks[i % tasks.size()]);
+            }
+        });
+    }
+
+    for (size_t c = 0; c < consumers; ++c) {
+        threads.emplace_back([&queue, &go, &consumed, expected]() noexcept {
+            while (!go) {
+                std::this_thread::yield();
+            }
+            while (consumed.load(std::memory_order_relaxed) < expected) {
+                if (queue.remove()) {
+                    consumed.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+
+    auto start = Clock::now();
+    go = true;
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    return static_cast<double>(expected) / elapsed.count() / 1e6;
+}
+
+}
+
+int main(int argc, char **argv) {
+    size_t consumers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4;
+    size_t total = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1 << 20;
+
+    std::cout << "consumers: " << consumers << ", tasks per run: " << total << "\n";
+    std::cout << std::setw(10) << "producers"
+              << std::setw(16) << "mutex Mops/s"
+              << std::setw(18) << "lock-free Mops/s" << "\n";
+
+    for (size_t producers = 1; producers <= 64; producers *= 2) {
+        auto mutexQueue = makeTaskQueue(QueueType::MUTEX);
+        auto lockFreeQueue = makeTaskQueue(QueueType::LOCK_FREE);
+
+        auto mutexRate = run(*mutexQueue, producers, consumers, total);
+        auto lockFreeRate = run(*lockFreeQueue, producers, consumers, total);
+
+        std::cout << std::setw(10) << producers
+                  << std::setw(16) << std::fixed << std::setprecision(2) << mutexRate
+                  << std::setw(18) << lockFreeRate << "\n";
+    }
+
+    return 0;
+}
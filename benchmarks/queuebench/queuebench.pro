@@ -0,0 +1,6 @@
+TEMPLATE = app
+TARGET = queuebench
+
+include(../../eventpp.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,352 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "application.h"
+#include "event.h"
+#include "latencyhistogram.h"
+#include "promise.h"
+
+// Scheduler microbenchmarks: submission throughput, round trip and wakeup latency, dispatch cost of binding
+// policies, promise chains and event fan-out. Application is a singleton, so every looper count runs in its
+// own child process. Benchmarks are driven from a thread outside the pool.
+//
+// Results go to stdout as JSON lines, one object per measurement, so runs can be diffed or compared with jq:
+//   {"benchmark":"wakeup_latency","loopers":4,"scheduler":"global","param":"","value":5123,"unit":"ns",...}
+//
+// Usage: schedbench [looper counts, e.g. 1,2,4] [scheduler: global|ws] [scale, 1 is the default amount of work]
+//                   [idle strategy: adaptive|spin|park]
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Config {
+    size_t loopers;
+    SchedulerMode scheduler;
+    double scale;
+    IdleStrategy idle;
+};
+
+Config config;
+
+size_t scaled(size_t count) {
+    return std::max<size_t>(1, static_cast<size_t>(static_cast<double>(count) * config.scale));
+}
+
+const char *idleName(IdleStrategy strategy) {
+    switch (strategy) {
+        case IdleStrategy::PARK:
+            return "park";
+        case IdleStrategy::SPIN:
+            return "spin";
+        case IdleStrategy::ADAPTIVE:
+        default:
+            return "adaptive";
+    }
+}
+
+void report(const std::string &benchmark, const std::string &param, double value, const char *unit,
+            const LatencyStats *stats = nullptr) {
+    std::ostringstream line;
+    line << "{\"benchmark\":\"" << benchmark << "\",\"loopers\":" << config.loopers
+         << ",\"scheduler\":\"" << (config.scheduler == SchedulerMode::WORK_STEALING ? "ws" : "global")
+         << "\",\"idle\":\"" << idleName(config.idle) << "\",\"param\":\"" << param << "\",\"value\":" << value << ",\"unit\":\"" << unit << "\"";
+    if (stats) {
+        line << ",\"count\":" << stats->count << ",\"mean_ns\":" << stats->mean().count()
+             << ",\"p50_ns\":" << stats->percentile(0.5).count() << ",\"p99_ns\":" << stats->percentile(0.99).count()
+             << ",\"max_ns\":" << stats->max().count();
+    }
+    line << "}\n";
+    std::cout << line.str() << std::flush;
+}
+
+double nsSince(Clock::time_point start) {
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+void waitFor(const std::atomic_size_t &counter, size_t expected) {
+    while (counter.load(std::memory_order_acquire) < expected) {
+        std::this_thread::yield();
+    }
+}
+
+// Sleeping loopers make every measurement include a wake up, so latency benchmarks start from a known state
+void waitUntilIdle() {
+    auto pool = getMainThreadPool();
+    while (pool->getIdleCount() < pool->getLooperCount()) {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+void submitThroughput() {
+    auto count = scaled(200000);
+    std::atomic_size_t done{0};
+    auto increment = [&done]() noexcept { done.fetch_add(1, std::memory_order_relaxed); };
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        App->addTask(increment);
+    }
+    waitFor(done, count);
+    report("submit_throughput", "single", static_cast<double>(count) * 1e9 / nsSince(start), "tasks/s");
+
+    done = 0;
+    constexpr size_t BATCH = 64;
+    std::vector<TaskRef> batch;
+    start = Clock::now();
+    for (size_t i = 0; i < count; i += BATCH) {
+        batch.clear();
+        for (size_t j = 0; j < BATCH && i + j < count; ++j) {
+            batch.emplace_back(new Task(increment));
+        }
+        getMainThreadPool()->addTasks(batch);
+    }
+    waitFor(done, count);
+    report("submit_throughput", "batch64", static_cast<double>(count) * 1e9 / nsSince(start), "tasks/s");
+}
+
+void roundTripLatency() {
+    LatencyHistogram histogram;
+    std::atomic_size_t done{0};
+    for (size_t i = 0; i < scaled(5000); ++i) {
+        auto start = Clock::now();
+        App->addTask([&done]() noexcept { done.fetch_add(1, std::memory_order_release); });
+        waitFor(done, i + 1);
+        histogram.record(Clock::now() - start);
+    }
+    auto stats = histogram.snapshot();
+    report("roundtrip_latency", "external", static_cast<double>(stats.mean().count()), "ns", &stats);
+
+    // Every task submits the next one from inside the pool
+    struct Hop {
+        static void run(size_t left, std::atomic_size_t &finished) {
+            if (left == 0) {
+                finished.store(1, std::memory_order_release);
+                return;
+            }
+            App->addTask([left, &finished]() noexcept { run(left - 1, finished); });
+        }
+    };
+    auto hops = scaled(100000);
+    std::atomic_size_t finished{0};
+    auto start = Clock::now();
+    Hop::run(hops, finished);
+    waitFor(finished, 1);
+    report("roundtrip_latency", "in_pool_hop", nsSince(start) / static_cast<double>(hops), "ns");
+}
+
+void dispatchCost() {
+    struct Case {
+        const char *name;
+        TaskPolicy policy;
+    };
+    auto last = static_cast<int>(config.loopers) - 1;
+    std::vector<Case> cases = {
+        {"unbound", TaskPolicy{TaskBindingPolicy::UNBOUND}},
+        {"bound", TaskPolicy{TaskBindingPolicy::BOUND, last}},
+    };
+    // Needs a looper besides the excluded one
+    if (config.loopers > 1) {
+        cases.push_back({"unbound_except", TaskPolicy{TaskBindingPolicy::UNBOUND_EXCEPT, 0}});
+    }
+
+    auto count = scaled(100000);
+    for (auto &item : cases) {
+        std::atomic_size_t done{0};
+        auto start = Clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            App->addTask(new Task([&done]() noexcept { done.fetch_add(1, std::memory_order_relaxed); }, item.policy));
+        }
+        waitFor(done, count);
+        report("dispatch_cost", item.name, nsSince(start) / static_cast<double>(count), "ns/task");
+    }
+}
+
+void chain(int left, std::atomic_size_t &done) {
+    Promise<int>([left]() noexcept { return left - 1; }).then([&done](int next) noexcept {
+        if (next == 0) {
+            done.fetch_add(1, std::memory_order_release);
+        }
+        else {
+            chain(next, done);
+        }
+    });
+}
+
+void promiseChain() {
+    for (int depth : {1, 16, 256}) {
+        LatencyHistogram histogram;
+        std::atomic_size_t done{0};
+        auto repeats = scaled(depth == 256 ? 100 : 1000);
+        for (size_t i = 0; i < repeats; ++i) {
+            auto start = Clock::now();
+            chain(depth, done);
+            waitFor(done, i + 1);
+            histogram.record(Clock::now() - start);
+        }
+        auto stats = histogram.snapshot();
+        report("promise_chain", "depth" + std::to_string(depth), static_cast<double>(stats.mean().count()), "ns", &stats);
+    }
+}
+
+struct Host {
+    Event<Host, int> event;
+    AsyncEvent<Host, int> asyncEvent;
+
+    void fire(int value) {
+        event(value);
+    }
+
+    void fireAsync(int value) {
+        asyncEvent(value);
+    }
+};
+
+void eventFanOut() {
+    for (size_t handlers : {size_t{1}, size_t{16}, size_t{256}}) {
+        Host host;
+        std::atomic_size_t calls{0};
+        for (size_t i = 0; i < handlers; ++i) {
+            host.event += [&calls](int value) noexcept { calls.fetch_add(static_cast<size_t>(value), std::memory_order_relaxed); };
+            host.asyncEvent += [&calls](int value) noexcept { calls.fetch_add(static_cast<size_t>(value), std::memory_order_release); };
+        }
+
+        auto invocations = scaled(handlers == 256 ? 2000 : 20000);
+        auto start = Clock::now();
+        for (size_t i = 0; i < invocations; ++i) {
+            host.fire(1);
+        }
+        report("event_fanout", "sync_h" + std::to_string(handlers), nsSince(start) / static_cast<double>(invocations),
+               "ns/invoke");
+
+        // Time until every handler of one invocation ran
+        LatencyHistogram histogram;
+        calls = 0;
+        for (size_t i = 0; i < invocations / 10 + 1; ++i) {
+            auto fired = Clock::now();
+            host.fireAsync(1);
+            waitFor(calls, (i + 1) * handlers);
+            histogram.record(Clock::now() - fired);
+        }
+        auto stats = histogram.snapshot();
+        report("event_fanout", "async_h" + std::to_string(handlers), static_cast<double>(stats.mean().count()), "ns",
+               &stats);
+    }
+}
+
+void wakeupLatency() {
+    LatencyHistogram histogram;
+    std::atomic_size_t done{0};
+    std::atomic<int64_t> started{0};
+    for (size_t i = 0; i < scaled(300); ++i) {
+        waitUntilIdle();
+        auto start = Clock::now();
+        App->addTask([&]() noexcept {
+            started.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+            done.fetch_add(1, std::memory_order_release);
+        });
+        waitFor(done, i + 1);
+        histogram.record(Clock::duration(started.load(std::memory_order_relaxed)) - start.time_since_epoch());
+    }
+    auto stats = histogram.snapshot();
+    report("wakeup_latency", "", static_cast<double>(stats.mean().count()), "ns", &stats);
+}
+
+// Runs in a child process: starts the application and drives the benchmarks from another thread
+int runAll() {
+    ThreadPoolOptions options;
+    options.loopers = config.loopers;
+    options.scheduler = config.scheduler;
+    options.idle.strategy = config.idle;
+    auto app = Application::create(options);
+
+    std::thread driver([]() {
+        // Pool is running once the first task completes
+        std::atomic_size_t started{0};
+        App->addTask([&started]() noexcept { started = 1; });
+        waitFor(started, 1);
+
+        submitThroughput();
+        roundTripLatency();
+        dispatchCost();
+        promiseChain();
+        eventFanOut();
+        wakeupLatency();
+
+        App->exit(0);
+    });
+
+    auto status = app->exec();
+    driver.join();
+    return status;
+}
+
+std::vector<size_t> parseCounts(const std::string &list) {
+    std::vector<size_t> counts;
+    std::istringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (auto count = std::strtoul(item.c_str(), nullptr, 10)) {
+            counts.push_back(count);
+        }
+    }
+    return counts;
+}
+
+}
+
+int main(int argc, char **argv) {
+    std::vector<size_t> counts;
+    if (argc > 1) {
+        counts = parseCounts(argv[1]);
+    }
+    else {
+        // 1, 2, 4... and all CPUs the process may use
+        auto cores = Topology::detect().getRecommendedLooperCount();
+        for (size_t count = 1; count < cores; count *= 2) {
+            counts.push_back(count);
+        }
+        counts.push_back(cores);
+    }
+    config.scheduler = argc > 2 && std::string(argv[2]) == "ws" ? SchedulerMode::WORK_STEALING
+                                                                : SchedulerMode::GLOBAL_QUEUE;
+    config.scale = argc > 3 ? std::max(0.001, std::atof(argv[3])) : 1.0;
+    config.idle = IdleStrategy::ADAPTIVE;
+    if (argc > 4) {
+        config.idle = std::string(argv[4]) == "park" ? IdleStrategy::PARK
+                    : std::string(argv[4]) == "spin" ? IdleStrategy::SPIN : IdleStrategy::ADAPTIVE;
+    }
+
+    for (auto count : counts) {
+        config.loopers = count;
+
+        // Nothing buffered may be duplicated by the child
+        std::cout.flush();
+        auto child = fork();
+        if (child < 0) {
+            std::cerr << "fork failed\n";
+            return 1;
+        }
+        if (child == 0) {
+            std::_Exit(runAll());
+        }
+
+        int status = 0;
+        waitpid(child, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << "benchmarks with " << count << " loopers failed\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,6 @@
+TEMPLATE = app
+TARGET = schedbench
+
+include(../../eventpp.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,50 @@
+#include <algorithm>
+
+#include "cancellation.h"
+#include "task.h"
+#include "threadpool.h"
+
+std::atomic_uint64_t CancellationToken::_cancelCount{0};
+
+CancellationToken CancellationToken::create() {
+    CancellationToken token;
+    token._state = std::make_shared<State>();
+    return token;
+}
+
+bool CancellationToken::isCanceled() const noexcept {
+    return _state && _state->canceled.load(std::memory_order_acquire);
+}
+
+void CancellationToken::cancel() noexcept {
+    if (_state && !_state->canceled.exchange(true, std::memory_order_acq_rel)) {
+        _cancelCount.fetch_add(1, std::memory_order_relaxed);
+
+        // Queued tasks of the token are purged right away instead of waiting for other work
+        wakeThreadPoolsToPurge();
+    }
+}
+
+bool CancellationToken::isValid() const noexcept {
+    return _state != nullptr;
+}
+
+uint64_t CancellationToken::getCancelCount() noexcept {
+    return _cancelCount.load(std::memory_order_relaxed);
+}
+
+bool PurgeTrigger::isDue(size_t size) const noexcept {
+    if (size == 0) {
+        return false;
+    }
+    if (CancellationToken::getCancelCount() != _tokens.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    auto canceled = Task::getCancelCount() - _tasks.load(std::memory_order_relaxed);
+    return canceled >= std::max<uint64_t>(MIN_CANCELED, size / 4);
+}
+
+void PurgeTrigger::reset() noexcept {
+    _tasks.store(Task::getCancelCount(), std::memory_order_relaxed);
+    _tokens.store(CancellationToken::getCancelCount(), std::memory_order_relaxed);
+}
@@ -0,0 +1,57 @@
+#ifndef CANCELLATION_H
+#define CANCELLATION_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Cancellation flag shared by a group of tasks. Copies refer to the same flag, so canceling any of them
+// cancels every task holding the token, see `Task::setCancellationToken()`. Running tasks can poll
+// `isCanceled()` to stop early. Default constructed token is never canceled and costs nothing
+class CancellationToken {
+    struct State {
+        std::atomic_bool canceled{false};
+    };
+
+    std::shared_ptr<State> _state;
+
+    // Number of canceled tokens, see PurgeTrigger
+    static std::atomic_uint64_t _cancelCount;
+
+public:
+    CancellationToken() noexcept = default;
+
+    // Creates a new token which can be canceled
+    static CancellationToken create();
+
+    bool isCanceled() const noexcept;
+
+    // Cancels all tasks holding the token. Queued tasks are dropped, running ones go on until they poll
+    void cancel() noexcept;
+
+    // Can the token be canceled at all
+    bool isValid() const noexcept;
+
+    static uint64_t getCancelCount() noexcept;
+};
+
+// Tells when a queue is worth scanning for canceled tasks: after any token was canceled or when tasks
+// canceled since the last scan could be a noticeable part of the queue. Scans are O(queue size),
+// so a burst of cancellations costs a few scans instead of one per task
+class PurgeTrigger {
+    std::atomic_uint64_t _tasks{0};
+    std::atomic_uint64_t _tokens{0};
+
+public:
+    // Min number of canceled tasks worth a scan
+    static constexpr uint64_t MIN_CANCELED = 64;
+
+    // Should a queue holding `size` tasks be scanned
+    bool isDue(size_t size) const noexcept;
+
+    // Remembers current counters, called right before the scan
+    void reset() noexcept;
+};
+
+#endif // CANCELLATION_H
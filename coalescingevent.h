@@ -0,0 +1,254 @@
+#ifndef COALESCINGEVENT_H
+#define COALESCINGEVENT_H
+
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <type_traits>
+
+#include "event.h"
+
+enum class CoalescingMode {
+    // Handler gets only the latest arguments fired before its delivery ran
+    LATEST,
+    // Handler gets everything fired during the window as one batch
+    BATCH,
+    // Like LATEST, but deliveries to a handler are at least an interval apart
+    RATE_LIMIT
+};
+
+// Element of a batch: the argument itself for one-argument events, a tuple otherwise
+template <class... Args>
+struct BatchItem {
+    using type = std::tuple<std::decay_t<Args>...>;
+};
+
+template <class Arg>
+struct BatchItem<Arg> {
+    using type = std::decay_t<Arg>;
+};
+
+// Event for producers firing much faster than handlers need. Firing only stores the arguments for every
+// handler, a handler with a delivery pending already doesn't get another one: each subscriber has at most
+// one queued task, whatever the firing rate. Deliveries to one handler never overlap.
+// `interval` is the delay of a delivery after the first firing for LATEST and BATCH (zero delivers on the
+// next free looper), and the min time between deliveries for RATE_LIMIT
+template <class F, CoalescingMode Mode, class... Args>
+class CoalescingEvent {
+    friend F;
+
+public:
+    using Item = typename BatchItem<Args...>::type;
+    using Batch = std::vector<Item>;
+    using Callback = std::conditional_t<Mode == CoalescingMode::BATCH,
+                                        std::function<void(Batch)>,
+                                        std::function<void(Args...)>>;
+
+private:
+    // Arguments waiting for the delivery
+    using Pending = std::conditional_t<Mode == CoalescingMode::BATCH,
+                                       Batch,
+                                       std::optional<std::tuple<std::decay_t<Args>...>>>;
+
+    struct Handler : EventHandlerBase {
+        Callback callback;
+        const TaskClock::duration interval;
+
+        // Guards the fields below, taken by firings and the delivery for a few stores
+        std::mutex mutex;
+        Pending pending;
+        // Delivery task is queued or running
+        bool scheduled = false;
+        TaskClock::time_point lastDelivery = TaskClock::time_point::min();
+
+        Handler(Callback function, TaskClock::duration window)
+            : callback{std::move(function)}, interval{window} {}
+
+        bool hasPending() const noexcept {
+            if constexpr (Mode == CoalescingMode::BATCH) {
+                return !pending.empty();
+            }
+            else {
+                return pending.has_value();
+            }
+        }
+
+        // When the delivery of pending arguments should run
+        TaskClock::time_point dueTime(TaskClock::time_point now) const noexcept {
+            if constexpr (Mode == CoalescingMode::RATE_LIMIT) {
+                return std::max(now, lastDelivery + interval);
+            }
+            else {
+                return now + interval;
+            }
+        }
+    };
+
+    // Delivers pending arguments of one handler, then schedules itself again if more were fired meanwhile
+    class DeliveryTask : public Task {
+        std::shared_ptr<Handler> _handler;
+
+    public:
+        explicit DeliveryTask(std::shared_ptr<Handler> handler) noexcept
+            : _handler{std::move(handler)} {}
+
+    protected:
+        void run() override {
+            auto &handler = *_handler;
+            Pending pending;
+            {
+                std::lock_guard<std::mutex> lock(handler.mutex);
+                pending = std::exchange(handler.pending, Pending{});
+                handler.lastDelivery = TaskClock::now();
+            }
+
+            // Unsubscribed while the delivery was queued
+            if (handler.active.load(std::memory_order_acquire)) {
+                try {
+                    if constexpr (Mode == CoalescingMode::BATCH) {
+                        handler.callback(std::move(pending));
+                    }
+                    else {
+                        std::apply(handler.callback, std::move(*pending));
+                    }
+                }
+                catch (...) {
+                    // Handler keeps getting deliveries, the exception goes on to the looper
+                    scheduleNext();
+                    throw;
+                }
+            }
+            scheduleNext();
+        }
+
+    private:
+        // Clears `scheduled` or schedules delivery of arguments fired meanwhile
+        void scheduleNext() {
+            auto &handler = *_handler;
+            auto now = TaskClock::now();
+            TaskClock::time_point due;
+            {
+                std::lock_guard<std::mutex> lock(handler.mutex);
+                if (!handler.hasPending()) {
+                    handler.scheduled = false;
+                    return;
+                }
+                due = handler.dueTime(now);
+            }
+            schedule(_handler, due, now);
+        }
+    };
+
+    HandlerList<Handler> _handlers;
+    const TaskClock::duration _interval;
+
+public:
+    explicit CoalescingEvent(TaskClock::duration interval = TaskClock::duration::zero())
+        : _interval{interval} {}
+
+    // Copies get their own handlers with nothing pending, subscriptions stay with the original event
+    CoalescingEvent(const CoalescingEvent &other)
+        : _interval{other._interval} {
+        copyFrom(other);
+    }
+
+    virtual ~CoalescingEvent() = default;
+
+    CoalescingEvent &operator=(const CoalescingEvent &other) {
+        if (this != &other) {
+            copyFrom(other);
+        }
+        return *this;
+    }
+
+    Subscription operator+=(Callback callback) {
+        return _handlers.add(std::make_shared<Handler>(std::move(callback), _interval));
+    }
+
+    void operator-=(Subscription &subscription) noexcept {
+        subscription.unsubscribe();
+    }
+
+    TaskClock::duration getInterval() const noexcept {
+        return _interval;
+    }
+
+protected:
+    virtual void invoke(Args... args) {
+        auto snapshot = _handlers.acquire();
+        if (snapshot.handlers().empty()) {
+            return;
+        }
+
+        auto now = TaskClock::now();
+        for (auto &handler : snapshot.handlers()) {
+            if (!handler->active.load(std::memory_order_acquire)) {
+                continue;
+            }
+
+            TaskClock::time_point due;
+            {
+                std::lock_guard<std::mutex> lock(handler->mutex);
+                if constexpr (Mode == CoalescingMode::BATCH) {
+                    handler->pending.emplace_back(args...);
+                }
+                else {
+                    handler->pending.emplace(args...);
+                }
+
+                // Pending delivery picks up the new arguments
+                if (std::exchange(handler->scheduled, true)) {
+                    continue;
+                }
+                due = handler->dueTime(now);
+            }
+            schedule(handler, due, now);
+        }
+    }
+
+    void operator()(Args... args) {
+        invoke(args...);
+    }
+
+    void swap(CoalescingEvent &other) {
+        _handlers.swap(other._handlers);
+    }
+
+private:
+    static void schedule(const std::shared_ptr<Handler> &handler, TaskClock::time_point due, TaskClock::time_point now) {
+        TaskRef task(new DeliveryTask(handler));
+        if (due <= now) {
+            Application::getInstance()->addTask(std::move(task));
+        }
+        else {
+            Application::getInstance()->addTaskAt(due, std::move(task));
+        }
+    }
+
+    void copyFrom(const CoalescingEvent &other) {
+        std::vector<std::shared_ptr<Handler>> copies;
+        {
+            auto snapshot = other._handlers.acquire();
+            for (auto &handler : snapshot.handlers()) {
+                if (handler->active.load(std::memory_order_acquire)) {
+                    copies.push_back(std::make_shared<Handler>(handler->callback, _interval));
+                }
+            }
+        }
+        _handlers.assign(std::move(copies));
+    }
+};
+
+// Handler gets only the latest arguments, `window` delays the delivery to coalesce more firings
+template <class F, class... Args>
+using LatestEvent = CoalescingEvent<F, CoalescingMode::LATEST, Args...>;
+
+// Handler gets `std::vector` of everything fired during `window`
+template <class F, class... Args>
+using BatchEvent = CoalescingEvent<F, CoalescingMode::BATCH, Args...>;
+
+// Handler gets the latest arguments at most once per `interval`
+template <class F, class... Args>
+using RateLimitedEvent = CoalescingEvent<F, CoalescingMode::RATE_LIMIT, Args...>;
+
+#endif // COALESCINGEVENT_H
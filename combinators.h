@@ -0,0 +1,220 @@
+#ifndef COMBINATORS_H
+#define COMBINATORS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ranges>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "promise.h"
+
+// Promise which is fulfilled when all or any of input promises are finished.
+// Every input gets a hook on its completion path, the input finishing last (or first for `whenAny`) executes
+// this task in place, so no task is allocated or scheduled for the combination itself.
+// `whenAll` is canceled as soon as any input is canceled, `whenAny` when all of them are
+template<class R>
+class CombinatorTask : public PromiseTask<R> {
+    using Collect = R (*)(const CombinatorTask &combinator);
+
+    struct InputHook : CompletionHook {
+        CombinatorTask *owner;
+        TaskRef input;
+        size_t index;
+    };
+
+    std::vector<InputHook> _inputs;
+
+    // Builds result from finished inputs
+    const Collect _collect;
+
+    // Finish after the first input instead of the last one
+    const bool _any;
+
+    // Hooks not fired yet
+    std::atomic_size_t _remaining;
+
+    // Index of the first finished input
+    std::atomic_size_t _first{SIZE_MAX};
+
+    // Inputs keep raw pointers to the hooks, so the task keeps itself alive until all of them are fired
+    TaskRef _self;
+
+public:
+    CombinatorTask(size_t count, bool any, Collect collect)
+        : _inputs(count), _collect{collect}, _any{any}, _remaining{count} {}
+
+    // Hooks inputs up. Has to be called once, right after construction. Inputs finished already fire immediately
+    void attach(const TaskRef *inputs) {
+        if (_inputs.empty()) {
+            this->execute();
+            return;
+        }
+
+        _self = TaskRef(this);
+        for (size_t i = 0; i < _inputs.size(); ++i) {
+            auto &hook = _inputs[i];
+            hook.fire = &CombinatorTask::fire;
+            hook.owner = this;
+            hook.input = inputs[i];
+            hook.index = i;
+        }
+
+        // Hooks are filled before the first one can fire
+        for (auto &hook : _inputs) {
+            if (!static_cast<PromiseTaskBase*>(hook.input.get())->addHook(&hook)) {
+                fire(&hook);
+            }
+        }
+    }
+
+    size_t getInputCount() const noexcept {
+        return _inputs.size();
+    }
+
+    const TaskRef &getInput(size_t index) const noexcept {
+        return _inputs[index].input;
+    }
+
+    size_t getFirst() const noexcept {
+        return _first.load(std::memory_order_acquire);
+    }
+
+protected:
+    void run() override {
+        this->produce([this]() { return _collect(*this); });
+    }
+
+private:
+    static void fire(CompletionHook *hook) {
+        auto input = static_cast<InputHook*>(hook);
+        auto owner = input->owner;
+        auto canceled = input->input->getState() == TaskState::CANCELED;
+
+        if (owner->_any) {
+            size_t none = SIZE_MAX;
+            if (!canceled && owner->_first.compare_exchange_strong(none, input->index, std::memory_order_acq_rel)) {
+                owner->execute();
+            }
+        }
+        else if (canceled) {
+            owner->cancel();
+        }
+
+        if (owner->_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // Execution is a no-op for the canceled task
+            if (!owner->_any) {
+                owner->execute();
+            }
+            else if (owner->getFirst() == SIZE_MAX) {
+                owner->cancel();
+            }
+            // Can free the owner
+            auto self = std::move(owner->_self);
+        }
+    }
+};
+
+// Value taken from a finished promise. Promise<void> gives std::monostate
+template<class T>
+using PromiseValue = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+// Rethrows the exception of the input, so the combination fails with it
+template<class T>
+PromiseValue<T> promiseValue(const TaskRef &task) {
+    if constexpr (std::is_void_v<T>) {
+        static_cast<PromiseTask<void>*>(task.get())->take();
+        return {};
+    }
+    else {
+        return static_cast<PromiseTask<T>*>(task.get())->take();
+    }
+}
+
+// Result type of a promise
+template<class P>
+struct PromiseResult;
+
+template<class T>
+struct PromiseResult<Promise<T>> {
+    using type = T;
+};
+
+template<class R>
+Promise<R> startCombinator(const TaskRef *inputs, size_t count, bool any, R (*collect)(const CombinatorTask<R> &)) {
+    auto task = new CombinatorTask<R>(count, any, collect);
+    TaskRef ref(task);
+    auto promise = Promise<R>::deferred(ref);
+    task->attach(inputs);
+    return promise;
+}
+
+// Fulfilled with a tuple of all results when every promise is finished. Results are moved from the promises
+template<class... Ts>
+Promise<std::tuple<PromiseValue<Ts>...>> whenAll(Promise<Ts>... promises) {
+    using Result = std::tuple<PromiseValue<Ts>...>;
+    std::array<TaskRef, sizeof...(Ts)> inputs{promises.getTask()...};
+    return startCombinator<Result>(inputs.data(), inputs.size(), false, [](const CombinatorTask<Result> &combinator) {
+        return [&]<size_t... I>(std::index_sequence<I...>) {
+            return Result{promiseValue<Ts>(combinator.getInput(I))...};
+        }(std::index_sequence_for<Ts...>{});
+    });
+}
+
+// Fulfilled with results in order of the range when every promise is finished. Results are moved from
+// the promises, so they can't be consumed otherwise. Range of Promise<void> gives Promise<void>
+template<std::ranges::input_range Range>
+auto whenAll(Range &&promises) {
+    using T = typename PromiseResult<std::ranges::range_value_t<std::remove_reference_t<Range>>>::type;
+    using Result = std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+
+    std::vector<TaskRef> inputs;
+    for (auto &promise : promises) {
+        inputs.push_back(promise.getTask());
+    }
+    return startCombinator<Result>(inputs.data(), inputs.size(), false, [](const CombinatorTask<Result> &combinator) {
+        if constexpr (!std::is_void_v<T>) {
+            Result result;
+            result.reserve(combinator.getInputCount());
+            for (size_t i = 0; i < combinator.getInputCount(); ++i) {
+                result.push_back(promiseValue<T>(combinator.getInput(i)));
+            }
+            return result;
+        }
+        else {
+            for (size_t i = 0; i < combinator.getInputCount(); ++i) {
+                promiseValue<void>(combinator.getInput(i));
+            }
+        }
+    });
+}
+
+// Fulfilled with the index of the first finished promise
+template<class... Ts>
+Promise<size_t> whenAny(const Promise<Ts>&... promises) {
+    static_assert(sizeof...(Ts) > 0, "whenAny needs at least one promise");
+    std::array<TaskRef, sizeof...(Ts)> inputs{promises.getTask()...};
+    return startCombinator<size_t>(inputs.data(), inputs.size(), true, [](const CombinatorTask<size_t> &combinator) {
+        return combinator.getFirst();
+    });
+}
+
+template<std::ranges::input_range Range>
+Promise<size_t> whenAny(const Range &promises) {
+    std::vector<TaskRef> inputs;
+    for (auto &promise : promises) {
+        inputs.push_back(promise.getTask());
+    }
+    if (inputs.empty()) {
+        throw std::runtime_error("whenAny needs at least one promise");
+    }
+    return startCombinator<size_t>(inputs.data(), inputs.size(), true, [](const CombinatorTask<size_t> &combinator) {
+        return combinator.getFirst();
+    });
+}
+
+#endif // COMBINATORS_H
@@ -0,0 +1,241 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <thread>
+#include <utility>
+
+#include "promise.h"
+#include "taskallocator.h"
+#include "threadpool.h"
+
+template<class T>
+class Coroutine;
+
+// Part of coroutine promise types independent from the result type
+class CoroutinePromiseBase {
+protected:
+    // Values of `_state` besides the address of awaiting coroutine
+    static inline void *const DONE = reinterpret_cast<void*>(uintptr_t{1});
+    static inline void *const DETACHED = reinterpret_cast<void*>(uintptr_t{2});
+
+    // nullptr while running, then DONE, DETACHED or awaiting coroutine, whichever comes first
+    std::atomic<void*> _state{nullptr};
+
+    std::exception_ptr _error;
+
+    // Resumes awaiting coroutine in place of the finished one, or frees the frame nobody owns
+    struct FinalAwaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        template<class Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            auto state = handle.promise()._state.exchange(DONE, std::memory_order_acq_rel);
+            if (state == DETACHED) {
+                handle.destroy();
+            }
+            else if (state != nullptr) {
+                return std::coroutine_handle<>::from_address(state);
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+public:
+    // Frames are small and short-lived, they come from the same slabs as tasks
+    static void *operator new(size_t size) {
+        return TaskAllocator::allocate(size);
+    }
+
+    static void operator delete(void *ptr) noexcept {
+        TaskAllocator::deallocate(ptr);
+    }
+
+    // Coroutine starts in the calling thread and runs until the first suspension
+    std::suspend_never initial_suspend() const noexcept {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() const noexcept {
+        return {};
+    }
+
+    void unhandled_exception() noexcept {
+        _error = std::current_exception();
+    }
+
+    bool isDone() const noexcept {
+        return _state.load(std::memory_order_acquire) == DONE;
+    }
+
+    // Makes `awaiting` resume when this coroutine finishes. Returns false if it finished already
+    bool setContinuation(std::coroutine_handle<> awaiting) noexcept {
+        void *expected = nullptr;
+        return _state.compare_exchange_strong(expected, awaiting.address(), std::memory_order_acq_rel);
+    }
+
+    // Gives up the frame. Returns true if the coroutine is finished and the caller has to destroy it
+    bool detach() noexcept {
+        return _state.exchange(DETACHED, std::memory_order_acq_rel) == DONE;
+    }
+
+    void rethrowIfFailed() const {
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+    }
+};
+
+template<class T>
+class CoroutinePromise : public CoroutinePromiseBase {
+    std::optional<T> _value;
+
+public:
+    Coroutine<T> get_return_object() noexcept;
+
+    template<class U>
+    void return_value(U &&value) {
+        _value.emplace(std::forward<U>(value));
+    }
+
+    // Result can be taken once
+    T takeValue() {
+        rethrowIfFailed();
+        return std::move(*_value);
+    }
+};
+
+template<>
+class CoroutinePromise<void> : public CoroutinePromiseBase {
+public:
+    Coroutine<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+
+    void takeValue() const {
+        rethrowIfFailed();
+    }
+};
+
+// Coroutine task. It starts immediately and continues on loopers after awaiting promises, see PromiseAwaiter.
+// Can be awaited by another coroutine once. Dropping it doesn't stop the coroutine, the frame is freed
+// when the coroutine finishes
+template<class T = void>
+class Coroutine {
+public:
+    using promise_type = CoroutinePromise<T>;
+
+private:
+    using Handle = std::coroutine_handle<promise_type>;
+
+    Handle _handle;
+
+    // Suspends awaiting coroutine until this one finishes, the finishing thread resumes it
+    class Awaiter {
+        Handle _handle;
+
+    public:
+        explicit Awaiter(Handle handle) noexcept
+            : _handle{handle} {}
+
+        bool await_ready() const noexcept {
+            return _handle.promise().isDone();
+        }
+
+        bool await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            return _handle.promise().setContinuation(awaiting);
+        }
+
+        T await_resume() const {
+            return _handle.promise().takeValue();
+        }
+    };
+
+public:
+    explicit Coroutine(Handle handle) noexcept
+        : _handle{handle} {}
+
+    Coroutine(Coroutine &&other) noexcept
+        : _handle{std::exchange(other._handle, nullptr)} {}
+
+    Coroutine &operator=(Coroutine &&other) noexcept {
+        if (this != &other) {
+            release();
+            _handle = std::exchange(other._handle, nullptr);
+        }
+        return *this;
+    }
+
+    Coroutine(const Coroutine &) = delete;
+    Coroutine &operator=(const Coroutine &) = delete;
+
+    ~Coroutine() {
+        release();
+    }
+
+    bool isReady() const noexcept {
+        return _handle.promise().isDone();
+    }
+
+    // Blocks current thread until coroutine is finished. Don't call from a looper the coroutine needs
+    T result() {
+        while (!isReady())
+            std::this_thread::yield();
+        return _handle.promise().takeValue();
+    }
+
+    Awaiter operator co_await() const noexcept {
+        return Awaiter(_handle);
+    }
+
+private:
+    void release() noexcept {
+        if (_handle && _handle.promise().detach()) {
+            _handle.destroy();
+        }
+        _handle = nullptr;
+    }
+};
+
+template<class T>
+Coroutine<T> CoroutinePromise<T>::get_return_object() noexcept {
+    return Coroutine<T>(std::coroutine_handle<CoroutinePromise<T>>::from_promise(*this));
+}
+
+inline Coroutine<void> CoroutinePromise<void>::get_return_object() noexcept {
+    return Coroutine<void>(std::coroutine_handle<CoroutinePromise<void>>::from_promise(*this));
+}
+
+// `co_await resumeOnPool()` moves the coroutine to a looper chosen by the policy, e.g. to leave the thread
+// which started it or to switch to another domain
+class PoolAwaiter {
+    TaskPolicy _policy;
+
+public:
+    explicit PoolAwaiter(const TaskPolicy &policy) noexcept
+        : _policy{policy} {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) const {
+        getMainThreadPool()->addTask(TaskRef(new Task([handle]() { handle.resume(); }, _policy)));
+    }
+
+    void await_resume() const noexcept {}
+};
+
+inline PoolAwaiter resumeOnPool(const TaskPolicy &policy = {}) {
+    return PoolAwaiter(policy);
+}
+
+#endif // COROUTINE_H
@@ -1,63 +1,226 @@
 #ifndef EVENT_H
 #define EVENT_H
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
 #include <mutex>
-#include <list>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "application.h"
+#include "hazardpointers.h"
 
-// Cosplay of C# event mechanism
+// Unsubscribing only clears the flag, the event drops inactive handlers on next change
+struct EventHandlerBase {
+    std::atomic_bool active{true};
+};
+
+// Subscribed callback
+template <class... Args>
+struct EventHandler : EventHandlerBase {
+    std::function<void(Args...)> callback;
+
+    explicit EventHandler(std::function<void(Args...)> function) noexcept
+        : callback{std::move(function)} {}
+};
+
+// Returned by `Event::operator+=`. Unsubscribes in O(1), doesn't keep the event or the callback alive.
+// Dropping the subscription doesn't unsubscribe
+class Subscription {
+    std::weak_ptr<EventHandlerBase> _handler;
+
+public:
+    Subscription() noexcept = default;
+
+    explicit Subscription(const std::shared_ptr<EventHandlerBase> &handler) noexcept
+        : _handler{handler} {}
+
+    // Callback is not called by invocations started after this. Invocations running already may still call it
+    void unsubscribe() noexcept {
+        if (auto handler = _handler.lock()) {
+            handler->active.store(false, std::memory_order_release);
+        }
+        _handler.reset();
+    }
+
+    bool isActive() const noexcept {
+        auto handler = _handler.lock();
+        return handler && handler->active.load(std::memory_order_acquire);
+    }
+};
+
+// Handlers of an event published as immutable snapshots (copy-on-write): subscribers copy the list under
+// a mutex, invocations take the current snapshot without locking and don't copy callbacks. Old snapshots
+// are reclaimed with hazard pointers
+template <class Handler>
+class HandlerList {
+public:
+    // Immutable list of handlers. The list holds one reference, every running invocation holds another one
+    struct Snapshot {
+        std::atomic_uint32_t refs{1};
+        std::vector<std::shared_ptr<Handler>> handlers;
+
+        void release() noexcept {
+            if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete this;
+            }
+        }
+    };
+
+    // Keeps a snapshot alive while the handlers are called
+    class SnapshotRef {
+        Snapshot *_snapshot;
+
+    public:
+        explicit SnapshotRef(Snapshot *snapshot) noexcept
+            : _snapshot{snapshot} {}
+
+        SnapshotRef(SnapshotRef &&other) noexcept
+            : _snapshot{std::exchange(other._snapshot, nullptr)} {}
+
+        SnapshotRef(const SnapshotRef &) = delete;
+        SnapshotRef &operator=(const SnapshotRef &) = delete;
+        SnapshotRef &operator=(SnapshotRef &&) = delete;
+
+        ~SnapshotRef() {
+            if (_snapshot) {
+                _snapshot->release();
+            }
+        }
+
+        const std::vector<std::shared_ptr<Handler>> &handlers() const noexcept {
+            return _snapshot->handlers;
+        }
+    };
+
+private:
+    std::atomic<Snapshot*> _snapshot;
+
+    // Serializes writers only, invocations never take it
+    mutable std::mutex _mutex;
+
+public:
+    HandlerList()
+        : _snapshot{new Snapshot()} {}
+
+    HandlerList(const HandlerList &) = delete;
+    HandlerList &operator=(const HandlerList &) = delete;
+
+    ~HandlerList() {
+        // Nobody can invoke an event being destroyed, so there are no readers to wait for
+        _snapshot.load(std::memory_order_relaxed)->release();
+    }
+
+    Subscription add(std::shared_ptr<Handler> handler) {
+        update([&handler](std::vector<std::shared_ptr<Handler>> &handlers) {
+            handlers.push_back(handler);
+        });
+        return Subscription(handler);
+    }
+
+    // Replaces all handlers
+    void assign(std::vector<std::shared_ptr<Handler>> handlers) {
+        update([&handlers](std::vector<std::shared_ptr<Handler>> &current) {
+            current = std::move(handlers);
+        });
+    }
+
+    // Takes the current snapshot without locking
+    SnapshotRef acquire() const noexcept {
+        HazardGuard guard;
+        auto snapshot = guard.protect(_snapshot);
+        // Published snapshot holds its own reference until it is reclaimed, and it can't be while protected
+        snapshot->refs.fetch_add(1, std::memory_order_relaxed);
+        return SnapshotRef(snapshot);
+    }
+
+    void swap(HandlerList &other) {
+        std::lock(_mutex, other._mutex);
+        std::lock_guard<std::mutex> lock_a(_mutex, std::adopt_lock);
+        std::lock_guard<std::mutex> lock_b(other._mutex, std::adopt_lock);
+
+        // Both snapshots stay valid for invocations running meanwhile, they just move to the other list
+        auto mine = _snapshot.load(std::memory_order_relaxed);
+        _snapshot.store(other._snapshot.load(std::memory_order_relaxed), std::memory_order_release);
+        other._snapshot.store(mine, std::memory_order_release);
+    }
+
+private:
+    // Publishes a modified copy of the current snapshot. Unsubscribed handlers are dropped on the way
+    template<class Modify>
+    void update(Modify &&modify) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto current = _snapshot.load(std::memory_order_relaxed);
+
+        auto next = new Snapshot();
+        next->handlers.reserve(current->handlers.size() + 1);
+        for (auto &handler : current->handlers) {
+            if (handler->active.load(std::memory_order_relaxed)) {
+                next->handlers.push_back(handler);
+            }
+        }
+        modify(next->handlers);
+
+        _snapshot.store(next, std::memory_order_release);
+        HazardPointers::retire(current, [](void *snapshot) {
+            static_cast<Snapshot*>(snapshot)->release();
+        });
+    }
+};
+
+// Cosplay of C# event mechanism, handlers are kept in a HandlerList
 template <class F, class... Args>
 class Event {
     using Callback = std::function<void(Args...)>;
+    using Handler = EventHandler<Args...>;
 
     // It's not good, but for now I can't find better way to give only to event-hosting class an access to some members
     friend F;
 
 protected:
-    mutable std::mutex _mutex;
-    std::list<Callback> _handlers;
+    using SnapshotRef = typename HandlerList<Handler>::SnapshotRef;
+
+private:
+    HandlerList<Handler> _handlers;
 
 public:
-    Event() {}
+    Event() = default;
 
     Event(const Event &other) {
-        std::lock_guard<std::mutex> lock(other._mutex);
-        _handlers = other._handlers;
+        copyFrom(other);
     }
 
+    virtual ~Event() = default;
 
-    virtual ~Event() {}
-
+    // Copies get their own handlers, subscriptions stay with the original event
     Event &operator=(const Event &other) {
-        std::lock_guard<std::mutex> lock(_mutex);
-        _handlers.clear();
-
-        other._mutex.lock();
-        _handlers = other._handlers;
-        other._mutex.unlock();
+        if (this != &other) {
+            copyFrom(other);
+        }
         return *this;
     }
 
     // C#-like addition operator (subscribes a callback to the event)
-    void operator+=(Callback callback) {
-        std::lock_guard<std::mutex> locker(_mutex);
-        _handlers.push_back(callback);
+    Subscription operator+=(Callback callback) {
+        return _handlers.add(std::make_shared<Handler>(std::move(callback)));
     }
 
     // C#-like remove operator (unsubscribes a callback from the event)
-    void operator-=(Callback callback) {
-        std::lock_guard<std::mutex> locker(_mutex);
-        _handlers.remove(callback);
+    void operator-=(Subscription &subscription) noexcept {
+        subscription.unsubscribe();
     }
 
 protected:
     virtual void invoke(Args... args) {
-        std::lock_guard<std::mutex> locker(_mutex);
-
-        // Simply iterate all subscribed callbacks
-        for (auto handler : _handlers)
-            handler(args...);
+        auto snapshot = acquire();
+        for (auto &handler : snapshot.handlers()) {
+            if (handler->active.load(std::memory_order_acquire)) {
+                handler->callback(args...);
+            }
+        }
     }
 
     void operator()(Args... args) {
@@ -65,25 +228,127 @@ protected:
     }
 
     void swap(Event &other) {
-        std::lock(_mutex, other._mutex);
-        std::lock_guard<std::mutex> lock_a(_mutex, std::adopt_lock);
-        std::lock_guard<std::mutex> lock_b(other._mutex, std::adopt_lock);
+        _handlers.swap(other._handlers);
+    }
 
-        std::swap(_handlers, other._handlers);
+    SnapshotRef acquire() const noexcept {
+        return _handlers.acquire();
+    }
+
+private:
+    void copyFrom(const Event &other) {
+        std::vector<std::shared_ptr<Handler>> copies;
+        {
+            auto snapshot = other.acquire();
+            for (auto &handler : snapshot.handlers()) {
+                if (handler->active.load(std::memory_order_acquire)) {
+                    copies.push_back(std::make_shared<Handler>(handler->callback));
+                }
+            }
+        }
+        _handlers.assign(std::move(copies));
     }
 };
 
+// Handlers are called by pool tasks. One invocation captures its arguments once and splits the handlers
+// into a few tasks of `grain` handlers, see `setFanOutGrain()`
 template <class F, class... Args>
 class AsyncEvent : public Event<F, Args...> {
     friend F;
 
+    using SnapshotRef = typename Event<F, Args...>::SnapshotRef;
+
+    // State of one invocation shared by its tasks: the snapshot keeps handlers alive, arguments are stored once
+    struct FanOut {
+        SnapshotRef snapshot;
+        std::tuple<std::decay_t<Args>...> args;
+
+        FanOut(SnapshotRef &&handlers, Args... values)
+            : snapshot{std::move(handlers)}, args{std::move(values)...} {}
+    };
+
+    // Calls handlers [begin, end) of the invocation
+    class FanOutTask : public Task {
+        std::shared_ptr<FanOut> _fanOut;
+        const size_t _begin;
+        const size_t _end;
+
+    public:
+        FanOutTask(std::shared_ptr<FanOut> fanOut, size_t begin, size_t end) noexcept
+            : _fanOut{std::move(fanOut)}, _begin{begin}, _end{end} {}
+
+    protected:
+        void run() override {
+            // Throwing handler doesn't skip the rest, the first exception goes on to the looper afterwards
+            std::exception_ptr error;
+            auto &handlers = _fanOut->snapshot.handlers();
+            for (auto i = _begin; i < _end; ++i) {
+                // Unsubscribed after the invocation started
+                if (handlers[i]->active.load(std::memory_order_acquire)) {
+                    try {
+                        std::apply(handlers[i]->callback, _fanOut->args);
+                    }
+                    catch (...) {
+                        if (!error) {
+                            error = std::current_exception();
+                        }
+                    }
+                }
+            }
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    };
+
+    // Handlers per task, 0 spreads them evenly over loopers
+    std::atomic_size_t _grain{0};
+
+public:
+    static constexpr size_t AUTO_GRAIN = 0;
+
+    AsyncEvent() = default;
+
+    AsyncEvent(const AsyncEvent &other)
+        : Event<F, Args...>(other), _grain{other.getFanOutGrain()} {}
+
+    AsyncEvent &operator=(const AsyncEvent &other) {
+        Event<F, Args...>::operator=(other);
+        setFanOutGrain(other.getFanOutGrain());
+        return *this;
+    }
+
+    // 1 gives a task per handler, bigger grains trade parallelism for fewer scheduling round trips
+    void setFanOutGrain(size_t grain) noexcept {
+        _grain.store(grain, std::memory_order_relaxed);
+    }
+
+    size_t getFanOutGrain() const noexcept {
+        return _grain.load(std::memory_order_relaxed);
+    }
+
 protected:
     virtual void invoke(Args... args) override {
-        // Instead of invoking callbacks directly, add them to the application as tasks
-        std::lock_guard<std::mutex> locker(this->_mutex);
-        for (auto handler : this->_handlers) {
-            Application::getInstance()->add(handler, args...);
+        auto snapshot = this->acquire();
+        auto count = snapshot.handlers().size();
+        if (count == 0) {
+            return;
+        }
+
+        auto grain = _grain.load(std::memory_order_relaxed);
+        if (grain == AUTO_GRAIN) {
+            auto loopers = getMainThreadPool()->getLooperCount();
+            grain = (count + loopers - 1) / loopers;
+        }
+
+        // All tasks go to the pool as one batch
+        auto fanOut = std::make_shared<FanOut>(std::move(snapshot), std::move(args)...);
+        std::vector<TaskRef> tasks;
+        tasks.reserve((count + grain - 1) / grain);
+        for (size_t begin = 0; begin < count; begin += grain) {
+            tasks.emplace_back(new FanOutTask(fanOut, begin, std::min(begin + grain, count)));
         }
+        Application::getInstance()->addTasks(tasks);
     }
 
     void invokeSync(Args... args) {
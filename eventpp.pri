@@ -0,0 +1,73 @@
+# Library part of the project, shared by the application and benchmarks
+
+CONFIG += console g++17
+CONFIG -= app_bundle
+CONFIG -= qt
+
+QMAKE_CXXFLAGS += -std=c++20 -O3 -fPIC -Wall -pedantic -Wall -Wextra -Wcast-align \
+    -Wcast-qual -Wctor-dtor-privacy -Wdisabled-optimization -Wformat=2 -Winit-self \
+    -Wlogical-op -Wmissing-declarations -Wmissing-include-dirs -Wnoexcept \
+    -Woverloaded-virtual -Wredundant-decls -Wshadow -Wsign-conversion \
+    -Wsign-promo -Wstrict-null-sentinel -Wstrict-overflow=5 -Wswitch-default -Wundef -Wunused
+
+# `qmake CONFIG+=notracing` compiles task tracing out
+notracing {
+    DEFINES += EVENTPP_NO_TRACING
+}
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/looper.cpp \
+    $$PWD/threadpool.cpp \
+    $$PWD/application.cpp \
+    $$PWD/task.cpp \
+    $$PWD/taskqueue.cpp \
+    $$PWD/lockfreetaskqueue.cpp \
+    $$PWD/hazardpointers.cpp \
+    $$PWD/parker.cpp \
+    $$PWD/taskallocator.cpp \
+    $$PWD/prioritytaskqueue.cpp \
+    $$PWD/latencyhistogram.cpp \
+    $$PWD/timerwheel.cpp \
+    $$PWD/cancellation.cpp \
+    $$PWD/tracer.cpp \
+    $$PWD/metrics.cpp \
+    $$PWD/topology.cpp \
+    $$PWD/reactor.cpp \
+    $$PWD/asyncsocket.cpp \
+    $$PWD/uring.cpp \
+    $$PWD/asyncfile.cpp
+
+HEADERS += \
+    $$PWD/looper.h \
+    $$PWD/threadpool.h \
+    $$PWD/promise.h \
+    $$PWD/application.h \
+    $$PWD/task.h \
+    $$PWD/event.h \
+    $$PWD/coalescingevent.h \
+    $$PWD/threadpoolbase.h \
+    $$PWD/workstealingdeque.h \
+    $$PWD/taskqueuebase.h \
+    $$PWD/taskqueue.h \
+    $$PWD/lockfreetaskqueue.h \
+    $$PWD/hazardpointers.h \
+    $$PWD/parker.h \
+    $$PWD/taskallocator.h \
+    $$PWD/prioritytaskqueue.h \
+    $$PWD/latencyhistogram.h \
+    $$PWD/timerwheel.h \
+    $$PWD/parallel.h \
+    $$PWD/coroutine.h \
+    $$PWD/combinators.h \
+    $$PWD/cancellation.h \
+    $$PWD/tracer.h \
+    $$PWD/metrics.h \
+    $$PWD/topology.h \
+    $$PWD/reactor.h \
+    $$PWD/asyncsocket.h \
+    $$PWD/uring.h \
+    $$PWD/asyncfile.h
+
+LIBS += -lpthread
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "hazardpointers.h"
+
+std::atomic<HazardPointers::Record*> HazardPointers::_records{nullptr};
+std::atomic_size_t HazardPointers::_recordCount{0};
+
+namespace {
+
+// Gives the record back when thread exits
+struct LocalRecord {
+    HazardPointers::Record *record{nullptr};
+
+    ~LocalRecord() {
+        if (record) {
+            HazardPointers::release(record);
+        }
+    }
+};
+
+thread_local LocalRecord localRecord;
+
+}
+
+HazardPointers::Record *HazardPointers::local() {
+    if (localRecord.record) {
+        return localRecord.record;
+    }
+
+    // Try to reuse record of a finished thread
+    for (auto record = _records.load(std::memory_order_acquire); record; record = record->next) {
+        bool active = false;
+        if (!record->active.load(std::memory_order_relaxed) &&
+                record->active.compare_exchange_strong(active, true, std::memory_order_acquire)) {
+            localRecord.record = record;
+            return record;
+        }
+    }
+
+    auto record = new Record();
+    for (auto &hazard : record->hazards) {
+        hazard.store(nullptr, std::memory_order_relaxed);
+    }
+    record->active.store(true, std::memory_order_relaxed);
+
+    auto head = _records.load(std::memory_order_relaxed);
+    do {
+        record->next = head;
+    } while (!_records.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+    ++_recordCount;
+
+    localRecord.record = record;
+    return record;
+}
+
+void HazardPointers::retire(void *ptr, void (*deleter)(void *)) {
+    auto record = local();
+    record->retired.push_back({ptr, deleter});
+
+    // Amortize scans: a scan runs only when it can free at least half of retired objects
+    if (record->retired.size() >= std::max<size_t>(64, 2 * SLOTS * _recordCount.load(std::memory_order_relaxed))) {
+        scan();
+    }
+}
+
+void HazardPointers::scan() {
+    auto record = local();
+
+    std::vector<void*> hazards;
+    for (auto other = _records.load(std::memory_order_acquire); other; other = other->next) {
+        for (auto &hazard : other->hazards) {
+            if (auto ptr = hazard.load(std::memory_order_seq_cst)) {
+                hazards.push_back(ptr);
+            }
+        }
+    }
+    // Not std::sort, its heap fallback makes GCC warn with -Wstrict-overflow
+    std::stable_sort(hazards.begin(), hazards.end());
+
+    auto alive = std::partition(record->retired.begin(), record->retired.end(), [&hazards](const Retired &retired) {
+        return std::binary_search(hazards.begin(), hazards.end(), retired.ptr);
+    });
+    for (auto it = alive; it != record->retired.end(); ++it) {
+        it->deleter(it->ptr);
+    }
+    record->retired.erase(alive, record->retired.end());
+}
+
+void HazardPointers::release(Record *record) noexcept {
+    try {
+        scan();
+    }
+    catch (...) {
+        // Leftovers stay in the record and will be freed by its next owner
+    }
+    for (auto &hazard : record->hazards) {
+        hazard.store(nullptr, std::memory_order_relaxed);
+    }
+    record->usedSlots = 0;
+    record->active.store(false, std::memory_order_release);
+}
+
+HazardGuard::HazardGuard() {
+    auto record = HazardPointers::local();
+    for (_index = 0; _index < HazardPointers::SLOTS; ++_index) {
+        if ((record->usedSlots & (1u << _index)) == 0) {
+            record->usedSlots |= 1u << _index;
+            _slot = &record->hazards[_index];
+            return;
+        }
+    }
+    throw std::runtime_error("Too many hazard pointers in one thread");
+}
+
+HazardGuard::~HazardGuard() {
+    reset();
+    HazardPointers::local()->usedSlots &= ~(1u << _index);
+}
+
+void HazardGuard::reset() noexcept {
+    _slot->store(nullptr, std::memory_order_release);
+}
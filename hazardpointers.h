@@ -0,0 +1,81 @@
+#ifndef HAZARDPOINTERS_H
+#define HAZARDPOINTERS_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Hazard pointers (M. Michael) for safe memory reclamation in lock-free structures.
+// A thread publishes pointers it is going to dereference, retired objects are deleted
+// only when no thread publishes them anymore
+class HazardPointers {
+public:
+    // Max number of pointers protected by one thread at the same time
+    static constexpr size_t SLOTS = 4;
+
+    struct Retired {
+        void *ptr;
+        void (*deleter)(void *);
+    };
+
+    // Per-thread record. Records are never freed, they are reused by new threads
+    struct Record {
+        std::atomic<void*> hazards[SLOTS];
+        std::atomic_bool active{false};
+        Record *next{nullptr};
+        unsigned usedSlots{0};
+        std::vector<Retired> retired;
+    };
+
+    // Returns record of current thread
+    static Record *local();
+
+    // Defers deletion of `ptr` until no thread protects it
+    static void retire(void *ptr, void (*deleter)(void *));
+
+    template<class T>
+    static void retire(T *ptr) {
+        retire(ptr, [](void *p) { delete static_cast<T*>(p); });
+    }
+
+    // Deletes every retired object of current thread that is not protected
+    static void scan();
+
+    // Used by thread-local holder on thread exit
+    static void release(Record *record) noexcept;
+
+private:
+    static std::atomic<Record*> _records;
+    static std::atomic_size_t _recordCount;
+};
+
+// Owns one hazard slot of current thread
+class HazardGuard {
+    std::atomic<void*> *_slot;
+    unsigned _index;
+
+public:
+    HazardGuard();
+    ~HazardGuard();
+
+    HazardGuard(const HazardGuard &) = delete;
+    HazardGuard &operator=(const HazardGuard &) = delete;
+
+    // Publishes pointer loaded from `source` and makes sure it is still there
+    template<class T>
+    T *protect(const std::atomic<T*> &source) noexcept {
+        T *ptr = source.load(std::memory_order_relaxed);
+        while (true) {
+            _slot->store(ptr, std::memory_order_seq_cst);
+            T *current = source.load(std::memory_order_acquire);
+            if (current == ptr) {
+                return ptr;
+            }
+            ptr = current;
+        }
+    }
+
+    void reset() noexcept;
+};
+
+#endif // HAZARDPOINTERS_H
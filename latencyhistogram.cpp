@@ -0,0 +1,71 @@
+#include <algorithm>
+
+#include "latencyhistogram.h"
+
+namespace {
+
+// Single writer: plain load and store instead of locked read-modify-write
+void add(std::atomic_uint64_t &counter, uint64_t value) noexcept {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+}
+
+std::chrono::nanoseconds LatencyStats::mean() const noexcept {
+    return std::chrono::nanoseconds(count ? static_cast<int64_t>(totalNs / count) : 0);
+}
+
+std::chrono::nanoseconds LatencyStats::max() const noexcept {
+    return std::chrono::nanoseconds(static_cast<int64_t>(maxNs));
+}
+
+std::chrono::nanoseconds LatencyStats::percentile(double p) const noexcept {
+    if (count == 0) {
+        return std::chrono::nanoseconds(0);
+    }
+
+    auto rank = static_cast<uint64_t>(p * static_cast<double>(count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen > rank) {
+            return std::chrono::nanoseconds(static_cast<int64_t>(std::min(maxNs, (uint64_t{2} << i) - 1)));
+        }
+    }
+    return max();
+}
+
+LatencyStats &LatencyStats::operator+=(const LatencyStats &other) noexcept {
+    count += other.count;
+    totalNs += other.totalNs;
+    maxNs = std::max(maxNs, other.maxNs);
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    return *this;
+}
+
+void LatencyHistogram::record(std::chrono::nanoseconds duration) noexcept {
+    auto ns = static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0));
+    size_t bucket = ns == 0 ? 0 : static_cast<size_t>(63 - __builtin_clzll(ns));
+    bucket = std::min(bucket, LatencyStats::BUCKETS - 1);
+
+    add(_buckets[bucket], 1);
+    add(_totalNs, ns);
+    if (ns > _maxNs.load(std::memory_order_relaxed)) {
+        _maxNs.store(ns, std::memory_order_relaxed);
+    }
+    // Count goes last, so a reader never sees more samples than bucket entries
+    _count.store(_count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+LatencyStats LatencyHistogram::snapshot() const noexcept {
+    LatencyStats stats;
+    stats.count = _count.load(std::memory_order_acquire);
+    stats.totalNs = _totalNs.load(std::memory_order_relaxed);
+    stats.maxNs = _maxNs.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < LatencyStats::BUCKETS; ++i) {
+        stats.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+}
@@ -0,0 +1,47 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Point-in-time copy of a LatencyHistogram
+struct LatencyStats {
+    // Bucket i holds durations in [2^i, 2^(i+1)) nanoseconds
+    static constexpr size_t BUCKETS = 40;
+
+    uint64_t count{0};
+    uint64_t totalNs{0};
+    uint64_t maxNs{0};
+    uint64_t buckets[BUCKETS] {};
+
+    std::chrono::nanoseconds mean() const noexcept;
+
+    std::chrono::nanoseconds max() const noexcept;
+
+    // Upper bound of the bucket containing the percentile, `p` is in [0, 1]
+    std::chrono::nanoseconds percentile(double p) const noexcept;
+
+    LatencyStats &operator+=(const LatencyStats &other) noexcept;
+};
+
+// Log2 histogram of durations. Written by a single thread with relaxed atomics, can be read from any thread
+class alignas(64) LatencyHistogram {
+    std::atomic_uint64_t _count{0};
+    std::atomic_uint64_t _totalNs{0};
+    std::atomic_uint64_t _maxNs{0};
+    std::atomic_uint64_t _buckets[LatencyStats::BUCKETS] {};
+
+public:
+    LatencyHistogram() = default;
+
+    LatencyHistogram(const LatencyHistogram &) = delete;
+    LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+    // Has to be called only from the owner thread
+    void record(std::chrono::nanoseconds duration) noexcept;
+
+    LatencyStats snapshot() const noexcept;
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "hazardpointers.h"
+#include "lockfreetaskqueue.h"
+
+namespace {
+
+// Marks slots that were consumed or abandoned by a consumer that came before the producer
+template<class T>
+T *taken() noexcept {
+    static char marker;
+    return reinterpret_cast<T*>(&marker);
+}
+
+// Marks slots whose canceled task was dropped by purgeCanceled(), consumers skip them
+template<class T>
+T *purged() noexcept {
+    static char marker;
+    return reinterpret_cast<T*>(&marker);
+}
+
+// Marks the slot purgeCanceled() is checking, its consumer waits until the task is put back or purged
+template<class T>
+T *inspected() noexcept {
+    static char marker;
+    return reinterpret_cast<T*>(&marker);
+}
+
+}
+
+LockFreeTaskQueue::Segment::Segment() noexcept {
+    for (auto &item : items) {
+        item.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+LockFreeTaskQueue::Segment::Segment(Item *first) noexcept : Segment() {
+    enqueueIndex.store(1, std::memory_order_relaxed);
+    items[0].store(first, std::memory_order_relaxed);
+}
+
+LockFreeTaskQueue::LockFreeTaskQueue(size_t capacity) : _capacity{capacity} {
+    auto segment = new Segment();
+    _head.store(segment, std::memory_order_relaxed);
+    _tail.store(segment, std::memory_order_relaxed);
+}
+
+LockFreeTaskQueue::~LockFreeTaskQueue() {
+    clear();
+
+    // Nobody uses the queue anymore, segments can be freed directly
+    auto segment = _head.load(std::memory_order_relaxed);
+    while (segment) {
+        auto next = segment->next.load(std::memory_order_relaxed);
+        delete segment;
+        segment = next;
+    }
+}
+
+void LockFreeTaskQueue::push(TaskRef task) {
+    while (!reserve()) {
+        std::this_thread::yield();
+    }
+    enqueue(task.detach());
+}
+
+bool LockFreeTaskQueue::tryPush(TaskRef task) {
+    if (!reserve()) {
+        return false;
+    }
+    enqueue(task.detach());
+    return true;
+}
+
+void LockFreeTaskQueue::pushBatch(const TaskRef *tasks, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    if (_capacity != 0 && count > _capacity) {
+        throw std::length_error("Batch is bigger than queue capacity");
+    }
+    while (!reserve(count)) {
+        std::this_thread::yield();
+    }
+
+    std::vector<Item*> items(count);
+    for (size_t i = 0; i < count; ++i) {
+        items[i] = TaskRef(tasks[i]).detach();
+    }
+    enqueueBatch(items.data(), count);
+}
+
+TaskRef LockFreeTaskQueue::remove() noexcept {
+    auto item = dequeue();
+    if (item) {
+        _size.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return TaskRef::adopt(item);
+}
+
+size_t LockFreeTaskQueue::removeBatch(TaskRef *out, size_t max) noexcept {
+    size_t count = 0;
+    while (count < max) {
+        auto item = dequeue();
+        if (item == nullptr) {
+            break;
+        }
+        out[count++] = TaskRef::adopt(item);
+    }
+    _size.fetch_sub(static_cast<int64_t>(count), std::memory_order_relaxed);
+    return count;
+}
+
+bool LockFreeTaskQueue::empty() const noexcept {
+    return _size.load(std::memory_order_acquire) <= 0;
+}
+
+size_t LockFreeTaskQueue::size() const noexcept {
+    auto size = _size.load(std::memory_order_relaxed);
+    return size > 0 ? static_cast<size_t>(size) : 0;
+}
+
+void LockFreeTaskQueue::clear() noexcept {
+    while (remove()) {
+    }
+}
+
+size_t LockFreeTaskQueue::purgeCanceled(std::vector<TaskRef> &removed) {
+    size_t count = 0;
+    HazardGuard guards[2];
+    auto current = 0;
+    auto segment = guards[current].protect(_head);
+    // Segments appended during the scan hold tasks pushed after the call
+    auto last = _tail.load(std::memory_order_acquire);
+    while (true) {
+        auto end = std::min(segment->enqueueIndex.load(std::memory_order_acquire), SEGMENT_SIZE);
+        for (auto index = segment->dequeueIndex.load(std::memory_order_acquire); index < end; ++index) {
+            auto &slot = segment->items[index];
+            auto item = slot.load(std::memory_order_acquire);
+            if (item == nullptr || item == taken<Item>() || item == purged<Item>()) {
+                continue;
+            }
+            // The task is safe to look at only while the queue owns it, so it is taken out of the slot for
+            // the check. Fails if a consumer took it meanwhile
+            if (!slot.compare_exchange_strong(item, inspected<Item>(), std::memory_order_acq_rel,
+                                              std::memory_order_relaxed)) {
+                continue;
+            }
+            if (item->isCanceled()) {
+                slot.store(purged<Item>(), std::memory_order_release);
+                removed.push_back(TaskRef::adopt(item));
+                ++count;
+            }
+            else {
+                slot.store(item, std::memory_order_release);
+            }
+        }
+
+        if (segment == last) {
+            break;
+        }
+        auto next = guards[1 - current].protect(segment->next);
+        if (next == nullptr) {
+            break;
+        }
+        // Segments are freed in order once consumers move the head past them. While the head hasn't left
+        // this one, the next one is alive, otherwise the scan goes on from the head
+        if (segment->dequeueIndex.load(std::memory_order_acquire) >= SEGMENT_SIZE &&
+                _head.load(std::memory_order_acquire) != segment) {
+            next = guards[1 - current].protect(_head);
+        }
+        current = 1 - current;
+        segment = next;
+    }
+
+    _size.fetch_sub(static_cast<int64_t>(count), std::memory_order_relaxed);
+    return count;
+}
+
+size_t LockFreeTaskQueue::capacity() const noexcept {
+    return _capacity;
+}
+
+bool LockFreeTaskQueue::reserve(size_t count) noexcept {
+    auto delta = static_cast<int64_t>(count);
+    auto size = _size.fetch_add(delta, std::memory_order_acq_rel);
+    if (_capacity != 0 && static_cast<size_t>(size + delta) > _capacity) {
+        _size.fetch_sub(delta, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void LockFreeTaskQueue::enqueue(Item *item) {
+    HazardGuard guard;
+    while (true) {
+        auto tail = guard.protect(_tail);
+        auto index = tail->enqueueIndex.fetch_add(1, std::memory_order_acq_rel);
+        if (index < SEGMENT_SIZE) {
+            Item *expected = nullptr;
+            if (tail->items[index].compare_exchange_strong(expected, item, std::memory_order_release,
+                                                           std::memory_order_relaxed)) {
+                return;
+            }
+            // A consumer has already given up on this slot, take another one
+            continue;
+        }
+
+        // Segment is full, append the next one or help another producer to do it
+        if (tail != _tail.load(std::memory_order_acquire)) {
+            continue;
+        }
+        auto next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            auto segment = new Segment(item);
+            if (tail->next.compare_exchange_strong(next, segment, std::memory_order_acq_rel)) {
+                _tail.compare_exchange_strong(tail, segment, std::memory_order_acq_rel);
+                return;
+            }
+            delete segment;
+        }
+        else {
+            _tail.compare_exchange_strong(tail, next, std::memory_order_acq_rel);
+        }
+    }
+}
+
+void LockFreeTaskQueue::enqueueBatch(Item **items, size_t count) {
+    size_t done = 0;
+    {
+        HazardGuard guard;
+        auto tail = guard.protect(_tail);
+        auto claim = static_cast<int>(std::min<size_t>(count, SEGMENT_SIZE));
+        auto first = tail->enqueueIndex.fetch_add(claim, std::memory_order_acq_rel);
+
+        for (int index = first; index < first + claim && index < SEGMENT_SIZE; ++index) {
+            Item *expected = nullptr;
+            if (tail->items[index].compare_exchange_strong(expected, items[done], std::memory_order_release,
+                                                           std::memory_order_relaxed)) {
+                ++done;
+            }
+            // Otherwise a consumer gave up on the slot, the item goes to the next one
+        }
+    }
+
+    // Items that didn't fit into the claimed range
+    for (; done < count; ++done) {
+        enqueue(items[done]);
+    }
+}
+
+LockFreeTaskQueue::Item *LockFreeTaskQueue::dequeue() noexcept {
+    HazardGuard guard;
+    while (true) {
+        auto head = guard.protect(_head);
+        if (head->dequeueIndex.load(std::memory_order_acquire) >= head->enqueueIndex.load(std::memory_order_acquire) &&
+                head->next.load(std::memory_order_acquire) == nullptr) {
+            return nullptr;
+        }
+
+        auto index = head->dequeueIndex.fetch_add(1, std::memory_order_acq_rel);
+        if (index < SEGMENT_SIZE) {
+            // If the producer hasn't filled the slot yet, it will find the marker and retry elsewhere
+            auto item = take(head->items[index]);
+            if (item != nullptr && item != purged<Item>()) {
+                return item;
+            }
+            continue;
+        }
+
+        // Segment is drained, move to the next one
+        auto next = head->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return nullptr;
+        }
+        if (_head.compare_exchange_strong(head, next, std::memory_order_acq_rel)) {
+            guard.reset();
+            HazardPointers::retire(head);
+        }
+    }
+}
+
+LockFreeTaskQueue::Item *LockFreeTaskQueue::take(std::atomic<Item*> &slot) noexcept {
+    auto item = slot.load(std::memory_order_acquire);
+    while (true) {
+        // purgeCanceled() holds the task for a couple of loads
+        if (item == inspected<Item>()) {
+            std::this_thread::yield();
+            item = slot.load(std::memory_order_acquire);
+            continue;
+        }
+        if (slot.compare_exchange_weak(item, taken<Item>(), std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return item;
+        }
+    }
+}
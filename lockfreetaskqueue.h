@@ -0,0 +1,86 @@
+#ifndef LOCKFREETASKQUEUE_H
+#define LOCKFREETASKQUEUE_H
+
+#include <atomic>
+
+#include "task.h"
+#include "taskqueuebase.h"
+
+// Lock-free multi-producer multi-consumer task queue.
+// Queue is a linked list of fixed-size segments (FAA array queue by Ramalhete and Correia):
+// producers and consumers claim slots with fetch_add, so they contend only on two counters,
+// drained segments are reclaimed with hazard pointers
+class LockFreeTaskQueue : public TaskQueueBase {
+    static constexpr int SEGMENT_SIZE = 1024;
+
+    // References detached from TaskRef
+    using Item = Task;
+
+    struct Segment {
+        std::atomic_int dequeueIndex{0};
+        std::atomic_int enqueueIndex{0};
+        std::atomic<Segment*> next{nullptr};
+        std::atomic<Item*> items[SEGMENT_SIZE];
+
+        Segment() noexcept;
+        explicit Segment(Item *first) noexcept;
+    };
+
+    alignas(64) std::atomic<Segment*> _head;
+    alignas(64) std::atomic<Segment*> _tail;
+
+    // Number of tasks pushed but not yet removed. Push reserves its place before the task becomes visible
+    alignas(64) std::atomic<int64_t> _size{0};
+
+    // 0 means unbounded
+    const size_t _capacity;
+
+public:
+    explicit LockFreeTaskQueue(size_t capacity = 0);
+
+    virtual ~LockFreeTaskQueue() override;
+
+    LockFreeTaskQueue(const LockFreeTaskQueue &) = delete;
+    LockFreeTaskQueue &operator=(const LockFreeTaskQueue &) = delete;
+
+    // Blocks (yields) while bounded queue is full
+    virtual void push(TaskRef task) override;
+
+    // Returns false if bounded queue is full
+    bool tryPush(TaskRef task);
+
+    // Blocks (yields) until the whole batch fits into bounded queue
+    virtual void pushBatch(const TaskRef *tasks, size_t count) override;
+
+    virtual TaskRef remove() noexcept override;
+
+    virtual size_t removeBatch(TaskRef *out, size_t max) noexcept override;
+
+    virtual bool empty() const noexcept override;
+
+    virtual size_t size() const noexcept override;
+
+    virtual void clear() noexcept override;
+
+    // Canceled tasks are swapped for a marker in their slots, which consumers skip, so the rest keeps its
+    // order and the scan never waits for free space
+    virtual size_t purgeCanceled(std::vector<TaskRef> &removed) override;
+
+    size_t capacity() const noexcept;
+
+private:
+    // Takes `count` places in the queue, fails if bounded queue is full
+    bool reserve(size_t count = 1) noexcept;
+
+    void enqueue(Item *item);
+
+    // Claims a range of slots in the tail segment with one fetch_add, the rest is enqueued one by one
+    void enqueueBatch(Item **items, size_t count);
+
+    Item *dequeue() noexcept;
+
+    // Marks the claimed slot consumed and returns what was in it
+    static Item *take(std::atomic<Item*> &slot) noexcept;
+};
+
+#endif // LOCKFREETASKQUEUE_H
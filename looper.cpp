@@ -1,63 +1,179 @@
+#include <algorithm>
+#include <thread>
+
 #include "looper.h"
 
 ThreadPoolBase::~ThreadPoolBase() {
 }
 
-Looper::Looper(int index, TaskQueue *queue, QueueWatcher &watcher, ThreadPoolBase* pool)
-    : _isStopped{false}, _index{index}, _globalQueue{queue},
-      _watcher{watcher}, _pool {pool}, _reschedule {false}, _reschedulePolicy{std::nullopt} {}
+Looper::Looper(int index, PriorityTaskQueue *queue, IdleSet &idle, SpinLimiter &spinners, ThreadPoolBase* pool,
+               SchedulerMode mode, const IdleOptions &idleOptions)
+    : _isStopped{false}, _index{index}, _globalQueue{queue}, _mode{mode},
+      _idle{idle}, _spinners{spinners}, _idleOptions{idleOptions}, _pool {pool}, _reschedule {false},
+      _reschedulePolicy{std::nullopt} {}
 
 Looper::~Looper() {
-    std::cerr << "Looper destructed\n";
     _isStopped = true;
     if (!_localQueue.empty())
         _localQueue.clear();
+
+    _next = nullptr;
+
+    // Loopers are already stopped, so nobody else touches the deque
+    while (auto task = _workQueue.pop()) {
+        TaskRef::adopt(task);
+    }
+}
+
+void Looper::pushBack(TaskRef task) {
+    // Local queue has its own lock
+    _localQueue.push(std::move(task));
+}
+
+void Looper::pushWork(TaskRef task) {
+    _workQueue.push(task.detach());
+}
+
+void Looper::pushNext(TaskRef task) {
+    if (_next) {
+        pushWork(std::move(_next));
+    }
+    _next = std::move(task);
+}
+
+void Looper::addTimer(TaskRef task) {
+    _timers.add(std::move(task));
+}
+
+void Looper::postTimer(TaskRef task) noexcept {
+    _timers.post(std::move(task));
+    unpark();
 }
 
-void Looper::pushBack(const std::shared_ptr<Task> &task) {
-    std::lock_guard<std::mutex> guard(_mutex);
-    _localQueue.push(task);
+TaskRef Looper::stealWork() noexcept {
+    return TaskRef::adopt(_workQueue.steal());
+}
+
+size_t Looper::getWorkSize() const noexcept {
+    return _workQueue.size();
+}
+
+ThreadPoolBase* Looper::getPool() const noexcept {
+    return _pool;
 }
 
 size_t Looper::getQueueSize() const noexcept {
     return _localQueue.size();
 }
 
+LatencyStats Looper::getQueueWaitStats(TaskPriority priority) const noexcept {
+    return _counters.getQueueWaitStats(priority);
+}
+
+LooperMetrics Looper::getMetrics() const noexcept {
+    LooperMetrics metrics;
+    _counters.snapshot(metrics);
+    metrics.index = _index;
+    metrics.localQueueSize = _localQueue.size();
+    metrics.workQueueSize = _workQueue.size();
+    return metrics;
+}
+
+void Looper::countSubmitted(size_t count) noexcept {
+    _counters.recordSubmitted(count);
+}
+
 int Looper::getIndex() const noexcept {
     return _index;
 }
 
+void Looper::setRetireTimeout(TaskClock::duration timeout) noexcept {
+    _retireAfter = timeout;
+}
+
+void Looper::enableReactor() {
+    _reactor.reset(new Reactor());
+}
+
+Reactor *Looper::getReactor() const noexcept {
+    return _reactor.get();
+}
+
+void Looper::enableFileIo(FileIoBackend backend) {
+    if (backend == FileIoBackend::THREADS) {
+        return;
+    }
+    try {
+        _ring.reset(new IoRing());
+    }
+    catch (const std::runtime_error &) {
+        if (backend == FileIoBackend::URING) {
+            throw;
+        }
+        return;
+    }
+    _ring->watch(*_reactor);
+}
+
+IoRing *Looper::getRing() const noexcept {
+    return _ring.get();
+}
+
+bool Looper::hasOwnWork() const noexcept {
+    // Eventfd of the ring is always registered, it is not a socket of this looper
+    size_t ownWatches = _ring ? 1 : 0;
+    return _next || !_localQueue.empty() || _workQueue.size() != 0 || !_timers.empty() || _timers.hasPosted() ||
+           (_reactor && _reactor->size() > ownWatches) || (_ring && _ring->getInflight() != 0);
+}
+
+TaskClock::duration Looper::getTaskRunTime(TaskClock::time_point now) const noexcept {
+    auto started = _taskStarted.load(std::memory_order_relaxed);
+    if (started == 0) {
+        return TaskClock::duration::zero();
+    }
+    return std::max(now - TaskClock::time_point(TaskClock::duration(started)), TaskClock::duration::zero());
+}
+
 void Looper::stop() noexcept {
     _isStopped = true;
 }
 
+bool Looper::unpark() noexcept {
+    return _reactor ? _reactor->wake() : _parker.unpark();
+}
+
 void Looper::loop() {
-    std::shared_ptr<Task> task {nullptr};
+#ifndef EVENTPP_NO_TRACING
+    Tracer::setThreadName("Looper #" + std::to_string(_index));
+#endif
+
+    _retired = false;
     while (!_isStopped || !_localQueue.empty()) {
+        purgeCanceled();
+
+        // File operations queued by the previous iteration go to the kernel with one call
+        if (_ring) {
+            _ring->submit();
+        }
+
         // Looper thread is blocked until any task is scheduled for execution or looper is stopped
-        _watcher.wait([this](){ return !_localQueue.empty() || !_globalQueue->empty() || _isStopped; });
+        waitForWork();
+        if (_retired) {
+            break;
+        }
+        if (_reactor) {
+            serveIo();
+        }
+        fireTimers();
 
         // Firstly, execute all tasks in local queue
         while (!_localQueue.empty()) {
-            task = _localQueue.remove();
-            if (task->getState() == TaskState::PENDING) {
-                std::cerr << "Looper #" << _index << " took task #" << task->getId() << " from local queue\n";
-                task->execute();
-
-                // Task can ask looper for rescheduling
-                if (_reschedule) {
-                    doReschedule(task);
-                }
-            }
-        }
-        task = _globalQueue->remove();
-        if (task && task->getState() == TaskState::PENDING) {
-            std::cerr << "Looper #" << _index << " took task #" << task->getId() << " from global queue\n";
-            task->execute();
-            if (_reschedule) {
-                doReschedule(task);
-            }
+            run(_localQueue.remove(), TaskSource::LOCAL_QUEUE);
         }
+
+        TaskSource source;
+        auto task = nextTask(source);
+        run(task, source);
     }
 }
 
@@ -71,7 +187,7 @@ void Looper::rescheduleCurrentTask(const TaskPolicy &policy) {
     _reschedulePolicy = policy;
 }
 
-void Looper::doReschedule(const std::shared_ptr<Task> &task) {
+void Looper::doReschedule(const TaskRef &task) {
     _reschedule = false;
 
     // If policy wasn't specified in reschedule request previous will be used, otherwise update to new one
@@ -79,7 +195,8 @@ void Looper::doReschedule(const std::shared_ptr<Task> &task) {
         task->setPolicy(*_reschedulePolicy);
     }
 
-    std::cerr << "Task #" << task->getId() << " rescheduled\n";
+    EVENTPP_TRACE(TraceEventType::RESCHEDULE, task->getId(), 0);
+    _counters.recordRescheduled();
 
     // Send task to thread pool
     _pool->addTask(task);
@@ -88,3 +205,316 @@ void Looper::doReschedule(const std::shared_ptr<Task> &task) {
 bool Looper::isEmpty() {
     return _localQueue.empty();
 }
+
+bool Looper::hasWork() const noexcept {
+    if (_next || !_localQueue.empty() || !_globalQueue->empty() || _timers.hasPosted())
+        return true;
+    if (_reactor && _reactor->hasReady())
+        return true;
+    if (_ring && _ring->hasCompletions())
+        return true;
+    return _pool->hasStealableTasks();
+}
+
+void Looper::waitForWork() noexcept {
+    if (hasWork() || _isStopped) {
+        return;
+    }
+
+    // Sleep no longer than until the nearest timer
+    auto expiry = _timers.nextExpiry();
+    auto idleSince = TaskClock::now();
+    if (expiry && *expiry <= idleSince) {
+        return;
+    }
+
+    // Task arriving soon is taken without a kernel round trip
+    auto deadline = idleSince + spinBudget();
+    if (expiry) {
+        deadline = std::min(deadline, *expiry);
+    }
+    if (deadline <= idleSince || !spinForWork(deadline)) {
+        // Looper without timers of its own can only be waiting to retire
+        park(_retireAfter && !expiry ? idleSince + *_retireAfter : expiry);
+
+        if (_retireAfter && !expiry && !_isStopped && !hasWork() && TaskClock::now() - idleSince >= *_retireAfter) {
+            _retired = _pool->retire(_index);
+            return;
+        }
+    }
+
+    if (!_isStopped) {
+        auto gap = TaskClock::now() - idleSince;
+        _idleGap = (_idleGap * 7 + gap) / 8;
+    }
+}
+
+TaskClock::duration Looper::spinBudget() const noexcept {
+    TaskClock::duration maxSpin = _idleOptions.maxSpin;
+    switch (_idleOptions.strategy) {
+        case IdleStrategy::PARK:
+            return TaskClock::duration::zero();
+        case IdleStrategy::SPIN:
+            return maxSpin;
+        case IdleStrategy::ADAPTIVE:
+        default:
+            // Work usually comes later than spinning could cover
+            if (_idleGap > maxSpin * 2) {
+                return TaskClock::duration::zero();
+            }
+            return std::clamp<TaskClock::duration>(_idleGap * 2, maxSpin / 8, maxSpin);
+    }
+}
+
+bool Looper::spinForWork(TaskClock::time_point deadline) noexcept {
+    if (!_spinners.tryStart()) {
+        return false;
+    }
+
+    auto found = hasWork() || _isStopped;
+    while (!found && TaskClock::now() < deadline) {
+        for (int i = 0; i < SPIN_ROUND; ++i) {
+            cpuRelax();
+        }
+        if (_reactor) {
+            _reactor->poll();
+        }
+        found = hasWork() || _isStopped;
+    }
+    for (uint32_t i = 0; !found && i < _idleOptions.yields; ++i) {
+        std::this_thread::yield();
+        found = hasWork() || _isStopped;
+    }
+
+    // Submitters skip waking parked loopers while somebody spins. The last spinner takes one task,
+    // so it wakes a parked looper if there is more
+    auto spinning = _spinners.stop();
+    if (found && spinning == 0 && (_globalQueue->size() > 1 || _pool->hasStealableTasks())) {
+        _pool->wake(1);
+    }
+    _counters.recordSpin(found);
+    return found;
+}
+
+void Looper::park(std::optional<TaskClock::time_point> expiry) noexcept {
+    auto timeout = expiry ? *expiry - TaskClock::now() : TaskClock::duration::zero();
+    if (expiry && timeout <= TaskClock::duration::zero()) {
+        return;
+    }
+
+    // Announce idleness first and check queues once more. Submitter pushes first and looks for idle loopers
+    // after, so at least one side sees the other and the wake up can't be lost
+    auto index = static_cast<size_t>(_index);
+    _idle.add(index);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!hasWork() && !_isStopped) {
+        EVENTPP_TRACE(TraceEventType::PARK, 0, 0);
+        auto parkedAt = TaskClock::now();
+        if (_reactor) {
+            if (expiry) {
+                _reactor->wait(timeout);
+            }
+            else {
+                _reactor->wait();
+            }
+        }
+        else if (expiry) {
+            _parker.park(timeout);
+        }
+        else {
+            _parker.park();
+        }
+        auto now = TaskClock::now();
+        EVENTPP_TRACE(TraceEventType::UNPARK, 0, 0);
+
+        // Neither work nor a due timer: somebody else took the task we were woken for, or no reason at all
+        auto spurious = !_isStopped && (!expiry || now < *expiry) && !hasWork();
+        _counters.recordWakeup(now - parkedAt, spurious);
+    }
+    _idle.remove(index);
+}
+
+void Looper::serveIo() {
+    if (!_reactor->hasReady() && ++_ioCountdown >= IO_POLL_INTERVAL) {
+        _ioCountdown = 0;
+        _reactor->poll();
+    }
+    _reactor->dispatch();
+    if (_ring) {
+        _ring->reap();
+    }
+}
+
+void Looper::purgeCanceled() {
+    if (_pool->isPurgeRequested()) {
+        _pool->purgeCanceled();
+    }
+
+    auto size = _localQueue.size() + _workQueue.size() + _timers.size() + (_next ? 1 : 0);
+    if (!_purgeTrigger.isDue(size)) {
+        return;
+    }
+    _purgeTrigger.reset();
+
+    _localQueue.purgeCanceled(_canceled);
+    _timers.purgeCanceled(_canceled);
+    if (_next && _next->isCanceled()) {
+        _canceled.push_back(std::move(_next));
+    }
+
+    // Only the owner pushes and pops, so live tasks are popped and pushed back in the same order.
+    // Thieves may take some of them meanwhile, as usual
+    std::vector<Task*> live;
+    while (auto task = _workQueue.pop()) {
+        if (task->isCanceled()) {
+            _canceled.push_back(TaskRef::adopt(task));
+        }
+        else {
+            live.push_back(task);
+        }
+    }
+    for (auto it = live.rbegin(); it != live.rend(); ++it) {
+        _workQueue.push(*it);
+    }
+
+    // Cancellation reaches continuations of removed tasks, they are freed right here
+    for (auto &task : _canceled) {
+        task->cancel();
+    }
+    _canceled.clear();
+}
+
+void Looper::fireTimers() {
+    if (_timers.empty()) {
+        return;
+    }
+
+    if (_timers.advance(TaskClock::now(), _expired) != 0) {
+        _pool->addTasks(_expired.data(), _expired.size());
+        _expired.clear();
+    }
+}
+
+void Looper::rearm(const TaskRef &task) {
+    auto period = task->getPeriod();
+    auto due = task->getDueTime() + period;
+    auto now = TaskClock::now();
+    if (due <= now) {
+        due += ((now - due) / period + 1) * period;
+    }
+
+    // Looper the pool may retire doesn't keep UNBOUND timers, they would hold it forever
+    if (_retireAfter && task->getPolicy().policy != TaskBindingPolicy::BOUND) {
+        _pool->addTaskAt(task, due);
+        return;
+    }
+
+    // Canceled after its run finished
+    if (!task->makePending()) {
+        task->cancel();
+        return;
+    }
+    task->setDueTime(due);
+    _timers.add(task);
+}
+
+TaskRef Looper::nextTask(TaskSource &source) {
+    // Continuation of the task just finished, its data is still in cache
+    if (_next) {
+        if (_nextStreak < MAX_NEXT_STREAK) {
+            ++_nextStreak;
+            source = TaskSource::NEXT_SLOT;
+            return std::move(_next);
+        }
+        pushWork(std::move(_next));
+    }
+    _nextStreak = 0;
+
+    // Urgent tasks never get into deques, don't let them wait behind the deque
+    source = TaskSource::GLOBAL_QUEUE;
+    if (_globalQueue->hasUrgent()) {
+        if (auto task = takeGlobal()) {
+            return task;
+        }
+    }
+
+    // Own deque is LIFO for the owner: the most recently spawned task is the hottest in cache
+    if (auto task = _workQueue.pop()) {
+        source = TaskSource::WORK_QUEUE;
+        return TaskRef::adopt(task);
+    }
+
+    auto task = takeGlobal();
+    if (task) {
+        return task;
+    }
+
+    task = _pool->stealTask(_index);
+    if (task) {
+        source = TaskSource::STOLEN;
+        EVENTPP_TRACE(TraceEventType::STEAL, task->getId(), 0);
+        _counters.recordStolen();
+    }
+    return task;
+}
+
+TaskRef Looper::takeGlobal() {
+    // Take a fair share of the queue, so other loopers still have something to do
+    auto batch = std::clamp<size_t>(_globalQueue->size() / _pool->getLooperCount(), 1, MAX_BATCH);
+    if (batch == 1) {
+        return _globalQueue->remove();
+    }
+
+    TaskRef tasks[MAX_BATCH];
+    auto count = _globalQueue->removeBatch(tasks, batch);
+    if (count == 0) {
+        return {nullptr};
+    }
+
+    // Rest of the batch stays stealable, so a long task can't hold it. Push in reverse to pop in FIFO order
+    for (size_t i = count - 1; i > 0; --i) {
+        pushWork(std::move(tasks[i]));
+    }
+    return std::move(tasks[0]);
+}
+
+void Looper::run(const TaskRef &task, [[maybe_unused]] TaskSource source) {
+    // Task canceled through its token is still PENDING, cancel it for real to reach its continuations
+    if (task && task->isCanceled()) {
+        task->cancel();
+        return;
+    }
+
+    if (task && task->getState() == TaskState::PENDING) {
+        auto priority = task->getPolicy().priority;
+        auto start = TaskClock::now();
+        auto wait = start - task->getEnqueueTime();
+
+        EVENTPP_TRACE(TraceEventType::DEQUEUE, task->getId(), static_cast<uint32_t>(source));
+        EVENTPP_TRACE(TraceEventType::START, task->getId(), 0);
+        _taskStarted.store(start.time_since_epoch().count(), std::memory_order_relaxed);
+        auto finish = [&]() {
+            _taskStarted.store(0, std::memory_order_relaxed);
+            EVENTPP_TRACE(TraceEventType::END, task->getId(), 0);
+            _counters.recordExecution(priority, wait, TaskClock::now() - start);
+        };
+        try {
+            task->execute();
+        }
+        catch (...) {
+            // Otherwise the supervisor would see the looper stuck in the task after ThreadPool::loop reloads it
+            finish();
+            _reschedule = false;
+            throw;
+        }
+        finish();
+
+        // Task can ask looper for rescheduling
+        if (_reschedule) {
+            doReschedule(task);
+        }
+        else if (task->isPeriodic() && task->getState() == TaskState::FINISHED) {
+            rearm(task);
+        }
+    }
+}
@@ -5,17 +5,24 @@
 #include <functional>
 #include <iostream>
 #include <mutex>
+#include <optional>
 #include <queue>
 #include <thread>
 #include <condition_variable>
 
 #include "task.h"
 #include "threadpoolbase.h"
-#include "taskqueue.h"
+#include "latencyhistogram.h"
+#include "metrics.h"
+#include "parker.h"
+#include "prioritytaskqueue.h"
+#include "reactor.h"
+#include "timerwheel.h"
+#include "uring.h"
+#include "tracer.h"
+#include "workstealingdeque.h"
 
 class Looper {
-    mutable std::mutex _mutex;
-
     // Is current loopers stopped
     std::atomic_bool _isStopped;
 
@@ -23,15 +30,65 @@ class Looper {
     const int _index;
 
     // Global task queue, can be shared between several loopers
-    TaskQueue* _globalQueue;
+    PriorityTaskQueue* _globalQueue;
 
     // Local task queue, accessible and managed only from looper instance
-    TaskQueue _localQueue;
+    PriorityTaskQueue _localQueue;
+
+    // How UNBOUND tasks reach this looper
+    const SchedulerMode _mode;
+
+    // Work-stealing deque for UNBOUND tasks. In SchedulerMode::WORK_STEALING it receives tasks spawned by the looper,
+    // in both modes it keeps the rest of a batch taken from the global queue, so idle loopers can steal it.
+    // Deque holds references detached from TaskRef
+    WorkStealingDeque<Task*> _workQueue;
+
+    // Max number of tasks taken from the global queue in one trip
+    static constexpr size_t MAX_BATCH = 32;
+
+    // LIFO slot: task executed right after the current one. Touched only from the looper thread
+    TaskRef _next;
+
+    // Tasks taken from the slot in a row. Chain of continuations can't hold the looper longer than the limit
+    size_t _nextStreak{0};
+    static constexpr size_t MAX_NEXT_STREAK = 32;
+
+    // Looper thread sleeps here when there is nothing to execute
+    Parker _parker;
+
+    // Optional epoll instance, the looper sleeps in it instead of Parker and serves descriptors of its sockets
+    std::unique_ptr<Reactor> _reactor;
+
+    // Busy looper checks descriptors once per this many iterations
+    uint32_t _ioCountdown{0};
+    static constexpr uint32_t IO_POLL_INTERVAL = 32;
+
+    // io_uring for AsyncFile, completions come through the reactor. Destroyed before it
+    std::unique_ptr<IoRing> _ring;
+
+    // Pool-wide set of sleeping loopers, looper registers itself before parking
+    IdleSet& _idle;
+
+    // Pool-wide count of spinning loopers and how this looper waits for work
+    SpinLimiter& _spinners;
+    const IdleOptions _idleOptions;
+
+    // Moving average of time between running out of work and getting some, drives IdleStrategy::ADAPTIVE
+    TaskClock::duration _idleGap{0};
 
-    // Synchronizes access to task queues and provides waits
-    QueueWatcher& _watcher;
+    // Pause instructions between checks for work while spinning
+    static constexpr int SPIN_ROUND = 16;
 
-    // ThreadPool instance, used only to reschedule tasks
+    // Set for loopers added by an elastic pool: how long they sleep before retiring
+    std::optional<TaskClock::duration> _retireAfter;
+
+    // Pool let the looper go, loop() returns. Touched only from the looper thread
+    bool _retired{false};
+
+    // Start of the task being executed, zero between tasks. Lets the pool notice loopers blocked in long tasks
+    std::atomic<TaskClock::rep> _taskStarted{0};
+
+    // ThreadPool instance, used to reschedule and steal tasks
     ThreadPoolBase* _pool;
 
     // Should reschedule *current* task after it finishes?
@@ -40,13 +97,51 @@ class Looper {
     // Reschedule policy of *current* task
     std::optional<TaskPolicy> _reschedulePolicy;
 
+    // Scheduler statistics, written only by the looper thread
+    LooperCounters _counters;
+
+    // Delayed and periodic tasks waiting for their due time
+    TimerWheel _timers;
+
+    // Expired tasks, kept between iterations to reuse memory
+    std::vector<TaskRef> _expired;
+
+    // When local queue, deque and timers have to be scanned for canceled tasks
+    PurgeTrigger _purgeTrigger;
+
+    // Canceled tasks taken out of the queues, kept between purges to reuse memory
+    std::vector<TaskRef> _canceled;
+
 public:
-    Looper(int index, TaskQueue *queue, QueueWatcher& watcher, ThreadPoolBase* pool);
+    Looper(int index, PriorityTaskQueue *queue, IdleSet& idle, SpinLimiter& spinners, ThreadPoolBase* pool,
+           SchedulerMode mode = SchedulerMode::GLOBAL_QUEUE, const IdleOptions& idleOptions = {});
 
     ~Looper();
 
     // Add task to local queue. Tasks from local queue are executed before any other tasks
-    void pushBack(const std::shared_ptr<Task> &_currentTask);
+    void pushBack(TaskRef task);
+
+    // Add task to work-stealing deque. Has to be called only from the looper thread
+    void pushWork(TaskRef task);
+
+    // Make the task the next one to execute. Task previously in the slot goes to work-stealing deque.
+    // Has to be called only from the looper thread
+    void pushNext(TaskRef task);
+
+    // Add delayed task to the timer wheel. Has to be called only from the looper thread
+    void addTimer(TaskRef task);
+
+    // Same from any other thread, wakes looper up to recalculate its sleep time
+    void postTimer(TaskRef task) noexcept;
+
+    // Take the oldest task from work-stealing deque. Can be called from any thread
+    TaskRef stealWork() noexcept;
+
+    // Get work-stealing deque size
+    size_t getWorkSize() const noexcept;
+
+    // Get thread pool the looper belongs to
+    ThreadPoolBase* getPool() const noexcept;
 
     // Get looper index
     int getIndex() const noexcept;
@@ -54,9 +149,45 @@ public:
     // Get local queue size
     size_t getQueueSize() const noexcept;
 
+    // Get queue wait statistics of tasks executed by this looper
+    LatencyStats getQueueWaitStats(TaskPriority priority) const noexcept;
+
+    // Copy of looper counters and queue sizes, can be called from any thread
+    LooperMetrics getMetrics() const noexcept;
+
+    // Counts tasks submitted by the looper thread. Has to be called only from the looper thread
+    void countSubmitted(size_t count) noexcept;
+
+    // Makes the looper retire after sleeping `timeout` with nothing to do. Has to be called before loop()
+    void setRetireTimeout(TaskClock::duration timeout) noexcept;
+
+    // Makes the looper wait in epoll. Has to be called before loop()
+    void enableReactor();
+
+    // Reactor of the looper, nullptr if it has none. Has to be used only from the looper thread
+    Reactor *getReactor() const noexcept;
+
+    // Sets up io_uring for file I/O when `backend` asks for it. Without io_uring the looper is left with none,
+    // unless FileIoBackend::URING is required, then std::runtime_error is thrown. Has to be called after
+    // enableReactor() and before loop()
+    void enableFileIo(FileIoBackend backend);
+
+    // io_uring of the looper, nullptr if it has none. Has to be used only from the looper thread
+    IoRing *getRing() const noexcept;
+
+    // Is anything queued for this looper only: own queues, LIFO slot and timers.
+    // Has to be called only from the looper thread
+    bool hasOwnWork() const noexcept;
+
+    // How long the current task has been running, zero between tasks. Can be called from any thread
+    TaskClock::duration getTaskRunTime(TaskClock::time_point now) const noexcept;
+
     // Ask looper to finish all local tasks and stop
     void stop() noexcept;
 
+    // Wake looper up if it sleeps. Returns true if it actually was sleeping
+    bool unpark() noexcept;
+
     // Start looper, blocking call
     void loop();
 
@@ -68,8 +199,44 @@ public:
 private:
     bool isEmpty();
 
+    // Is there anything the looper can execute
+    bool hasWork() const noexcept;
+
+    // Sleep until a task is scheduled for execution, the nearest timer expires or looper is stopped
+    void waitForWork() noexcept;
+
+    // How long to spin before parking, see IdleStrategy
+    TaskClock::duration spinBudget() const noexcept;
+
+    // Spins, then yields until work arrives or the budget runs out. Returns true if there is work
+    bool spinForWork(TaskClock::time_point deadline) noexcept;
+
+    // Parks until woken up or `expiry`
+    void park(std::optional<TaskClock::time_point> expiry) noexcept;
+
+    // Runs watches of ready descriptors, polling for them once in a while when busy
+    void serveIo();
+
+    // Drops canceled tasks from own queues and timers, and lets the pool purge the global queue
+    void purgeCanceled();
+
+    // Passes expired timers to thread pool
+    void fireTimers();
+
+    // Puts finished periodic task back to the wheel, skipping missed runs
+    void rearm(const TaskRef &task);
+
+    // Next UNBOUND task: own deque, then global queue, then other loopers' deques
+    TaskRef nextTask(TaskSource &source);
+
+    // Takes several tasks from the global queue at once, batch grows with queue depth
+    TaskRef takeGlobal();
+
+    // Executes pending task and reschedules it if asked
+    void run(const TaskRef &task, TaskSource source);
+
     // Passes current task to thread pool
-    void doReschedule(const std::shared_ptr<Task> &_currentTask);
+    void doReschedule(const TaskRef &task);
 };
 
 #endif // LOOPER_H
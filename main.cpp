@@ -5,8 +5,10 @@
 #include <vector>
 
 #include "application.h"
+#include "coroutine.h"
 #include "promise.h"
 #include "event.h"
+#include "parallel.h"
 
 using std::chrono_literals::operator""ms;
 using std::chrono_literals::operator""s;
@@ -68,13 +70,26 @@ Promise<int> calc(int a, int b) {
     }, a, b);
 }
 
+// GCC lowers coroutine bodies into a switch over suspension points without a default case
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wswitch-default"
+
+// Each step continues on the looper which finished previous promise
+static Coroutine<int> calcChain(int a, int b, int c) {
+    auto product = co_await calc(a, b);
+    co_return co_await calc(product, c);
+}
+
+static Coroutine<> printChain() {
+    auto result = co_await calcChain(2, 3, 7);
+    std::cerr << "\tChain result " << result << " | " << App->getThreadId() << std::endl;
+}
+
+#pragma GCC diagnostic pop
+
 template <class T>
-void pfor(T start, T end, std::function<void(T)> action) {
-    auto inst = Application::getInstance();
-    for (T i = start; i < end; ++i) {
-        std::this_thread::sleep_for(40ms);
-        inst->addTask([i, action]() { action(i); });
-    }
+Promise<void> pfor(T start, T end, std::function<void(T)> action) {
+    return parallelForAsync(start, end, 0, action);
 }
 
 class Dummy {
@@ -147,17 +162,12 @@ int main() {
         numbers.pushBack(i*i);
     }
 
-    app->add([]() {
+    printChain();
+
+    app->addPeriodic(100ms, []() {
         static int count = 0;
         std::cerr << "Task, count = " << count << "\n";
-        if(count < 10) {
-            std::this_thread::sleep_for(100ms);
-            App->rescheduleTask(TaskPolicy {
-                                   TaskBindingPolicy::UNBOUND_EXCEPT,
-                                   App->getThreadId()
-                               });
-        }
-        else {
+        if(count == 10) {
             App->exit(0);
         }
         ++count;
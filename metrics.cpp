@@ -0,0 +1,132 @@
+#include <algorithm>
+
+#include "metrics.h"
+
+namespace {
+
+// Single writer: plain load and store instead of locked read-modify-write
+void add(std::atomic_uint64_t &counter, uint64_t value) noexcept {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+uint64_t toNs(std::chrono::nanoseconds duration) noexcept {
+    return static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0));
+}
+
+}
+
+LooperMetrics &LooperMetrics::operator+=(const LooperMetrics &other) noexcept {
+    submitted += other.submitted;
+    executed += other.executed;
+    rescheduled += other.rescheduled;
+    stolen += other.stolen;
+    wakeups += other.wakeups;
+    spuriousWakeups += other.spuriousWakeups;
+    spins += other.spins;
+    spinHits += other.spinHits;
+    busy += other.busy;
+    idle += other.idle;
+    localQueueSize += other.localQueueSize;
+    workQueueSize += other.workQueueSize;
+    for (size_t i = 0; i < TASK_PRIORITY_COUNT; ++i) {
+        queueWait[i] += other.queueWait[i];
+    }
+    executionTime += other.executionTime;
+    consistent = consistent && other.consistent;
+    return *this;
+}
+
+LooperMetrics ThreadPoolMetrics::total() const noexcept {
+    LooperMetrics sum;
+    for (auto &looper : loopers) {
+        sum += looper;
+    }
+    return sum;
+}
+
+void LooperCounters::recordSubmitted(size_t count) noexcept {
+    beginUpdate();
+    add(_submitted, count);
+    endUpdate();
+}
+
+void LooperCounters::recordExecution(TaskPriority priority, std::chrono::nanoseconds wait,
+                                     std::chrono::nanoseconds duration) noexcept {
+    beginUpdate();
+    add(_executed, 1);
+    _queueWait[static_cast<size_t>(priority)].record(wait);
+    _executionTime.record(duration);
+    endUpdate();
+}
+
+void LooperCounters::recordRescheduled() noexcept {
+    beginUpdate();
+    add(_rescheduled, 1);
+    endUpdate();
+}
+
+void LooperCounters::recordStolen() noexcept {
+    beginUpdate();
+    add(_stolen, 1);
+    endUpdate();
+}
+
+void LooperCounters::recordWakeup(std::chrono::nanoseconds idle, bool spurious) noexcept {
+    beginUpdate();
+    add(_wakeups, 1);
+    if (spurious) {
+        add(_spuriousWakeups, 1);
+    }
+    add(_idleNs, toNs(idle));
+    endUpdate();
+}
+
+void LooperCounters::recordSpin(bool found) noexcept {
+    beginUpdate();
+    add(_spins, 1);
+    if (found) {
+        add(_spinHits, 1);
+    }
+    endUpdate();
+}
+
+LatencyStats LooperCounters::getQueueWaitStats(TaskPriority priority) const noexcept {
+    return _queueWait[static_cast<size_t>(priority)].snapshot();
+}
+
+void LooperCounters::snapshot(LooperMetrics &metrics) const noexcept {
+    for (int attempt = 0; attempt < MAX_SNAPSHOT_ATTEMPTS; ++attempt) {
+        auto version = _version.load(std::memory_order_acquire);
+
+        metrics.submitted = _submitted.load(std::memory_order_relaxed);
+        metrics.executed = _executed.load(std::memory_order_relaxed);
+        metrics.rescheduled = _rescheduled.load(std::memory_order_relaxed);
+        metrics.stolen = _stolen.load(std::memory_order_relaxed);
+        metrics.wakeups = _wakeups.load(std::memory_order_relaxed);
+        metrics.spuriousWakeups = _spuriousWakeups.load(std::memory_order_relaxed);
+        metrics.spins = _spins.load(std::memory_order_relaxed);
+        metrics.spinHits = _spinHits.load(std::memory_order_relaxed);
+        metrics.idle = std::chrono::nanoseconds(static_cast<int64_t>(_idleNs.load(std::memory_order_relaxed)));
+        for (size_t i = 0; i < TASK_PRIORITY_COUNT; ++i) {
+            metrics.queueWait[i] = _queueWait[i].snapshot();
+        }
+        metrics.executionTime = _executionTime.snapshot();
+        metrics.busy = std::chrono::nanoseconds(static_cast<int64_t>(metrics.executionTime.totalNs));
+
+        // Nothing was changed while copying
+        std::atomic_thread_fence(std::memory_order_acquire);
+        metrics.consistent = (version & 1) == 0 && _version.load(std::memory_order_relaxed) == version;
+        if (metrics.consistent) {
+            return;
+        }
+    }
+}
+
+void LooperCounters::beginUpdate() noexcept {
+    _version.store(_version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void LooperCounters::endUpdate() noexcept {
+    _version.store(_version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
@@ -0,0 +1,123 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "latencyhistogram.h"
+#include "task.h"
+
+// Point-in-time copy of one looper's counters
+struct LooperMetrics {
+    int index{-1};
+
+    // Tasks put into run queues from the looper thread. Timers count when they fire
+    uint64_t submitted{0};
+    uint64_t executed{0};
+    uint64_t rescheduled{0};
+    // Tasks taken from other loopers' deques
+    uint64_t stolen{0};
+
+    // Returns from sleep, and those which found nothing to do
+    uint64_t wakeups{0};
+    uint64_t spuriousWakeups{0};
+
+    // Spins for work before parking, and those which got work
+    uint64_t spins{0};
+    uint64_t spinHits{0};
+
+    // Time spent executing tasks and sleeping
+    std::chrono::nanoseconds busy{0};
+    std::chrono::nanoseconds idle{0};
+
+    // Sizes at the moment of the snapshot
+    size_t localQueueSize{0};
+    size_t workQueueSize{0};
+
+    // Time between submission and start of execution, per priority class
+    std::array<LatencyStats, TASK_PRIORITY_COUNT> queueWait{};
+    LatencyStats executionTime;
+
+    // Counters were copied between two updates of the looper. A looper updating them too often to catch
+    // a gap gives a copy where every counter is still exact, but they may disagree by a task or so
+    bool consistent{true};
+
+    LooperMetrics &operator+=(const LooperMetrics &other) noexcept;
+};
+
+struct ThreadPoolMetrics {
+    TaskClock::time_point time;
+
+    size_t globalQueueSize{0};
+    size_t idleLoopers{0};
+
+    // Loopers with a thread, changes only in elastic pool. Retired loopers stay in `loopers`
+    size_t runningLoopers{0};
+
+    // Tasks submitted from threads outside the pool
+    uint64_t externalSubmitted{0};
+
+    std::vector<LooperMetrics> loopers;
+
+    // Sum over all loopers
+    LooperMetrics total() const noexcept;
+};
+
+// Scheduler counters of one looper. Only the looper thread writes them, with relaxed atomics and no locked
+// instructions, readers copy them from any thread without stopping the looper. Counters are kept in their own
+// cache lines, so readers and other loopers don't slow the owner down
+class alignas(64) LooperCounters {
+    // Seqlock version, odd while the owner is in the middle of an update
+    std::atomic_uint64_t _version{0};
+
+    std::atomic_uint64_t _submitted{0};
+    std::atomic_uint64_t _executed{0};
+    std::atomic_uint64_t _rescheduled{0};
+    std::atomic_uint64_t _stolen{0};
+    std::atomic_uint64_t _wakeups{0};
+    std::atomic_uint64_t _spuriousWakeups{0};
+    std::atomic_uint64_t _spins{0};
+    std::atomic_uint64_t _spinHits{0};
+    std::atomic_uint64_t _idleNs{0};
+
+    LatencyHistogram _queueWait[TASK_PRIORITY_COUNT];
+    LatencyHistogram _executionTime;
+
+    // Reader gives up waiting for a gap between updates after this many tries
+    static constexpr int MAX_SNAPSHOT_ATTEMPTS = 16;
+
+public:
+    LooperCounters() = default;
+
+    LooperCounters(const LooperCounters &) = delete;
+    LooperCounters &operator=(const LooperCounters &) = delete;
+
+    // Record methods have to be called only from the owner thread
+    void recordSubmitted(size_t count) noexcept;
+
+    void recordExecution(TaskPriority priority, std::chrono::nanoseconds wait,
+                         std::chrono::nanoseconds duration) noexcept;
+
+    void recordRescheduled() noexcept;
+
+    void recordStolen() noexcept;
+
+    void recordWakeup(std::chrono::nanoseconds idle, bool spurious) noexcept;
+
+    void recordSpin(bool found) noexcept;
+
+    LatencyStats getQueueWaitStats(TaskPriority priority) const noexcept;
+
+    // Fills counters of `metrics`, can be called from any thread
+    void snapshot(LooperMetrics &metrics) const noexcept;
+
+private:
+    void beginUpdate() noexcept;
+
+    void endUpdate() noexcept;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,302 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+#include "promise.h"
+#include "threadpool.h"
+
+// State of one parallel loop. Range is split lazily: a worker cuts off half of its range only when nobody
+// is waiting for a piece already, otherwise it keeps going grain by grain. So pieces are big when loopers
+// are busy and get smaller when some of them are idle
+template<class Index, class Chunk>
+class ParallelJob : public std::enable_shared_from_this<ParallelJob<Index, Chunk>> {
+    using Range = std::pair<Index, Index>;
+
+    std::shared_ptr<ThreadPool> _pool;
+
+    // Processes [begin, end) serially
+    Chunk _chunk;
+
+    // Min number of indices processed without looking at other loopers
+    const size_t _grain;
+
+    // Pieces cut off but not taken by anyone yet. Front is the oldest and the biggest
+    std::mutex _mutex;
+    std::deque<Range> _ranges;
+    std::atomic_size_t _pending{0};
+
+    // Pieces not finished yet, including the ones being processed
+    std::atomic_size_t _remaining{0};
+
+    // Caller of a blocking loop sleeps here
+    std::condition_variable _finishedCondition;
+    bool _finished{false};
+
+    // Executed by the last worker of an asynchronous loop
+    TaskRef _completion;
+
+    std::exception_ptr _error;
+
+public:
+    ParallelJob(std::shared_ptr<ThreadPool> pool, Chunk chunk, size_t grain)
+        : _pool{std::move(pool)}, _chunk{std::move(chunk)}, _grain{grain} {}
+
+    // Makes the last worker execute `completion` instead of notifying the caller
+    void setCompletion(TaskRef completion) noexcept {
+        _completion = std::move(completion);
+    }
+
+    // Passes the range to the pool
+    void spawn(Index begin, Index end) {
+        _remaining.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _ranges.emplace_back(begin, end);
+            _pending.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Task is a ticket for the oldest piece, it does nothing if the piece was taken by the caller
+        _pool->addTask(TaskRef(new Task([job = this->shared_from_this()]() {
+            if (auto range = job->take(false)) {
+                job->run(range->first, range->second);
+            }
+        })));
+    }
+
+    // Processes the range in current thread, splitting it when other loopers have nothing to do
+    void run(Index begin, Index end) {
+        try {
+            while (size(begin, end) > _grain) {
+                if (shouldSplit()) {
+                    auto middle = static_cast<Index>(begin + static_cast<Index>(size(begin, end) / 2));
+                    spawn(middle, end);
+                    end = middle;
+                }
+                else {
+                    auto next = static_cast<Index>(begin + static_cast<Index>(_grain));
+                    _chunk(begin, next);
+                    begin = next;
+                }
+            }
+            _chunk(begin, end);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_error) {
+                _error = std::current_exception();
+            }
+        }
+        finish();
+    }
+
+    // Runs the whole range in current thread and helps with pieces taken by others until all of them finish
+    void runAndWait(Index begin, Index end) {
+        _remaining.fetch_add(1, std::memory_order_relaxed);
+        run(begin, end);
+
+        // Newest pieces are the smallest and were cut off by current thread, they are still in cache
+        while (auto range = take(true)) {
+            run(range->first, range->second);
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finishedCondition.wait(lock, [this]() { return _finished; });
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+    }
+
+    std::exception_ptr getError() const noexcept {
+        return _error;
+    }
+
+private:
+    static size_t size(Index begin, Index end) noexcept {
+        return end > begin ? static_cast<size_t>(end - begin) : 0;
+    }
+
+    // Split when all pieces cut off before are taken and at least one looper is going to take a new one
+    bool shouldSplit() const noexcept {
+        auto pending = _pending.load(std::memory_order_relaxed);
+        return pending == 0 || pending < _pool->getIdleCount();
+    }
+
+    std::optional<Range> take(bool newest) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_ranges.empty()) {
+            return std::nullopt;
+        }
+
+        Range range;
+        if (newest) {
+            range = _ranges.back();
+            _ranges.pop_back();
+        }
+        else {
+            range = _ranges.front();
+            _ranges.pop_front();
+        }
+        _pending.fetch_sub(1, std::memory_order_relaxed);
+        return range;
+    }
+
+    void finish() {
+        if (_remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+
+        if (_completion) {
+            // Completion task holds the job, break the cycle before running it
+            auto completion = std::move(_completion);
+            completion->execute();
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _finished = true;
+        _finishedCondition.notify_all();
+    }
+};
+
+// Loops below run over [begin, end) in the main thread pool. `grain` is the smallest piece processed without
+// checking for idle loopers, 0 picks it from the range size and looper count
+inline size_t parallelGrain(size_t size, size_t grain) {
+    if (grain != 0) {
+        return grain;
+    }
+    // Several pieces per looper, so late loopers still find something to take
+    return std::max<size_t>(1, size / (getMainThreadPool()->getLooperCount() * 8));
+}
+
+// Calls `body(i)` for every index. Current thread takes part in the work and returns when the loop is finished.
+// Exception thrown by `body` drops the rest of the piece it was thrown in, other pieces still run. The first
+// exception is rethrown to the caller
+template<class Index, class Body>
+void parallelFor(Index begin, Index end, size_t grain, Body body) {
+    static_assert(std::is_integral_v<Index>, "Index has to be integral");
+    if (end <= begin) {
+        return;
+    }
+
+    auto chunk = [&body](Index from, Index to) {
+        for (auto i = from; i < to; ++i) {
+            body(i);
+        }
+    };
+    auto size = static_cast<size_t>(end - begin);
+    auto job = std::make_shared<ParallelJob<Index, decltype(chunk)>>(getMainThreadPool(), chunk,
+                                                                     parallelGrain(size, grain));
+    job->runAndWait(begin, end);
+}
+
+// Same, but returns immediately. Promise is fulfilled by the looper finishing the last piece, the first
+// exception of `body` is rethrown by `result()` or `co_await` of the promise
+template<class Index, class Body>
+Promise<void> parallelForAsync(Index begin, Index end, size_t grain, Body body) {
+    static_assert(std::is_integral_v<Index>, "Index has to be integral");
+
+    auto chunk = [body = std::move(body)](Index from, Index to) {
+        for (auto i = from; i < to; ++i) {
+            body(i);
+        }
+    };
+    using Job = ParallelJob<Index, decltype(chunk)>;
+
+    auto size = end > begin ? static_cast<size_t>(end - begin) : 0;
+    auto job = std::make_shared<Job>(getMainThreadPool(), std::move(chunk), parallelGrain(size, grain));
+
+    TaskRef completion(makePromiseTask<void>([job]() {
+        if (auto error = job->getError()) {
+            std::rethrow_exception(error);
+        }
+    }));
+    auto promise = Promise<void>::deferred(completion);
+    if (size == 0) {
+        completion->execute();
+        return promise;
+    }
+
+    job->setCompletion(completion);
+    job->spawn(begin, end);
+    return promise;
+}
+
+// Reduces `map(i)` of every index with `combine`, starting from `identity`. Pieces are combined in any order,
+// so `combine` has to be associative and commutative. Current thread takes part in the work
+template<class Index, class T, class Map, class Combine>
+T parallelReduce(Index begin, Index end, T identity, Map map, Combine combine, size_t grain = 0) {
+    static_assert(std::is_integral_v<Index>, "Index has to be integral");
+    if (end <= begin) {
+        return identity;
+    }
+
+    std::mutex mutex;
+    T result = identity;
+    auto chunk = [&](Index from, Index to) {
+        T local = identity;
+        for (auto i = from; i < to; ++i) {
+            local = combine(std::move(local), map(i));
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        result = combine(std::move(result), std::move(local));
+    };
+    auto size = static_cast<size_t>(end - begin);
+    auto job = std::make_shared<ParallelJob<Index, decltype(chunk)>>(getMainThreadPool(), chunk,
+                                                                     parallelGrain(size, grain));
+    job->runAndWait(begin, end);
+    return result;
+}
+
+// Same, but returns immediately. Promise is fulfilled by the looper finishing the last piece, exceptions
+// are handled as by parallelForAsync
+template<class Index, class T, class Map, class Combine>
+Promise<T> parallelReduceAsync(Index begin, Index end, T identity, Map map, Combine combine, size_t grain = 0) {
+    static_assert(std::is_integral_v<Index>, "Index has to be integral");
+
+    // Partial results live with the job, so pieces can outlive the caller
+    struct Accumulator {
+        std::mutex mutex;
+        T result;
+    };
+    auto accumulator = std::make_shared<Accumulator>();
+    accumulator->result = identity;
+
+    auto chunk = [accumulator, identity, map = std::move(map), combine](Index from, Index to) {
+        T local = identity;
+        for (auto i = from; i < to; ++i) {
+            local = combine(std::move(local), map(i));
+        }
+        std::lock_guard<std::mutex> lock(accumulator->mutex);
+        accumulator->result = combine(std::move(accumulator->result), std::move(local));
+    };
+    using Job = ParallelJob<Index, decltype(chunk)>;
+
+    auto size = end > begin ? static_cast<size_t>(end - begin) : 0;
+    auto job = std::make_shared<Job>(getMainThreadPool(), std::move(chunk), parallelGrain(size, grain));
+
+    TaskRef completion(makePromiseTask<T>([job, accumulator]() {
+        if (auto error = job->getError()) {
+            std::rethrow_exception(error);
+        }
+        return std::move(accumulator->result);
+    }));
+    auto promise = Promise<T>::deferred(completion);
+    if (size == 0) {
+        completion->execute();
+        return promise;
+    }
+
+    job->setCompletion(completion);
+    job->spawn(begin, end);
+    return promise;
+}
+
+#endif // PARALLEL_H
@@ -0,0 +1,116 @@
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "parker.h"
+
+namespace {
+
+int futex(std::atomic<int32_t> *address, int op, int32_t value, const timespec *timeout) noexcept {
+    return static_cast<int>(syscall(SYS_futex, reinterpret_cast<int32_t*>(address), op, value, timeout, nullptr, 0));
+}
+
+}
+
+void Parker::park() noexcept {
+    // Consume pending notification or become PARKED
+    if (_state.fetch_sub(1, std::memory_order_acquire) == NOTIFIED) {
+        return;
+    }
+
+    while (true) {
+        futex(&_state, FUTEX_WAIT_PRIVATE, PARKED, nullptr);
+        int32_t notified = NOTIFIED;
+        if (_state.compare_exchange_strong(notified, EMPTY, std::memory_order_acquire)) {
+            return;
+        }
+        // Spurious wake up, sleep again
+    }
+}
+
+bool Parker::park(std::chrono::nanoseconds timeout) noexcept {
+    if (_state.fetch_sub(1, std::memory_order_acquire) == NOTIFIED) {
+        return true;
+    }
+
+    if (timeout.count() > 0) {
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        timespec ts;
+        ts.tv_sec = static_cast<time_t>(seconds.count());
+        ts.tv_nsec = static_cast<long>((timeout - seconds).count());
+        futex(&_state, FUTEX_WAIT_PRIVATE, PARKED, &ts);
+    }
+
+    return _state.exchange(EMPTY, std::memory_order_acquire) == NOTIFIED;
+}
+
+bool Parker::unpark() noexcept {
+    if (_state.exchange(NOTIFIED, std::memory_order_release) == PARKED) {
+        futex(&_state, FUTEX_WAKE_PRIVATE, 1, nullptr);
+        return true;
+    }
+    return false;
+}
+
+IdleSet::IdleSet(size_t size)
+    : _words{new std::atomic<uint64_t>[(size + 63) / 64]}, _wordCount{(size + 63) / 64} {
+    for (size_t i = 0; i < _wordCount; ++i) {
+        _words[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void IdleSet::add(size_t index) noexcept {
+    uint64_t bit = uint64_t{1} << (index % 64);
+    if ((_words[index / 64].fetch_or(bit, std::memory_order_seq_cst) & bit) == 0) {
+        _count.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool IdleSet::remove(size_t index) noexcept {
+    uint64_t bit = uint64_t{1} << (index % 64);
+    if ((_words[index / 64].fetch_and(~bit, std::memory_order_seq_cst) & bit) != 0) {
+        _count.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+int IdleSet::take() noexcept {
+    for (size_t i = 0; i < _wordCount; ++i) {
+        uint64_t word = _words[i].load(std::memory_order_seq_cst);
+        while (word != 0) {
+            auto bit = static_cast<size_t>(__builtin_ctzll(word));
+            if (_words[i].compare_exchange_weak(word, word & ~(uint64_t{1} << bit), std::memory_order_seq_cst)) {
+                _count.fetch_sub(1, std::memory_order_relaxed);
+                return static_cast<int>(i * 64 + bit);
+            }
+        }
+    }
+    return -1;
+}
+
+size_t IdleSet::count() const noexcept {
+    return _count.load(std::memory_order_relaxed);
+}
+
+SpinLimiter::SpinLimiter(size_t max) noexcept
+    : _max{max} {}
+
+bool SpinLimiter::tryStart() noexcept {
+    auto count = _count.load(std::memory_order_relaxed);
+    while (count < _max) {
+        if (_count.compare_exchange_weak(count, count + 1, std::memory_order_seq_cst)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t SpinLimiter::stop() noexcept {
+    return _count.fetch_sub(1, std::memory_order_seq_cst) - 1;
+}
+
+size_t SpinLimiter::count() const noexcept {
+    return _count.load(std::memory_order_seq_cst);
+}
@@ -0,0 +1,113 @@
+#ifndef PARKER_H
+#define PARKER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+// Binary semaphore for a single thread built on futex.
+// `unpark()` before `park()` is not lost: the next `park()` returns immediately
+class Parker {
+    static constexpr int32_t EMPTY = 0;
+    static constexpr int32_t NOTIFIED = 1;
+    static constexpr int32_t PARKED = -1;
+
+    std::atomic<int32_t> _state{EMPTY};
+
+public:
+    Parker() = default;
+
+    Parker(const Parker &) = delete;
+    Parker &operator=(const Parker &) = delete;
+
+    // Blocks owner thread until `unpark()` is called. Can return spuriously
+    void park() noexcept;
+
+    // Same as `park()`, but gives up after timeout. Returns true if was unparked
+    bool park(std::chrono::nanoseconds timeout) noexcept;
+
+    // Wakes owner thread. Returns true if the thread was actually sleeping
+    bool unpark() noexcept;
+};
+
+// Set of idle looper indices, lock-free bitmap
+class IdleSet {
+    std::unique_ptr<std::atomic<uint64_t>[]> _words;
+    size_t _wordCount;
+    std::atomic_size_t _count{0};
+
+public:
+    explicit IdleSet(size_t size);
+
+    IdleSet(const IdleSet &) = delete;
+    IdleSet &operator=(const IdleSet &) = delete;
+
+    void add(size_t index) noexcept;
+
+    // Returns true if index was in the set
+    bool remove(size_t index) noexcept;
+
+    // Removes and returns any index from the set, -1 if set is empty
+    int take() noexcept;
+
+    size_t count() const noexcept;
+};
+
+// What a looper does when it runs out of work
+enum class IdleStrategy {
+    // Park right away. Cheapest for CPU, every task arriving later pays a kernel wake up
+    PARK,
+
+    // Spin for `IdleOptions::maxSpin`, yield a few times, then park
+    SPIN,
+
+    // Like SPIN, but the spin follows recent gaps between running out of work and getting some:
+    // a looper which usually waits longer than it could spin parks right away
+    ADAPTIVE
+};
+
+struct IdleOptions {
+    IdleStrategy strategy {IdleStrategy::ADAPTIVE};
+
+    // Max time spent spinning with pause instructions
+    std::chrono::nanoseconds maxSpin {std::chrono::microseconds(50)};
+
+    // Number of `yield()` calls between spinning and parking
+    uint32_t yields {8};
+
+    // Max loopers spinning at the same time, 0 means one per four loopers
+    size_t maxSpinners {0};
+};
+
+// Tells the CPU we are in a spin-wait loop
+inline void cpuRelax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Counts loopers spinning for work, so an idle pool burns at most a few cores. Submitters don't wake parked
+// loopers for work a spinner is going to take
+class SpinLimiter {
+    std::atomic_size_t _count{0};
+    const size_t _max;
+
+public:
+    explicit SpinLimiter(size_t max) noexcept;
+
+    SpinLimiter(const SpinLimiter &) = delete;
+    SpinLimiter &operator=(const SpinLimiter &) = delete;
+
+    // Returns false if too many loopers spin already
+    bool tryStart() noexcept;
+
+    // Returns number of loopers still spinning
+    size_t stop() noexcept;
+
+    size_t count() const noexcept;
+};
+
+#endif // PARKER_H
@@ -0,0 +1,227 @@
+#include <algorithm>
+
+#include "prioritytaskqueue.h"
+
+namespace {
+
+using DeadlineHeap = std::vector<std::pair<TaskClock::time_point, TaskRef>>;
+
+// Min-heap by deadline
+bool laterDeadline(const DeadlineHeap::value_type &a, const DeadlineHeap::value_type &b) noexcept {
+    return a.first > b.first;
+}
+
+// Heap is sifted by hand with unsigned indices, std heap algorithms trip -Wstrict-overflow
+void siftUp(DeadlineHeap &heap, size_t index) noexcept {
+    while (index > 0) {
+        auto parent = (index - 1) / 2;
+        if (!laterDeadline(heap[parent], heap[index])) {
+            return;
+        }
+        std::swap(heap[parent], heap[index]);
+        index = parent;
+    }
+}
+
+void siftDown(DeadlineHeap &heap, size_t index) noexcept {
+    auto size = heap.size();
+    while (true) {
+        auto earliest = index;
+        auto left = 2 * index + 1;
+        auto right = left + 1;
+        if (left < size && laterDeadline(heap[earliest], heap[left])) {
+            earliest = left;
+        }
+        if (right < size && laterDeadline(heap[earliest], heap[right])) {
+            earliest = right;
+        }
+        if (earliest == index) {
+            return;
+        }
+        std::swap(heap[index], heap[earliest]);
+        index = earliest;
+    }
+}
+
+}
+
+PriorityTaskQueue::PriorityTaskQueue(QueueType type, size_t capacity, uint32_t starvationLimit)
+    : _starvationLimit{std::max<uint32_t>(starvationLimit, 1)} {
+    for (auto &cls : _classes) {
+        cls.fifo = makeTaskQueue(type, capacity);
+    }
+}
+
+void PriorityTaskQueue::push(TaskRef task) {
+    const auto &policy = task->getPolicy();
+    auto &cls = _classes[static_cast<size_t>(policy.priority)];
+    if (policy.deadline) {
+        pushDeadline(cls, std::move(task), *policy.deadline);
+    }
+    else {
+        cls.fifo->push(std::move(task));
+    }
+}
+
+void PriorityTaskQueue::pushBatch(const TaskRef *tasks, size_t count) {
+    // Usual batch is homogeneous: pass it to one FIFO queue as is
+    auto priority = count ? tasks[0]->getPolicy().priority : TaskPriority::NORMAL;
+    bool homogeneous = std::all_of(tasks, tasks + count, [priority](const TaskRef &task) {
+        const auto &policy = task->getPolicy();
+        return policy.priority == priority && !policy.deadline;
+    });
+
+    if (homogeneous) {
+        _classes[static_cast<size_t>(priority)].fifo->pushBatch(tasks, count);
+    }
+    else {
+        for (size_t i = 0; i < count; ++i) {
+            push(tasks[i]);
+        }
+    }
+}
+
+TaskRef PriorityTaskQueue::remove() noexcept {
+    // Another consumer can empty the class between the pick and the removal, so try again
+    for (int index = pickClass(); index >= 0; index = pickClass()) {
+        auto &cls = _classes[index];
+        if (auto task = removeDeadline(cls)) {
+            return task;
+        }
+        if (auto task = cls.fifo->remove()) {
+            return task;
+        }
+    }
+    return {nullptr};
+}
+
+size_t PriorityTaskQueue::removeBatch(TaskRef *out, size_t max) noexcept {
+    if (max == 0) {
+        return 0;
+    }
+
+    for (int index = pickClass(); index >= 0; index = pickClass()) {
+        auto &cls = _classes[index];
+        // Urgent tasks are handed out one at a time, so they never wait behind each other in a looper
+        if (auto task = removeDeadline(cls)) {
+            out[0] = std::move(task);
+            return 1;
+        }
+        auto urgent = index > static_cast<int>(TaskPriority::NORMAL);
+        if (auto count = cls.fifo->removeBatch(out, urgent ? 1 : max)) {
+            return count;
+        }
+    }
+    return 0;
+}
+
+bool PriorityTaskQueue::empty() const noexcept {
+    return std::all_of(std::begin(_classes), std::end(_classes), [](const PriorityClass &cls) {
+        return cls.empty();
+    });
+}
+
+size_t PriorityTaskQueue::size() const noexcept {
+    size_t size = 0;
+    for (auto &cls : _classes) {
+        size += cls.fifo->size() + cls.deadlines.size.load(std::memory_order_relaxed);
+    }
+    return size;
+}
+
+void PriorityTaskQueue::clear() noexcept {
+    for (auto &cls : _classes) {
+        cls.fifo->clear();
+        std::lock_guard<std::mutex> lock(cls.deadlines.mutex);
+        cls.deadlines.heap.clear();
+        cls.deadlines.size = 0;
+    }
+}
+
+size_t PriorityTaskQueue::purgeCanceled(std::vector<TaskRef> &removed) {
+    size_t count = 0;
+    for (auto &cls : _classes) {
+        count += cls.fifo->purgeCanceled(removed);
+
+        if (cls.deadlines.size.load(std::memory_order_acquire) == 0) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(cls.deadlines.mutex);
+        auto &heap = cls.deadlines.heap;
+        auto live = std::partition(heap.begin(), heap.end(), [](const auto &entry) {
+            return !entry.second->isCanceled();
+        });
+        for (auto it = live; it != heap.end(); ++it) {
+            removed.push_back(std::move(it->second));
+        }
+        count += static_cast<size_t>(heap.end() - live);
+        heap.erase(live, heap.end());
+        for (auto index = heap.size() / 2; index-- > 0;) {
+            siftDown(heap, index);
+        }
+        cls.deadlines.size.store(heap.size(), std::memory_order_release);
+    }
+    return count;
+}
+
+bool PriorityTaskQueue::hasUrgent() const noexcept {
+    for (size_t i = static_cast<size_t>(TaskPriority::HIGH); i < TASK_PRIORITY_COUNT; ++i) {
+        if (!_classes[i].empty()) {
+            return true;
+        }
+    }
+    return std::any_of(std::begin(_classes), std::end(_classes), [](const PriorityClass &cls) {
+        return cls.deadlines.size.load(std::memory_order_relaxed) != 0;
+    });
+}
+
+int PriorityTaskQueue::pickClass() noexcept {
+    size_t top = TASK_PRIORITY_COUNT;
+    while (top > 0 && _classes[top - 1].empty()) {
+        --top;
+    }
+    if (top == 0) {
+        return -1;
+    }
+    --top;
+
+    // Every waiting lower class is skipped once more. The one that was skipped too often is served instead
+    size_t pick = top;
+    for (size_t index = top; index-- > 0;) {
+        auto &cls = _classes[index];
+        if (cls.empty()) {
+            continue;
+        }
+        if (cls.skipped.fetch_add(1, std::memory_order_relaxed) + 1 >= _starvationLimit && pick == top) {
+            pick = index;
+        }
+    }
+
+    _classes[pick].skipped.store(0, std::memory_order_relaxed);
+    return static_cast<int>(pick);
+}
+
+void PriorityTaskQueue::pushDeadline(PriorityClass &cls, TaskRef task, TaskClock::time_point deadline) {
+    std::lock_guard<std::mutex> lock(cls.deadlines.mutex);
+    cls.deadlines.heap.emplace_back(deadline, std::move(task));
+    siftUp(cls.deadlines.heap, cls.deadlines.heap.size() - 1);
+    cls.deadlines.size.store(cls.deadlines.heap.size(), std::memory_order_release);
+}
+
+TaskRef PriorityTaskQueue::removeDeadline(PriorityClass &cls) noexcept {
+    if (cls.deadlines.size.load(std::memory_order_acquire) == 0) {
+        return {nullptr};
+    }
+
+    std::lock_guard<std::mutex> lock(cls.deadlines.mutex);
+    auto &heap = cls.deadlines.heap;
+    if (heap.empty()) {
+        return {nullptr};
+    }
+    std::swap(heap.front(), heap.back());
+    auto task = std::move(heap.back().second);
+    heap.pop_back();
+    siftDown(heap, 0);
+    cls.deadlines.size.store(heap.size(), std::memory_order_release);
+    return task;
+}
@@ -0,0 +1,72 @@
+#ifndef PRIORITYTASKQUEUE_H
+#define PRIORITYTASKQUEUE_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "task.h"
+#include "taskqueuebase.h"
+
+// Task queue ordered by TaskPolicy::priority. Every priority class has a FIFO queue of configured type
+// and a heap of tasks with deadline, which go first within the class (earliest deadline first).
+// To keep low priority work moving, a non-empty class is served once it was skipped `starvationLimit` times
+class PriorityTaskQueue : public TaskQueueBase {
+    struct DeadlineHeap {
+        std::mutex mutex;
+        std::vector<std::pair<TaskClock::time_point, TaskRef>> heap;
+        std::atomic_size_t size{0};
+    };
+
+    struct alignas(64) PriorityClass {
+        std::unique_ptr<TaskQueueBase> fifo;
+        DeadlineHeap deadlines;
+
+        // How many times the class was passed over in favor of more urgent ones
+        std::atomic_uint32_t skipped{0};
+
+        bool empty() const noexcept {
+            return fifo->empty() && deadlines.size.load(std::memory_order_acquire) == 0;
+        }
+    };
+
+    PriorityClass _classes[TASK_PRIORITY_COUNT];
+    const uint32_t _starvationLimit;
+
+public:
+    // Capacity is applied to every FIFO queue separately
+    explicit PriorityTaskQueue(QueueType type = QueueType::MUTEX, size_t capacity = 0, uint32_t starvationLimit = 32);
+
+    PriorityTaskQueue(const PriorityTaskQueue &) = delete;
+    PriorityTaskQueue &operator=(const PriorityTaskQueue &) = delete;
+
+    virtual void push(TaskRef task) override;
+
+    virtual void pushBatch(const TaskRef *tasks, size_t count) override;
+
+    virtual TaskRef remove() noexcept override;
+
+    // Batch is always taken from one priority class. Urgent tasks are taken one by one
+    virtual size_t removeBatch(TaskRef *out, size_t max) noexcept override;
+
+    virtual bool empty() const noexcept override;
+
+    virtual size_t size() const noexcept override;
+
+    virtual void clear() noexcept override;
+
+    virtual size_t purgeCanceled(std::vector<TaskRef> &removed) override;
+
+    // Is there a task more urgent than TaskPriority::NORMAL or with a deadline
+    bool hasUrgent() const noexcept;
+
+private:
+    // Index of the class to serve next, -1 if queue is empty
+    int pickClass() noexcept;
+
+    void pushDeadline(PriorityClass &cls, TaskRef task, TaskClock::time_point deadline);
+
+    TaskRef removeDeadline(PriorityClass &cls) noexcept;
+};
+
+#endif // PRIORITYTASKQUEUE_H
@@ -3,175 +3,543 @@
 
 #include "application.h"
 #include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
 #include <optional>
+#include <stdexcept>
 #include <functional>
+#include <new>
 #include <tuple>
 
-template<class T>
-class PromiseTask : public Task {
-    using Thennable = std::function<void(T)>;
+// Callback run by the thread which finished or canceled a promise task, it checks the task state.
+// Hooks are intrusive, so the caller owns the memory
+struct CompletionHook {
+    void (*fire)(CompletionHook *hook);
+    CompletionHook *next{nullptr};
+};
+
+// `then` callback of a promise task. It is created by `then` and holds the callback inline, the promise task
+// passes itself to it when finished, so nothing is allocated on the completion path
+class ContinuationTaskBase : public Task {
+    // Finished promise task, set right before the continuation is dispatched
+    TaskRef _source;
+
+    friend class PromiseTaskBase;
+
+public:
+    explicit ContinuationTaskBase(const TaskPolicy &policy) noexcept
+        : Task{nullptr, policy} {}
+
+protected:
+    Task *getSource() const noexcept {
+        return _source.get();
+    }
+
+    // Result is taken, the promise task is not needed anymore
+    void releaseSource() noexcept {
+        _source = nullptr;
+    }
+};
+
+// Completion part shared by all promise tasks
+class PromiseTaskBase : public Task {
+    // Marks the hook list of a finished task, no hooks can be added after it
+    static inline CompletionHook *const CLOSED = reinterpret_cast<CompletionHook*>(uintptr_t{1});
+
+    // Lock-free stack of hooks waiting for the task to finish or to be canceled
+    std::atomic<CompletionHook*> _hooks{nullptr};
 
-    TaskPolicy _thenPolicy;
-    Thennable _then;
+    // Policy of continuations, `then` can override its continuation mode
+    const TaskPolicy _thenPolicy;
+
+    // Continuation waiting for the task. It doesn't reference the task until dispatched, so there is no cycle
     std::mutex _thenMutex;
+    TaskRef _continuation;
+
+    // Set under `_thenMutex` once the task is finished or canceled, so the continuation is dispatched once
+    bool _done{false};
 
-    // Here result is stored. The result is stored as binary data to prevent issues with constructor call
-    uint8_t _resultBlob[sizeof(T)];
+    // Exception thrown by the body. The task is finished, whoever takes the result gets the exception instead
+    std::exception_ptr _error;
 
 public:
-    template<class Callable, class... Args>
-    PromiseTask(Callable&& callback, Args&&... args)
-        : Task{createExecutor(std::forward<Callable>(callback), std::forward<Args>(args)...)},
-          _thenPolicy{}, _then {nullptr} {
+    explicit PromiseTaskBase(const TaskPolicy &policy = {}, const TaskPolicy &thenPolicy = {}) noexcept
+        : Task{nullptr, policy}, _thenPolicy{thenPolicy} {}
+
+    // Adds hook to be fired when the task is finished or canceled. Returns false if that happened already,
+    // the hook is not fired then
+    bool addHook(CompletionHook *hook) noexcept {
+        auto head = _hooks.load(std::memory_order_acquire);
+        do {
+            if (head == CLOSED) {
+                return false;
+            }
+            hook->next = head;
+        } while (!_hooks.compare_exchange_weak(head, hook, std::memory_order_acq_rel, std::memory_order_acquire));
+        return true;
     }
 
-    template<class Callable, class... Args>
-    PromiseTask(Callable&& callback, const TaskPolicy& taskPolicy, const TaskPolicy& thenPolicy, Args&&... args)
-        : Task{createExecutor(std::forward<Callable>(callback), std::forward<Args>(args)...), taskPolicy},
-          _thenPolicy{thenPolicy}, _then {nullptr} {
+    bool isReady() const noexcept {
+        return getState() == TaskState::FINISHED;
     }
 
-    virtual ~PromiseTask() = default;
+    // Is the task finished with an exception
+    bool hasError() const noexcept {
+        return static_cast<bool>(_error);
+    }
 
-    void setThen(Thennable then) {
-        std::lock_guard<std::mutex> lock(_thenMutex);
-        _then = then;
-        if (isReady()) {
-            // If the task have been executed already - just schedule `then` callback and pass the result to it
-            Application::getInstance()->addTask(new Task([result = std::move(*(T*)(_resultBlob)), then = _then]() {
-                then(result);
-            }, _thenPolicy));
+    std::exception_ptr getError() const noexcept {
+        return _error;
+    }
+
+    const TaskPolicy &getThenPolicy() const noexcept {
+        return _thenPolicy;
+    }
+
+    // Sets the continuation, it takes the result, so a promise has one. Dispatched right away if the task
+    // is finished already
+    void setContinuation(TaskRef continuation) {
+        std::unique_lock<std::mutex> lock(_thenMutex);
+        if (!_done) {
+            _continuation = std::move(continuation);
+            return;
+        }
+        lock.unlock();
+        dispatchContinuation(std::move(continuation));
+    }
+
+protected:
+    void setError(std::exception_ptr error) noexcept {
+        _error = std::move(error);
+    }
+
+    void rethrowError() const {
+        if (_error) {
+            std::rethrow_exception(_error);
         }
     }
 
-    T get() const noexcept {
-        return *(T*)(_resultBlob);
+    // Continuation runs after the task is FINISHED, so it sees the promise ready
+    void onFinished() override {
+        fireHooks();
+        complete();
     }
 
-    bool isReady() const  noexcept {
-        return this->getState() == TaskState::FINISHED;
+    // Awaiting coroutines see the task canceled, the continuation is canceled and freed
+    void onCanceled() override {
+        fireHooks();
+        complete();
     }
 
 private:
-    // Wrapps callable with arbitary arguments and return type to `void()` that is accepted by Task
-    template<class Callable, class... Args>
-    Executor createExecutor(Callable&& callback, Args&&... args) {
-        auto argsTuple = std::make_tuple<Args...>(std::forward<Args>(args)...);
+    void fireHooks() {
+        auto hooks = _hooks.exchange(CLOSED, std::memory_order_acq_rel);
+
+        // Fire in order of addition
+        CompletionHook *ordered = nullptr;
+        while (hooks) {
+            auto next = hooks->next;
+            hooks->next = ordered;
+            ordered = hooks;
+            hooks = next;
+        }
+        while (ordered) {
+            // Hook can free itself when fired
+            auto next = ordered->next;
+            ordered->fire(ordered);
+            ordered = next;
+        }
+    }
 
-        // lambda is mutable because `execInternal()` modifies mutex and result field
-        return [this, callback = std::forward<Callable>(callback), args = std::move(argsTuple)]() mutable {
-            execInternal(callback, std::forward<decltype (args)>(args));
-        };
+    void complete() {
+        TaskRef continuation;
+        {
+            std::lock_guard<std::mutex> lock(_thenMutex);
+            _done = true;
+            continuation = std::move(_continuation);
+        }
+        if (continuation) {
+            dispatchContinuation(std::move(continuation));
+        }
     }
 
-    template<class Callable, class... Args>
-    void execInternal(Callable&& callback, std::tuple<Args...>&& args) {
-        // FIXME: Some bad things can happen here
-        *(T*)(_resultBlob) = std::apply(callback, std::forward<decltype (args)>(args));
+    // Runs the continuation as its `policy.continuation` says
+    void dispatchContinuation(TaskRef continuation) {
+        if (getState() == TaskState::CANCELED) {
+            continuation->cancel();
+            return;
+        }
 
-        _thenMutex.lock();
-        if (_then) {
-            Application::getInstance()->addTask(new Task([result = std::move(*(T*)(_resultBlob)), then = _then]() mutable {
-                then(std::forward<T>(result));
-            }, _thenPolicy));
+        static_cast<ContinuationTaskBase*>(continuation.get())->_source = TaskRef(this);
+
+        switch (continuation->getPolicy().continuation) {
+            case ContinuationMode::INLINE:
+                continuation->execute();
+                break;
+            case ContinuationMode::SAME_LOOPER:
+                Application::getInstance()->addTaskNext(std::move(continuation));
+                break;
+            case ContinuationMode::QUEUED:
+            default:
+                Application::getInstance()->addTask(std::move(continuation));
+                break;
         }
-        _thenMutex.unlock();
     }
 };
 
-template<>
-class PromiseTask<void> : public Task {
-    using Thennable = std::function<void()>;
+// Error handler of a continuation without one: the exception goes on to the looper, which reports it
+struct RethrowError {
+    [[noreturn]] void operator()(std::exception_ptr error) const {
+        std::rethrow_exception(std::move(error));
+    }
+};
 
-    TaskPolicy _thenPolicy;
-    Thennable _then;
-    std::mutex _thenMutex;
+// Promise task with result storage. The result lives in the task itself, it is constructed in place when
+// the task runs and moved out once by the consumer: continuation, awaiting coroutine, combinator or `result()`.
+// Subclasses provide the body, see PromiseCallTask
+template<class T>
+class PromiseTask : public PromiseTaskBase {
+    alignas(T) unsigned char _result[sizeof(T)];
+    bool _hasResult{false};
 
 public:
-    template<class Callable, class... Args>
-    PromiseTask(Callable&& callback, Args&&... args)
-        : Task{createExecutor(std::forward<Callable>(callback), std::forward<Args>(args)...)},
-          _thenPolicy{}, _then {nullptr} {
+    using PromiseTaskBase::PromiseTaskBase;
+
+    ~PromiseTask() override {
+        if (_hasResult) {
+            value()->~T();
+        }
     }
 
-    template<class Callable, class... Args>
-    PromiseTask(Callable&& callback, const TaskPolicy& taskPolicy, const TaskPolicy& thenPolicy, Args&&... args)
-        : Task{createExecutor(std::forward<Callable>(callback), std::forward<Args>(args)...), taskPolicy},
-          _thenPolicy{thenPolicy}, _then {nullptr} {
+    // Moves the result out. Only for the finished task and only once. Rethrows the exception of the body
+    T take() {
+        rethrowError();
+        return std::move(*value());
     }
 
-    virtual ~PromiseTask() {
+    // Creates the continuation calling `callback(T)` with the result
+    // `onError(std::exception_ptr)` is called instead of `callback` if the body threw
+    template<class Callback, class OnError>
+    void setThen(Callback &&callback, OnError &&onError, ContinuationMode mode);
+
+    template<class Callback>
+    void setThen(Callback &&callback, ContinuationMode mode) {
+        setThen(std::forward<Callback>(callback), RethrowError{}, mode);
     }
 
-    void setThen(Thennable then) {
-        std::lock_guard<std::mutex> lock(_thenMutex);
-        _then = then;
-        if (isReady()) {
-            Application::getInstance()->addTask(new Task(_then, _thenPolicy));
-        }
+    template<class Callback>
+    void setThen(Callback &&callback) {
+        setThen(std::forward<Callback>(callback), RethrowError{}, getThenPolicy().continuation);
     }
 
+protected:
+    // Constructs the result from what `producer()` returns, without moving it. Exception is kept for the consumer
+    template<class Producer>
+    void produce(Producer &&producer) {
+        try {
+            new (_result) T(std::forward<Producer>(producer)());
+            _hasResult = true;
+        }
+        catch (...) {
+            setError(std::current_exception());
+        }
+    }
 
-    bool isReady() const noexcept {
-        return this->getState() == TaskState::FINISHED;
+    // Moves `value` straight into the result storage
+    void produceValue(T &&value) {
+        produce([&value]() -> T && {
+            return std::move(value);
+        });
     }
 
 private:
-    template<class Callable, class... Args>
-    Executor createExecutor(Callable&& callback, Args&&... args) {
-        auto argsTuple = std::make_tuple<Args...>(std::forward<Args>(args)...);
-        return [this, callback = std::forward<Callable>(callback), args = std::move(argsTuple)]() mutable {
-            execInternal(callback, std::forward<decltype (args)>(args));
-        };
+    T *value() noexcept {
+        return std::launder(reinterpret_cast<T*>(_result));
     }
+};
 
-    template<class Callable, class... Args>
-    void execInternal(Callable&& callback, std::tuple<Args...>&& args) {
-        std::apply(callback, std::forward<decltype (args)>(args));
+template<>
+class PromiseTask<void> : public PromiseTaskBase {
+public:
+    using PromiseTaskBase::PromiseTaskBase;
+
+    void take() const {
+        rethrowError();
+    }
 
-        _thenMutex.lock();
-        if (_then) {
-            Application::getInstance()->addTask(new Task(_then, _thenPolicy));
+    // `onError(std::exception_ptr)` is called instead of `callback` if the body threw
+    template<class Callback, class OnError>
+    void setThen(Callback &&callback, OnError &&onError, ContinuationMode mode);
+
+    template<class Callback>
+    void setThen(Callback &&callback, ContinuationMode mode) {
+        setThen(std::forward<Callback>(callback), RethrowError{}, mode);
+    }
+
+    template<class Callback>
+    void setThen(Callback &&callback) {
+        setThen(std::forward<Callback>(callback), RethrowError{}, getThenPolicy().continuation);
+    }
+
+protected:
+    template<class Producer>
+    void produce(Producer &&producer) {
+        try {
+            std::forward<Producer>(producer)();
+        }
+        catch (...) {
+            setError(std::current_exception());
         }
-        _thenMutex.unlock();
     }
 };
 
+// Promise task calling `Callable` with bound arguments. Both are stored in the task, so it is one allocation
+template<class T, class Callable, class... Args>
+class PromiseCallTask final : public PromiseTask<T> {
+    Callable _callback;
+    std::tuple<Args...> _args;
+
+public:
+    template<class C, class... A>
+    PromiseCallTask(const TaskPolicy &taskPolicy, const TaskPolicy &thenPolicy, C &&callback, A&&... args)
+        : PromiseTask<T>{taskPolicy, thenPolicy}, _callback(std::forward<C>(callback)), _args(std::forward<A>(args)...) {}
+
+protected:
+    void run() override {
+        this->produce([this]() -> T {
+            return std::apply(std::move(_callback), std::move(_args));
+        });
+    }
+};
+
+// Promise task finished from outside, e.g. by an I/O completion. It is never queued: whoever gets the result
+// calls `resolve()`, which finishes the task on the calling thread and dispatches the continuation as usual
+template<class T>
+class ResolvableTask final : public PromiseTask<T> {
+public:
+    explicit ResolvableTask(const TaskPolicy &thenPolicy = {}) noexcept
+        : PromiseTask<T>{TaskPolicy{}, thenPolicy} {}
+
+    // The result is in place before the task finishes, nobody reads it until the continuation is dispatched
+    void resolve(T value) {
+        this->produceValue(std::move(value));
+        this->execute();
+    }
+
+protected:
+    // Result is produced by `resolve()`
+    void run() override {}
+};
+
+template<class T, class Callable, class... Args>
+PromiseTask<T> *makePromiseTask(const TaskPolicy &taskPolicy, const TaskPolicy &thenPolicy,
+                                Callable &&callback, Args&&... args) {
+    return new PromiseCallTask<T, std::decay_t<Callable>, std::decay_t<Args>...>(
+        taskPolicy, thenPolicy, std::forward<Callable>(callback), std::forward<Args>(args)...);
+}
+
+template<class T, class Callable, class... Args>
+    requires (!std::is_same_v<std::decay_t<Callable>, TaskPolicy>)
+PromiseTask<T> *makePromiseTask(Callable &&callback, Args&&... args) {
+    return makePromiseTask<T>(TaskPolicy{}, TaskPolicy{}, std::forward<Callable>(callback),
+                              std::forward<Args>(args)...);
+}
+
+// Continuation calling `Callback` with the result of a promise task, or `OnError` with its exception
+template<class T, class Callback, class OnError>
+class ContinuationTask final : public ContinuationTaskBase {
+    Callback _callback;
+    OnError _onError;
+
+public:
+    template<class C, class E>
+    ContinuationTask(C &&callback, E &&onError, const TaskPolicy &policy)
+        : ContinuationTaskBase{policy}, _callback(std::forward<C>(callback)), _onError(std::forward<E>(onError)) {}
+
+protected:
+    void run() override {
+        auto source = static_cast<PromiseTask<T>*>(getSource());
+        if (source->hasError()) {
+            auto error = source->getError();
+            releaseSource();
+            _onError(std::move(error));
+            return;
+        }
+        if constexpr (std::is_void_v<T>) {
+            _callback();
+        }
+        else {
+            _callback(source->take());
+        }
+        releaseSource();
+    }
+};
+
+// Continuation shares the cancellation token of the promise task
+template<class T>
+template<class Callback, class OnError>
+void PromiseTask<T>::setThen(Callback &&callback, OnError &&onError, ContinuationMode mode) {
+    auto policy = getThenPolicy();
+    policy.continuation = mode;
+    TaskRef continuation(new ContinuationTask<T, std::decay_t<Callback>, std::decay_t<OnError>>(
+        std::forward<Callback>(callback), std::forward<OnError>(onError), policy));
+    continuation->setCancellationToken(getCancellationToken());
+    setContinuation(std::move(continuation));
+}
+
+template<class Callback, class OnError>
+void PromiseTask<void>::setThen(Callback &&callback, OnError &&onError, ContinuationMode mode) {
+    auto policy = getThenPolicy();
+    policy.continuation = mode;
+    TaskRef continuation(new ContinuationTask<void, std::decay_t<Callback>, std::decay_t<OnError>>(
+        std::forward<Callback>(callback), std::forward<OnError>(onError), policy));
+    continuation->setCancellationToken(getCancellationToken());
+    setContinuation(std::move(continuation));
+}
+
+// Suspends coroutine until promise task is finished. Coroutine is resumed by the looper which finished the task.
+// `co_await` of a canceled promise throws, as well as of the one whose body threw
+template<class T>
+class PromiseAwaiter : CompletionHook {
+    TaskRef _task;
+    std::coroutine_handle<> _handle;
+
+public:
+    explicit PromiseAwaiter(TaskRef task) noexcept
+        : CompletionHook{&PromiseAwaiter::resume}, _task{std::move(task)} {}
+
+    bool await_ready() const noexcept {
+        return promiseTask()->isReady();
+    }
+
+    // Doesn't suspend if the task finished while the hook was being added
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        _handle = handle;
+        return promiseTask()->addHook(this);
+    }
+
+    T await_resume() const {
+        if (promiseTask()->getState() == TaskState::CANCELED) {
+            throw std::runtime_error("Promise is canceled");
+        }
+        return promiseTask()->take();
+    }
+
+private:
+    PromiseTask<T>* promiseTask() const noexcept {
+        return static_cast<PromiseTask<T>*>(_task.get());
+    }
+
+    static void resume(CompletionHook *hook) {
+        static_cast<PromiseAwaiter*>(hook)->_handle.resume();
+    }
+};
+
+// Handle of a promise task. It is the only consumer of the result, so it is move-only and every way to get
+// the result (`then`, `co_await`, `result()`, `tryGet()`, `whenAll`) takes it
 template<class T>
 class Promise {
-    std::shared_ptr<Task> _task;
+    TaskRef _task;
+
+    struct Deferred {};
+
+    Promise(Deferred, TaskRef task) noexcept
+        : _task{std::move(task)} {}
 
 public:
+    // Wraps PromiseTask<T> without scheduling it. Whoever holds the task has to execute it
+    static Promise deferred(TaskRef task) noexcept {
+        return Promise(Deferred{}, std::move(task));
+    }
+
+    template<class Callable, class... Args>
+        requires (!std::is_same_v<std::decay_t<Callable>, Promise> &&
+                  !std::is_same_v<std::decay_t<Callable>, CancellationToken>)
+    Promise(Callable&& target, Args&&... args)
+        : Promise(CancellationToken{}, std::forward<Callable>(target), std::forward<Args>(args)...) {}
+
+    // Canceling the token cancels the task and its continuation
     template<class Callable, class... Args>
-    Promise(Callable&& target, Args&&... args) {
+    Promise(CancellationToken token, Callable&& target, Args&&... args) {
         auto app = Application::getInstance();
-        _task = std::shared_ptr<Task>(new PromiseTask<T> {
-                                          std::forward<Callable>(target),
-                                          std::forward<Args>(args)...
-                                      });
+        _task = TaskRef(makePromiseTask<T>(std::forward<Callable>(target), std::forward<Args>(args)...));
+        _task->setCancellationToken(std::move(token));
         app->addTask(_task);
     }
 
-    void then(std::function<void(T)> thenCb) noexcept {
-        promise_cast()->setThen(thenCb);
+    Promise(Promise &&) noexcept = default;
+    Promise &operator=(Promise &&) noexcept = default;
+
+    Promise(const Promise &) = delete;
+    Promise &operator=(const Promise &) = delete;
+
+    // `thenCb` gets the result as an rvalue, it can be move-only as well as the callback. It is not called
+    // if the task body throws, the exception is rethrown from the continuation task and reported by its looper
+    template<class Callback>
+    void then(Callback &&thenCb) {
+        promise_cast()->setThen(std::forward<Callback>(thenCb));
+    }
+
+    // Overrides continuation mode of the then policy for this callback
+    template<class Callback>
+    void then(Callback &&thenCb, ContinuationMode mode) {
+        promise_cast()->setThen(std::forward<Callback>(thenCb), mode);
+    }
+
+    // `errorCb(std::exception_ptr)` gets the exception of the task body instead
+    template<class Callback, class ErrorCallback>
+    void then(Callback &&thenCb, ErrorCallback &&errorCb, ContinuationMode mode) {
+        promise_cast()->setThen(std::forward<Callback>(thenCb), std::forward<ErrorCallback>(errorCb), mode);
+    }
+
+    template<class Callback, class ErrorCallback>
+        requires (!std::is_same_v<std::decay_t<ErrorCallback>, ContinuationMode>)
+    void then(Callback &&thenCb, ErrorCallback &&errorCb) {
+        promise_cast()->setThen(std::forward<Callback>(thenCb), std::forward<ErrorCallback>(errorCb),
+                                promise_cast()->getThenPolicy().continuation);
     }
 
     bool isReady() const noexcept {
         return promise_cast()->isReady();
     }
 
-    T result() const {
-        while (!promise_cast()->isReady())
+    bool isCanceled() const noexcept {
+        return _task->isCanceled();
+    }
+
+    // Cancels the task unless it is finished already, see `Task::cancel()`
+    bool cancel() {
+        return _task->cancel();
+    }
+
+    // Blocks until the task is finished. Throws if it is canceled, rethrows the exception of the task body
+    T result() {
+        while (!promise_cast()->isReady()) {
+            if (_task->getState() == TaskState::CANCELED) {
+                throw std::runtime_error("Promise is canceled");
+            }
             std::this_thread::yield();
-        return promise_cast()->get();
+        }
+        return promise_cast()->take();
     }
 
-    std::optional<T> tryGet() const noexcept {
+    std::optional<T> tryGet() {
         if (promise_cast()->isReady())
-            return { promise_cast()->get() };
+            return { promise_cast()->take() };
         return std::nullopt;
     }
 
+    // `co_await promise` suspends the coroutine without blocking a looper
+    PromiseAwaiter<T> operator co_await() const noexcept {
+        return PromiseAwaiter<T>(_task);
+    }
+
+    // Underlying PromiseTask<T>
+    const TaskRef &getTask() const noexcept {
+        return _task;
+    }
+
 private:
     PromiseTask<T>* promise_cast() const noexcept {
         return static_cast<PromiseTask<T>*>(_task.get());
@@ -180,31 +548,114 @@ private:
 
 template<>
 class Promise<void> {
-    std::shared_ptr<Task> _task;
+    TaskRef _task;
+
+    struct Deferred {};
+
+    Promise(Deferred, TaskRef task) noexcept
+        : _task{std::move(task)} {}
 
 public:
+    // Wraps PromiseTask<void> without scheduling it. Whoever holds the task has to execute it
+    static Promise deferred(TaskRef task) noexcept {
+        return Promise(Deferred{}, std::move(task));
+    }
+
     template<class Callable, class... Args>
-    Promise(Callable&& target, Args&&... args) {
+        requires (!std::is_same_v<std::decay_t<Callable>, Promise> &&
+                  !std::is_same_v<std::decay_t<Callable>, CancellationToken>)
+    Promise(Callable&& target, Args&&... args)
+        : Promise(CancellationToken{}, std::forward<Callable>(target), std::forward<Args>(args)...) {}
+
+    template<class Callable, class... Args>
+    Promise(CancellationToken token, Callable&& target, Args&&... args) {
         auto app = Application::getInstance();
-        _task = std::shared_ptr<Task>(new PromiseTask<void> {
-                                          std::forward<Callable>(target),
-                                          std::forward<Args>(args)...
-                                      });
+        _task = TaskRef(makePromiseTask<void>(std::forward<Callable>(target), std::forward<Args>(args)...));
+        _task->setCancellationToken(std::move(token));
         app->addTask(_task);
     }
 
-    void then(std::function<void()> thenCb) noexcept {
-        promise_cast()->setThen(thenCb);
+    Promise(Promise &&) noexcept = default;
+    Promise &operator=(Promise &&) noexcept = default;
+
+    Promise(const Promise &) = delete;
+    Promise &operator=(const Promise &) = delete;
+
+    template<class Callback>
+    void then(Callback &&thenCb) {
+        promise_cast()->setThen(std::forward<Callback>(thenCb));
+    }
+
+    template<class Callback>
+    void then(Callback &&thenCb, ContinuationMode mode) {
+        promise_cast()->setThen(std::forward<Callback>(thenCb), mode);
+    }
+
+    template<class Callback, class ErrorCallback>
+    void then(Callback &&thenCb, ErrorCallback &&errorCb, ContinuationMode mode) {
+        promise_cast()->setThen(std::forward<Callback>(thenCb), std::forward<ErrorCallback>(errorCb), mode);
+    }
+
+    template<class Callback, class ErrorCallback>
+        requires (!std::is_same_v<std::decay_t<ErrorCallback>, ContinuationMode>)
+    void then(Callback &&thenCb, ErrorCallback &&errorCb) {
+        promise_cast()->setThen(std::forward<Callback>(thenCb), std::forward<ErrorCallback>(errorCb),
+                                promise_cast()->getThenPolicy().continuation);
     }
 
     bool isReady() const noexcept {
         return promise_cast()->isReady();
     }
 
+    bool isCanceled() const noexcept {
+        return _task->isCanceled();
+    }
+
+    bool cancel() {
+        return _task->cancel();
+    }
+
+    // Blocks until the task is finished. Throws if it is canceled, rethrows the exception of the task body
+    void result() {
+        while (!promise_cast()->isReady()) {
+            if (_task->getState() == TaskState::CANCELED) {
+                throw std::runtime_error("Promise is canceled");
+            }
+            std::this_thread::yield();
+        }
+        promise_cast()->take();
+    }
+
+    PromiseAwaiter<void> operator co_await() const noexcept {
+        return PromiseAwaiter<void>(_task);
+    }
+
+    const TaskRef &getTask() const noexcept {
+        return _task;
+    }
+
 private:
     PromiseTask<void>* promise_cast() const noexcept {
         return static_cast<PromiseTask<void>*>(_task.get());
     }
 };
 
+// Runs `target` on `domain`, its `then` callback runs on `thenDomain`. E.g. a blocking call goes to the blocking
+// domain and its result is handled back on the main one
+template<class Callable, class... Args>
+auto runOnDomain(DomainId domain, DomainId thenDomain, Callable&& target, Args&&... args) {
+    using T = std::invoke_result_t<std::decay_t<Callable>, std::decay_t<Args>...>;
+    TaskRef task(makePromiseTask<T>(TaskPolicy{domain}, TaskPolicy{thenDomain}, std::forward<Callable>(target),
+                                    std::forward<Args>(args)...));
+    Application::getInstance()->addTask(task);
+    return Promise<T>::deferred(std::move(task));
+}
+
+// Continuation comes back to the main domain
+template<class Callable, class... Args>
+    requires (!std::is_same_v<std::decay_t<Callable>, DomainId>)
+auto runOnDomain(DomainId domain, Callable&& target, Args&&... args) {
+    return runOnDomain(domain, DomainId::MAIN, std::forward<Callable>(target), std::forward<Args>(args)...);
+}
+
 #endif // PROMISE_H
@@ -0,0 +1,172 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+
+#include "reactor.h"
+
+namespace {
+
+// epoll_pwait2 takes nanoseconds, epoll_wait only milliseconds. Older kernels lack the former
+std::atomic_bool hasPwait2{true};
+
+int epollWait(int epoll, epoll_event *events, int count, std::chrono::nanoseconds timeout) noexcept {
+#ifdef SYS_epoll_pwait2
+    if (hasPwait2.load(std::memory_order_relaxed)) {
+        timespec ts;
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        ts.tv_sec = static_cast<time_t>(seconds.count());
+        ts.tv_nsec = static_cast<long>((timeout - seconds).count());
+        auto result = static_cast<int>(syscall(SYS_epoll_pwait2, epoll, events, count,
+                                               timeout.count() < 0 ? nullptr : &ts, nullptr, 0));
+        if (result >= 0 || errno != ENOSYS) {
+            return result;
+        }
+        hasPwait2.store(false, std::memory_order_relaxed);
+    }
+#endif
+    // Rounded up, so a timer is not missed by a few microseconds
+    int ms = -1;
+    if (timeout.count() >= 0) {
+        ms = static_cast<int>((timeout.count() + 999999) / 1000000);
+    }
+    return epoll_wait(epoll, events, count, ms);
+}
+
+}
+
+Reactor::Reactor() {
+    _epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (_epoll < 0) {
+        throw std::runtime_error(std::string("Can't create epoll: ") + std::strerror(errno));
+    }
+
+    _event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_event < 0) {
+        close(_epoll);
+        throw std::runtime_error(std::string("Can't create eventfd: ") + std::strerror(errno));
+    }
+
+    // Level-triggered: a wake up written while the looper was busy is seen by the next wait
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, _event, &event) != 0) {
+        close(_event);
+        close(_epoll);
+        throw std::runtime_error(std::string("Can't watch eventfd: ") + std::strerror(errno));
+    }
+}
+
+Reactor::~Reactor() {
+    close(_event);
+    close(_epoll);
+}
+
+void Reactor::add(int fd, uint32_t events, IoWatch *watch) {
+    epoll_event event{};
+    event.events = events | EPOLLET;
+    event.data.ptr = watch;
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+        throw std::runtime_error(std::string("Can't watch descriptor: ") + std::strerror(errno));
+    }
+    ++_watchCount;
+}
+
+void Reactor::remove(int fd, IoWatch *watch) noexcept {
+    if (epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr) == 0) {
+        --_watchCount;
+    }
+
+    // Watch may be freed right after
+    for (int i = 0; i < _readyCount; ++i) {
+        if (_readyWatches[i] == watch) {
+            _readyWatches[i] = nullptr;
+        }
+    }
+}
+
+size_t Reactor::size() const noexcept {
+    return _watchCount;
+}
+
+bool Reactor::hasReady() const noexcept {
+    return _readyCount != 0;
+}
+
+void Reactor::wait() noexcept {
+    // Consume pending notification or become PARKED
+    if (_state.fetch_sub(1, std::memory_order_acquire) == NOTIFIED) {
+        poll();
+        return;
+    }
+
+    collect(std::chrono::nanoseconds(-1));
+    _state.exchange(EMPTY, std::memory_order_acquire);
+}
+
+bool Reactor::wait(std::chrono::nanoseconds timeout) noexcept {
+    if (_state.fetch_sub(1, std::memory_order_acquire) == NOTIFIED) {
+        poll();
+        return true;
+    }
+
+    collect(std::max(timeout, std::chrono::nanoseconds::zero()));
+    return _state.exchange(EMPTY, std::memory_order_acquire) == NOTIFIED;
+}
+
+void Reactor::poll() noexcept {
+    if (_watchCount != 0) {
+        collect(std::chrono::nanoseconds::zero());
+    }
+}
+
+size_t Reactor::dispatch() {
+    size_t count = 0;
+
+    // Watch can register or remove descriptors, the buffer is taken first
+    while (_readyCount != 0) {
+        auto index = --_readyCount;
+        if (auto watch = _readyWatches[index]) {
+            watch->ready(watch, _readyEvents[index]);
+            ++count;
+        }
+    }
+    return count;
+}
+
+bool Reactor::wake() noexcept {
+    if (_state.exchange(NOTIFIED, std::memory_order_release) == PARKED) {
+        uint64_t one = 1;
+        [[maybe_unused]] auto written = write(_event, &one, sizeof(one));
+        return true;
+    }
+    return false;
+}
+
+void Reactor::collect(std::chrono::nanoseconds timeout) noexcept {
+    if (_readyCount != 0) {
+        return;
+    }
+
+    epoll_event events[MAX_EVENTS];
+    auto count = epollWait(_epoll, events, MAX_EVENTS, timeout);
+    for (int i = 0; i < count; ++i) {
+        auto watch = static_cast<IoWatch*>(events[i].data.ptr);
+        if (watch == nullptr) {
+            uint64_t value;
+            [[maybe_unused]] auto read = ::read(_event, &value, sizeof(value));
+            continue;
+        }
+        _readyWatches[_readyCount] = watch;
+        _readyEvents[_readyCount] = events[i].events;
+        ++_readyCount;
+    }
+}
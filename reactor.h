@@ -0,0 +1,92 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Outcome of an I/O operation
+struct IoResult {
+    // Bytes transferred, 0 at end of stream
+    ssize_t value{0};
+
+    // errno of the failed operation, 0 on success
+    int error{0};
+
+    explicit operator bool() const noexcept {
+        return error == 0;
+    }
+};
+
+// Object waiting for readiness of a descriptor. Reactor calls it on the looper thread with epoll events.
+// Intrusive, so the owner keeps it alive while the descriptor is registered
+struct IoWatch {
+    void (*ready)(IoWatch *watch, uint32_t events);
+};
+
+// epoll instance of a looper. Looper sleeps in `wait()` instead of Parker, so ready descriptors wake it up
+// as well as new tasks: `wake()` writes to an eventfd. Same as Parker, `wake()` before `wait()` is not lost.
+// Descriptors are registered edge-triggered: a watch tries its operation first and waits for the next edge
+// only when the operation would block
+class Reactor {
+    static constexpr int32_t EMPTY = 0;
+    static constexpr int32_t NOTIFIED = 1;
+    static constexpr int32_t PARKED = -1;
+
+    static constexpr int MAX_EVENTS = 64;
+
+    int _epoll{-1};
+    int _event{-1};
+    std::atomic<int32_t> _state{EMPTY};
+
+    // Registered descriptors and events waiting for `dispatch()`, touched only from the looper thread
+    size_t _watchCount{0};
+    uint32_t _readyEvents[MAX_EVENTS];
+    IoWatch *_readyWatches[MAX_EVENTS];
+    int _readyCount{0};
+
+public:
+    // Throws std::runtime_error if epoll or eventfd can't be created
+    Reactor();
+
+    ~Reactor();
+
+    Reactor(const Reactor &) = delete;
+    Reactor &operator=(const Reactor &) = delete;
+
+    // Watches `events` of `fd`. Throws std::runtime_error if the kernel refuses
+    void add(int fd, uint32_t events, IoWatch *watch);
+
+    // Stops watching `fd`, ready events not dispatched yet are dropped
+    void remove(int fd, IoWatch *watch) noexcept;
+
+    // Number of registered descriptors
+    size_t size() const noexcept;
+
+    // Are there ready events to dispatch
+    bool hasReady() const noexcept;
+
+    // Blocks until `wake()` or a ready descriptor. Can return spuriously
+    void wait() noexcept;
+
+    // Same as `wait()`, but gives up after timeout. Returns true if was woken up
+    bool wait(std::chrono::nanoseconds timeout) noexcept;
+
+    // Collects ready descriptors without blocking
+    void poll() noexcept;
+
+    // Calls watches of collected descriptors. Returns their number
+    size_t dispatch();
+
+    // Wakes owner thread. Returns true if the thread was actually sleeping. Can be called from any thread
+    bool wake() noexcept;
+
+private:
+    // Waits for events, negative timeout means forever
+    void collect(std::chrono::nanoseconds timeout) noexcept;
+};
+
+#endif // REACTOR_H
@@ -1,18 +1,31 @@
 #include "task.h"
+#include "taskallocator.h"
+#include "threadpool.h"
 #include <iostream>
 
 std::atomic_size_t Task::_idCounter{1};
+std::atomic_uint64_t Task::_cancelCount{0};
+
+namespace {
+
+// Number of ids a thread takes from the global counter at once
+constexpr size_t ID_BLOCK = 1024;
+
+thread_local size_t localNextId = 0;
+thread_local size_t localLastId = 0;
+
+}
 
 Task::Task() noexcept
-    : _id{_idCounter++}, _policy{}, _executor{nullptr}, _state{TaskState::PENDING} {
+    : _id{nextId()}, _policy{}, _executor{nullptr}, _state{TaskState::PENDING} {
 }
 
 Task::Task(Task::Executor executor) noexcept
-    : _id{_idCounter++}, _policy{}, _executor{executor} {
+    : _id{nextId()}, _policy{}, _executor{executor}, _state{TaskState::PENDING} {
 }
 
 Task::Task(Executor executor, TaskPolicy policy) noexcept
-    : _id{_idCounter++}, _policy{policy}, _executor{executor}, _state{TaskState::PENDING} {
+    : _id{nextId()}, _policy{policy}, _executor{executor}, _state{TaskState::PENDING} {
 }
 
 TaskPolicy Task::getPolicy() const noexcept {
@@ -35,19 +48,195 @@ size_t Task::getId() const noexcept {
     return _id;
 }
 
+TaskClock::time_point Task::getEnqueueTime() const noexcept {
+    return _enqueueTime;
+}
+
+void Task::setEnqueueTime(TaskClock::time_point time) noexcept {
+    _enqueueTime = time;
+}
+
+TaskClock::time_point Task::getDueTime() const noexcept {
+    return _dueTime;
+}
+
+void Task::setDueTime(TaskClock::time_point time) noexcept {
+    _dueTime = time;
+}
+
+TaskClock::duration Task::getPeriod() const noexcept {
+    return _period;
+}
+
+void Task::setPeriod(TaskClock::duration period) noexcept {
+    _period = period;
+}
+
+bool Task::isPeriodic() const noexcept {
+    return _period > TaskClock::duration::zero();
+}
+
+uint64_t Task::getCancelCount() noexcept {
+    return _cancelCount.load(std::memory_order_relaxed);
+}
+
+const CancellationToken &Task::getCancellationToken() const noexcept {
+    return _token;
+}
+
+void Task::setCancellationToken(CancellationToken token) noexcept {
+    _token = std::move(token);
+}
+
+bool Task::isCanceled() const noexcept {
+    return _state == TaskState::CANCELED || _token.isCanceled();
+}
+
+bool Task::makePending() noexcept {
+    auto state = _state.load();
+    do {
+        if (state == TaskState::CANCELED || _token.isCanceled()) {
+            return false;
+        }
+    } while (!_state.compare_exchange_weak(state, TaskState::PENDING));
+    return true;
+}
+
+bool Task::cancel() {
+    auto state = _state.load();
+    do {
+        // Periodic task is FINISHED only until the looper rearms it
+        auto isDone = state == TaskState::CANCELED || (state == TaskState::FINISHED && !isPeriodic());
+        if (isDone) {
+            return false;
+        }
+    } while (!_state.compare_exchange_weak(state, TaskState::CANCELED));
+
+    _cancelCount.fetch_add(1, std::memory_order_relaxed);
+    // Task may wait in a queue of its pool
+    if (state == TaskState::PENDING) {
+        requestPurge(_policy.domain);
+    }
+    onCanceled();
+    return true;
+}
+
 void Task::execute() {
-    _state = TaskState::EXECUTING;
+    if (_token.isCanceled()) {
+        cancel();
+        return;
+    }
+
+    // Task canceled meanwhile is not started, and not finished if canceled while running
+    auto expected = TaskState::PENDING;
+    if (!_state.compare_exchange_strong(expected, TaskState::EXECUTING)) {
+        return;
+    }
+    run();
+    expected = TaskState::EXECUTING;
+    if (_state.compare_exchange_strong(expected, TaskState::FINISHED)) {
+        onFinished();
+    }
+}
+
+void Task::run() {
     if(_executor)
         _executor();
-    _state = TaskState::FINISHED;
 }
 
 void Task::operator()() {
     execute();
 }
 
-TaskWatcher::TaskWatcher(const std::shared_ptr<Task> task) noexcept
-    : _task{task}
+void *Task::operator new(size_t size) {
+    return TaskAllocator::allocate(size);
+}
+
+void Task::operator delete(void *ptr) noexcept {
+    TaskAllocator::deallocate(ptr);
+}
+
+void *Task::operator new(size_t size, std::align_val_t align) {
+    return ::operator new(size, align);
+}
+
+void Task::operator delete(void *ptr, std::align_val_t align) noexcept {
+    ::operator delete(ptr, align);
+}
+
+size_t Task::nextId() noexcept {
+    if (localNextId == localLastId) {
+        localNextId = _idCounter.fetch_add(ID_BLOCK, std::memory_order_relaxed);
+        localLastId = localNextId + ID_BLOCK;
+    }
+    return localNextId++;
+}
+
+void Task::addRef() const noexcept {
+    _refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Task::release() const noexcept {
+    if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+    }
+}
+
+TaskRef::TaskRef(Task *task) noexcept
+    : _task{task} {
+    if (_task)
+        _task->addRef();
+}
+
+TaskRef::TaskRef(const TaskRef &other) noexcept
+    : _task{other._task} {
+    if (_task)
+        _task->addRef();
+}
+
+TaskRef::TaskRef(TaskRef &&other) noexcept
+    : _task{other._task} {
+    other._task = nullptr;
+}
+
+TaskRef::~TaskRef() {
+    if (_task)
+        _task->release();
+}
+
+TaskRef &TaskRef::operator=(const TaskRef &other) noexcept {
+    if (other._task)
+        other._task->addRef();
+    if (_task)
+        _task->release();
+    _task = other._task;
+    return *this;
+}
+
+TaskRef &TaskRef::operator=(TaskRef &&other) noexcept {
+    if (this != &other) {
+        if (_task)
+            _task->release();
+        _task = other._task;
+        other._task = nullptr;
+    }
+    return *this;
+}
+
+Task *TaskRef::detach() noexcept {
+    auto task = _task;
+    _task = nullptr;
+    return task;
+}
+
+TaskRef TaskRef::adopt(Task *task) noexcept {
+    TaskRef ref;
+    ref._task = task;
+    return ref;
+}
+
+TaskWatcher::TaskWatcher(TaskRef task) noexcept
+    : _task{std::move(task)}
 {}
 
 auto TaskWatcher::getState() const noexcept {
@@ -67,6 +256,6 @@ bool TaskWatcher::isFinished() const noexcept {
     return state == TaskState::FINISHED || state == TaskState::CANCELED;
 }
 
-void TaskWatcher::cancel() noexcept {
-    _task->setState(TaskState::CANCELED);
+void TaskWatcher::cancel() {
+    _task->cancel();
 }
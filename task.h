@@ -2,8 +2,15 @@
 #define TASK_H
 
 #include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <new>
+#include <optional>
+
+#include "cancellation.h"
 
 enum class TaskBindingPolicy {
     // Can be executed in any thread (looper)
@@ -18,21 +25,81 @@ enum class TaskBindingPolicy {
 
 enum class TaskState { PENDING, EXECUTING, FINISHED, CANCELED };
 
+// Urgency class of a task. Loopers always take the most urgent class first
+enum class TaskPriority {
+    LOW,
+    NORMAL,
+    HIGH,
+    CRITICAL
+};
+
+constexpr size_t TASK_PRIORITY_COUNT = 4;
+
+using TaskClock = std::chrono::steady_clock;
+
+// Executor of Application a task runs on, see Application::addDomain. Every domain is a thread pool of its own
+enum class DomainId : uint8_t {
+    MAIN = 0
+};
+
+constexpr size_t MAX_DOMAINS = 16;
+
+// How a continuation (`Promise::then` callback) is run after the promise task is finished
+enum class ContinuationMode {
+    // Separate task through the thread pool queues
+    QUEUED,
+
+    // Right away in the thread which finished the promise task. For cheap callbacks only
+    INLINE,
+
+    // Separate task run next by the looper which finished the promise task, while its data is still in cache
+    SAME_LOOPER
+};
+
 struct TaskPolicy {
     TaskBindingPolicy policy;
     int boundLooper;
+    TaskPriority priority;
+
+    // Within one priority class tasks with deadline go first, earliest deadline first
+    std::optional<TaskClock::time_point> deadline;
+
+    // Used by promises for their `then` callbacks
+    ContinuationMode continuation {ContinuationMode::QUEUED};
+
+    // Thread pool the task is passed to. Bound looper indices are counted within the domain
+    DomainId domain {DomainId::MAIN};
 
     TaskPolicy()
-        : policy {TaskBindingPolicy::UNBOUND}, boundLooper {-1}
+        : policy {TaskBindingPolicy::UNBOUND}, boundLooper {-1}, priority {TaskPriority::NORMAL}
+    {}
+
+    TaskPolicy (TaskBindingPolicy binding)
+        : policy {binding}, boundLooper {-1}, priority {TaskPriority::NORMAL}
     {}
 
-    TaskPolicy (TaskBindingPolicy policy)
-        : policy {policy}, boundLooper {-1}
+    TaskPolicy (TaskBindingPolicy binding, int looper)
+        : policy {binding}, boundLooper {looper}, priority {TaskPriority::NORMAL}
     {}
 
-    TaskPolicy (TaskBindingPolicy policy, int looper)
-        : policy {policy}, boundLooper {looper}
+    TaskPolicy (TaskPriority urgency, std::optional<TaskClock::time_point> dueBy = std::nullopt)
+        : policy {TaskBindingPolicy::UNBOUND}, boundLooper {-1}, priority {urgency}, deadline {dueBy}
     {}
+
+    TaskPolicy (DomainId pool, TaskPriority urgency = TaskPriority::NORMAL)
+        : policy {TaskBindingPolicy::UNBOUND}, boundLooper {-1}, priority {urgency}, domain {pool}
+    {}
+
+    TaskPolicy (TaskBindingPolicy binding, int looper, TaskPriority urgency,
+                std::optional<TaskClock::time_point> dueBy = std::nullopt)
+        : policy {binding}, boundLooper {looper}, priority {urgency}, deadline {dueBy}
+    {}
+
+    // Should the task bypass looper-local work-stealing deques, which know nothing about priorities. Low
+    // priority tasks bypass them too, a deque is served before the global queue with normal ones
+    bool isPrioritized() const noexcept {
+        return priority != TaskPriority::NORMAL || deadline.has_value();
+    }
 };
 
 class Task {
@@ -45,8 +112,32 @@ private:
     const Executor _executor;
     std::atomic<TaskState> _state;
 
-    // Provides unique task id
+    // When the task was passed to a thread pool, used for queue wait statistics
+    TaskClock::time_point _enqueueTime;
+
+    // When a delayed task has to be passed to the thread pool
+    TaskClock::time_point _dueTime;
+
+    // Interval of periodic task, zero for one-shot tasks
+    TaskClock::duration _period{TaskClock::duration::zero()};
+
+    // Intrusive link of TimerWheel lists
+    Task *_timerNext{nullptr};
+
+    // Intrusive reference counter, see TaskRef
+    mutable std::atomic_uint32_t _refs{0};
+
+    // Group cancellation, the task is dropped once the token is canceled
+    CancellationToken _token;
+
+    // Provides unique task id. Threads take ids from it in blocks, see `nextId()`
     static std::atomic_size_t _idCounter;
+
+    // Number of tasks canceled by `cancel()`, see PurgeTrigger
+    static std::atomic_uint64_t _cancelCount;
+
+    friend class TaskRef;
+    friend class TimerWheel;
 public:
     Task() noexcept;
 
@@ -67,19 +158,114 @@ public:
 
     size_t getId() const noexcept;
 
+    TaskClock::time_point getEnqueueTime() const noexcept;
+    void setEnqueueTime(TaskClock::time_point time) noexcept;
+
+    TaskClock::time_point getDueTime() const noexcept;
+    void setDueTime(TaskClock::time_point time) noexcept;
+
+    TaskClock::duration getPeriod() const noexcept;
+    void setPeriod(TaskClock::duration period) noexcept;
+
+    bool isPeriodic() const noexcept;
+
+    static uint64_t getCancelCount() noexcept;
+
+    // Token has to be set before the task is passed to a thread pool
+    const CancellationToken &getCancellationToken() const noexcept;
+    void setCancellationToken(CancellationToken token) noexcept;
+
+    // Is the task canceled itself or through its token. Canceled tasks are dropped by queues and loopers
+    bool isCanceled() const noexcept;
+
+    // Makes the task PENDING before it is queued. Fails if it is canceled, a concurrent cancel() is never undone
+    bool makePending() noexcept;
+
+    // Makes pending or running task CANCELED and cancels whatever depends on it, e.g. promise continuations.
+    // Running task is not interrupted, but it won't be FINISHED. A periodic task is canceled between its runs
+    // too, so it is not rearmed. Returns false if the task is done already
+    bool cancel();
+
+    // Runs PENDING task. Task canceled through its token is canceled instead
     void execute();
 
     void operator()();
+
+    // Tasks live in per-thread slabs of TaskAllocator
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr) noexcept;
+
+    // Over-aligned tasks bypass the slabs
+    static void *operator new(size_t size, std::align_val_t align);
+    static void operator delete(void *ptr, std::align_val_t align) noexcept;
+
+protected:
+    // Body of the task, calls the executor. Subclasses keeping their callable inline override it instead
+    virtual void run();
+
+    // Called by `execute()` after the task became FINISHED, in the same thread
+    virtual void onFinished() {}
+
+    // Called by `cancel()` once the task became CANCELED, in the canceling thread
+    virtual void onCanceled() {}
+
+private:
+    // Ids are unique, but not ordered between threads
+    static size_t nextId() noexcept;
+
+    void addRef() const noexcept;
+    void release() const noexcept;
+};
+
+// Intrusive owning pointer to a task. Task is deleted when the last TaskRef is gone
+class TaskRef {
+    Task *_task{nullptr};
+
+public:
+    TaskRef() noexcept = default;
+
+    TaskRef(std::nullptr_t) noexcept {}
+
+    // Takes shared ownership of the task
+    explicit TaskRef(Task *task) noexcept;
+
+    TaskRef(const TaskRef &other) noexcept;
+
+    TaskRef(TaskRef &&other) noexcept;
+
+    ~TaskRef();
+
+    TaskRef &operator=(const TaskRef &other) noexcept;
+
+    TaskRef &operator=(TaskRef &&other) noexcept;
+
+    Task *get() const noexcept { return _task; }
+
+    Task *operator->() const noexcept { return _task; }
+
+    Task &operator*() const noexcept { return *_task; }
+
+    explicit operator bool() const noexcept { return _task != nullptr; }
+
+    bool operator==(const TaskRef &other) const noexcept { return _task == other._task; }
+
+    bool operator!=(const TaskRef &other) const noexcept { return _task != other._task; }
+
+    // Gives up the reference without releasing it. Used to keep tasks in lock-free structures as raw pointers
+    Task *detach() noexcept;
+
+    // Takes over a reference previously given up by `detach()`
+    static TaskRef adopt(Task *task) noexcept;
 };
 
 
 // Safe wrapper above the task
 class TaskWatcher {
 private:
-    const std::shared_ptr<Task> _task;
+    const TaskRef _task;
 
 public:
-    TaskWatcher(const std::shared_ptr<Task> task) noexcept;
+    TaskWatcher(TaskRef task) noexcept;
 
     auto getState() const noexcept;
 
@@ -89,7 +275,7 @@ public:
 
     bool isFinished() const noexcept;
 
-    void cancel() noexcept;
+    void cancel();
 };
 
 #endif // TASK_H
@@ -0,0 +1,149 @@
+#include <new>
+
+#include "taskallocator.h"
+
+namespace {
+
+// Precedes every block, keeps the payload aligned to max_align_t
+struct alignas(alignof(std::max_align_t)) BlockHeader {
+    TaskAllocator *owner;
+    size_t sizeClass;
+};
+
+constexpr size_t HEADER_SIZE = sizeof(BlockHeader);
+
+// Plain pointer has no destructor, so it is safe to read during thread teardown
+thread_local TaskAllocator *localAllocator = nullptr;
+thread_local bool localAllocatorDead = false;
+
+struct LocalAllocatorGuard {
+    ~LocalAllocatorGuard() {
+        localAllocatorDead = true;
+        if (localAllocator) {
+            auto allocator = localAllocator;
+            localAllocator = nullptr;
+            allocator->orphan();
+        }
+    }
+};
+
+thread_local LocalAllocatorGuard localAllocatorGuard;
+
+// Size of blocks in the class, header included
+constexpr size_t blockSize(size_t sizeClass) noexcept {
+    return size_t{64} << sizeClass;
+}
+
+}
+
+TaskAllocator::~TaskAllocator() {
+    for (auto slab : _slabs) {
+        ::operator delete(slab);
+    }
+}
+
+void *TaskAllocator::allocate(size_t size) {
+    auto allocator = local();
+    size_t total = size + HEADER_SIZE;
+
+    if (allocator) {
+        for (size_t sizeClass = 0; sizeClass < CLASS_COUNT; ++sizeClass) {
+            if (total <= blockSize(sizeClass)) {
+                return allocator->allocateBlock(sizeClass);
+            }
+        }
+    }
+
+    // Big block or no allocator at all, use global heap
+    auto header = static_cast<BlockHeader*>(::operator new(total));
+    header->owner = nullptr;
+    header->sizeClass = CLASS_COUNT;
+    return header + 1;
+}
+
+void TaskAllocator::deallocate(void *ptr) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+
+    auto header = static_cast<BlockHeader*>(ptr) - 1;
+    auto owner = header->owner;
+    if (owner == nullptr) {
+        ::operator delete(header);
+        return;
+    }
+
+    if (owner == localAllocator) {
+        auto block = reinterpret_cast<FreeBlock*>(ptr);
+        block->next = owner->_free[header->sizeClass];
+        owner->_free[header->sizeClass] = block;
+        ++owner->_freed;
+    }
+    else {
+        owner->freeRemote(ptr, header->sizeClass);
+    }
+}
+
+TaskAllocator *TaskAllocator::local() noexcept {
+    if (localAllocator == nullptr && !localAllocatorDead) {
+        // Touch the guard, so it is constructed and destroyed with the thread
+        (void)&localAllocatorGuard;
+        localAllocator = new (std::nothrow) TaskAllocator();
+    }
+    return localAllocator;
+}
+
+void TaskAllocator::orphan() noexcept {
+    // From now on only remote frees are possible. Once the counter gets back to zero, nothing is alive
+    auto outstanding = _allocated - _freed;
+    if (_pending.fetch_add(outstanding, std::memory_order_acq_rel) + outstanding == 0) {
+        delete this;
+    }
+}
+
+void *TaskAllocator::allocateBlock(size_t sizeClass) {
+    if (_free[sizeClass] == nullptr) {
+        // Take everything other threads have returned, then fall back to a new slab
+        _free[sizeClass] = _remote[sizeClass].exchange(nullptr, std::memory_order_acquire);
+        if (_free[sizeClass] == nullptr) {
+            refill(sizeClass);
+        }
+    }
+
+    auto block = _free[sizeClass];
+    _free[sizeClass] = block->next;
+    ++_allocated;
+
+    auto header = reinterpret_cast<BlockHeader*>(block) - 1;
+    header->owner = this;
+    header->sizeClass = sizeClass;
+    return block;
+}
+
+void TaskAllocator::freeRemote(void *ptr, size_t sizeClass) noexcept {
+    auto block = static_cast<FreeBlock*>(ptr);
+    auto head = _remote[sizeClass].load(std::memory_order_relaxed);
+    do {
+        block->next = head;
+    } while (!_remote[sizeClass].compare_exchange_weak(head, block, std::memory_order_release,
+                                                      std::memory_order_relaxed));
+
+    // Owner is gone and this was its last block
+    if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+    }
+}
+
+void TaskAllocator::refill(size_t sizeClass) {
+    auto slab = static_cast<char*>(::operator new(SLAB_SIZE));
+    _slabs.push_back(slab);
+
+    auto size = blockSize(sizeClass);
+    FreeBlock *head = nullptr;
+    for (size_t offset = SLAB_SIZE; offset >= size; offset -= size) {
+        auto block = reinterpret_cast<FreeBlock*>(slab + offset - size + HEADER_SIZE);
+        block->next = head;
+        head = block;
+    }
+    _free[sizeClass] = head;
+}
@@ -0,0 +1,64 @@
+#ifndef TASKALLOCATOR_H
+#define TASKALLOCATOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Per-thread slab allocator for tasks and other small scheduler objects.
+// Every thread (so every looper) owns its allocator. Blocks freed by the owner go to its local free list,
+// blocks freed by other threads are pushed to the owner's lock-free remote list and reused by the owner later.
+// Requests that don't fit the biggest size class go to the global heap
+class TaskAllocator {
+    // Block sizes are 64, 128, ..., 1024 bytes including header
+    static constexpr size_t CLASS_COUNT = 5;
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    // Local free lists, touched only by owner thread
+    FreeBlock *_free[CLASS_COUNT] {};
+
+    // Blocks freed by other threads
+    alignas(64) std::atomic<FreeBlock*> _remote[CLASS_COUNT] {};
+
+    // Remote frees minus blocks the owner has handed out and not freed itself, see `orphan()`
+    alignas(64) std::atomic<int64_t> _pending{0};
+
+    // Owner-only statistics of handed out blocks
+    int64_t _allocated{0};
+    int64_t _freed{0};
+
+    std::vector<void*> _slabs;
+
+    TaskAllocator() = default;
+    ~TaskAllocator();
+
+public:
+    TaskAllocator(const TaskAllocator &) = delete;
+    TaskAllocator &operator=(const TaskAllocator &) = delete;
+
+    // Allocates memory in allocator of current thread, aligned to max_align_t
+    static void *allocate(size_t size);
+
+    // Returns memory to the allocator which owns it. Can be called from any thread
+    static void deallocate(void *ptr) noexcept;
+
+    // Allocator of current thread. nullptr while thread is being destroyed
+    static TaskAllocator *local() noexcept;
+
+    // Called when owner thread exits. Allocator is deleted when its last block is freed
+    void orphan() noexcept;
+
+private:
+    void *allocateBlock(size_t sizeClass);
+
+    void freeRemote(void *block, size_t sizeClass) noexcept;
+
+    void refill(size_t sizeClass);
+};
+
+#endif // TASKALLOCATOR_H
@@ -1,37 +1,70 @@
+#include <algorithm>
+
 #include "taskqueue.h"
+#include "lockfreetaskqueue.h"
+
+TaskQueueBase::~TaskQueueBase() {
+}
+
+std::unique_ptr<TaskQueueBase> makeTaskQueue(QueueType type, size_t capacity) {
+    switch (type) {
+        case QueueType::LOCK_FREE:
+            return std::unique_ptr<TaskQueueBase>(new LockFreeTaskQueue(capacity));
+        case QueueType::MUTEX:
+        default:
+            return std::unique_ptr<TaskQueueBase>(new TaskQueue());
+    }
+}
 
-void TaskQueue::push(const std::shared_ptr<Task> &task) {
+void TaskQueue::push(TaskRef task) {
     std::lock_guard<std::mutex> lock(_mutex);
-    _queue.push_back(task);
+    _queue.push_back(std::move(task));
     ++_size;
 }
 
+void TaskQueue::pushBatch(const TaskRef *tasks, size_t count) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _queue.insert(_queue.end(), tasks, tasks + count);
+    _size += count;
+}
+
 void TaskQueue::pop() noexcept {
     std::lock_guard<std::mutex> lock(_mutex);
     _queue.pop_front();
     --_size;
 }
 
-std::shared_ptr<Task> TaskQueue::remove() noexcept {
+TaskRef TaskQueue::remove() noexcept {
     std::lock_guard<std::mutex> lock(_mutex);
     if (_size == 0) {
         return {nullptr};
     }
     else {
-        auto task = _queue.front();
+        auto task = std::move(_queue.front());
         _queue.pop_front();
         --_size;
         return task;
     }
 }
 
-std::shared_ptr<Task> TaskQueue::peek() const noexcept {
+size_t TaskQueue::removeBatch(TaskRef *out, size_t max) noexcept {
+    std::lock_guard<std::mutex> lock(_mutex);
+    size_t count = std::min(max, _queue.size());
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = std::move(_queue.front());
+        _queue.pop_front();
+    }
+    _size -= count;
+    return count;
+}
+
+TaskRef TaskQueue::peek() const noexcept {
     std::lock_guard<std::mutex> lock(_mutex);
     return _queue.front();
 }
 
-void TaskQueue::lpush(const std::shared_ptr<Task> &task) {
-    _queue.push_back(task);
+void TaskQueue::lpush(TaskRef task) {
+    _queue.push_back(std::move(task));
     ++_size;
 }
 
@@ -40,14 +73,14 @@ void TaskQueue::lpop() noexcept {
     --_size;
 }
 
-std::shared_ptr<Task> TaskQueue::lremove() noexcept {
-    auto task = _queue.front();
+TaskRef TaskQueue::lremove() noexcept {
+    auto task = std::move(_queue.front());
     _queue.pop_front();
     --_size;
     return task;
 }
 
-std::shared_ptr<Task> TaskQueue::lpeek() const noexcept {
+TaskRef TaskQueue::lpeek() const noexcept {
     return _queue.front();
 }
 
@@ -65,6 +98,23 @@ void TaskQueue::clear() noexcept {
     _queue.clear();
 }
 
+size_t TaskQueue::purgeCanceled(std::vector<TaskRef> &removed) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto live = _queue.begin();
+    for (auto it = _queue.begin(); it != _queue.end(); ++it) {
+        if ((*it)->isCanceled()) {
+            removed.push_back(std::move(*it));
+        }
+        else {
+            *live++ = std::move(*it);
+        }
+    }
+    auto count = static_cast<size_t>(_queue.end() - live);
+    _queue.erase(live, _queue.end());
+    _size -= count;
+    return count;
+}
+
 decltype(TaskQueue::_queue)::iterator TaskQueue::begin() noexcept {
     return _queue.begin();
 }
@@ -80,18 +130,3 @@ void TaskQueue::lock() const {
 void TaskQueue::unlock() const {
     _mutex.unlock();
 }
-
-void QueueWatcher::notifyAll() noexcept {
-    std::unique_lock<std::mutex> lock(mutex);
-    cvar.notify_all();
-}
-
-void QueueWatcher::notifyOne() noexcept {
-    std::unique_lock<std::mutex> lock(mutex);
-    cvar.notify_one();
-}
-
-void QueueWatcher::wait(std::function<bool ()> predicate) {
-    std::unique_lock<std::mutex> lock(mutex);
-    cvar.wait(lock, predicate);
-}
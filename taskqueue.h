@@ -4,14 +4,14 @@
 #include <atomic>
 #include <mutex>
 #include <queue>
-#include <condition_variable>
 
 #include "task.h"
+#include "taskqueuebase.h"
 
-class TaskQueue {
+class TaskQueue : public TaskQueueBase {
     mutable std::mutex _mutex;
-    std::deque<std::shared_ptr<Task>> _queue;
-    std::atomic_size_t _size;
+    std::deque<TaskRef> _queue;
+    std::atomic_size_t _size{0};
 
 public:
     TaskQueue() = default;
@@ -20,31 +20,37 @@ public:
 
     TaskQueue &operator=(const TaskQueue &) = delete;
 
-    void push(const std::shared_ptr<Task> &task);
+    virtual void push(TaskRef task) override;
+
+    virtual void pushBatch(const TaskRef *tasks, size_t count) override;
 
     void pop() noexcept;
 
-    std::shared_ptr<Task> remove() noexcept;
+    virtual TaskRef remove() noexcept override;
+
+    virtual size_t removeBatch(TaskRef *out, size_t max) noexcept override;
 
-    std::shared_ptr<Task> peek() const noexcept;
+    TaskRef peek() const noexcept;
 
     // Push, but not lock. Thread-unsafe
-    void lpush(const std::shared_ptr<Task> &task);
+    void lpush(TaskRef task);
 
     // Pop, but not lock. Thread-unsafe
     void lpop() noexcept;
 
     // Remove, but not lock. Thread-unsafe
-    std::shared_ptr<Task> lremove() noexcept;
+    TaskRef lremove() noexcept;
 
     // Peek, but not lock. Thread-unsafe
-    std::shared_ptr<Task> lpeek() const noexcept;
+    TaskRef lpeek() const noexcept;
+
+    virtual bool empty() const noexcept override;
 
-    bool empty() const noexcept;
+    virtual size_t size() const noexcept override;
 
-    size_t size() const noexcept;
+    virtual void clear() noexcept override;
 
-    void clear() noexcept;
+    virtual size_t purgeCanceled(std::vector<TaskRef> &removed) override;
 
     decltype(_queue)::iterator begin() noexcept;
 
@@ -55,17 +61,4 @@ public:
     void unlock() const;
 };
 
-// Just wrapper above mutex and condition var
-struct QueueWatcher {
-    std::mutex mutex;
-    std::condition_variable cvar;
-
-    void notifyAll() noexcept;
-
-    void notifyOne() noexcept;
-
-    void wait(std::function<bool()> predicate);
-};
-
-
 #endif // TASKQUEUE_H
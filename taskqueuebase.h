@@ -0,0 +1,48 @@
+#ifndef TASKQUEUEBASE_H
+#define TASKQUEUEBASE_H
+
+#include <memory>
+#include <vector>
+
+#include "task.h"
+
+// Implementation of the global task queue
+enum class QueueType {
+    // std::deque protected by a mutex
+    MUTEX,
+
+    // Lock-free segmented queue, see LockFreeTaskQueue
+    LOCK_FREE
+};
+
+// Interface of a multi-producer multi-consumer FIFO task queue
+class TaskQueueBase {
+public:
+    virtual void push(TaskRef task) = 0;
+
+    // Pushes `count` tasks at once. References stay in `tasks`, the queue takes its own ones
+    virtual void pushBatch(const TaskRef *tasks, size_t count) = 0;
+
+    // Takes the first task. Returns nullptr if queue is empty
+    virtual TaskRef remove() noexcept = 0;
+
+    // Takes up to `max` first tasks into `out`. Returns number of taken tasks
+    virtual size_t removeBatch(TaskRef *out, size_t max) noexcept = 0;
+
+    virtual bool empty() const noexcept = 0;
+
+    virtual size_t size() const noexcept = 0;
+
+    virtual void clear() noexcept = 0;
+
+    // Moves canceled tasks, see `Task::isCanceled()`, to `removed` keeping the order of the rest.
+    // Returns number of removed tasks. Caller cancels them outside of the queue, see `Task::cancel()`
+    virtual size_t purgeCanceled(std::vector<TaskRef> &removed) = 0;
+
+    virtual ~TaskQueueBase();
+};
+
+// Creates queue of specified type. Capacity is respected only by bounded implementations, 0 means unbounded
+std::unique_ptr<TaskQueueBase> makeTaskQueue(QueueType type, size_t capacity = 0);
+
+#endif // TASKQUEUEBASE_H
@@ -1,23 +1,65 @@
 #include "threadpool.h"
 
-static std::shared_ptr<ThreadPool> mainPool{nullptr};
+// Pools are registered before they start, so loopers read the table without locks
+static std::shared_ptr<ThreadPool> domainPools[MAX_DOMAINS];
 thread_local std::shared_ptr<Looper> ThreadPool::_thisLooper;
 
-ThreadPool::ThreadPool(size_t count, bool addMainLooper)
-    : _count{count}, _useMainLooper{addMainLooper}, _isStopped{false} {
-    if (count < 1) {
+namespace {
+
+const std::shared_ptr<ThreadPool> &domainPool(DomainId domain) {
+    auto index = static_cast<size_t>(domain);
+    if (index >= MAX_DOMAINS || !domainPools[index]) {
+        throw std::runtime_error("Domain " + std::to_string(index) + " has no thread pool");
+    }
+    return domainPools[index];
+}
+
+}
+
+ThreadPool::ThreadPool(size_t count, bool addMainLooper, const ThreadPoolOptions &options, DomainId domain)
+    : ThreadPool(count, addMainLooper, options, domain, Topology::detect()) {}
+
+ThreadPool::ThreadPool(size_t count, bool addMainLooper, const ThreadPoolOptions &options, DomainId domain,
+                       Topology topology)
+    : _count{addMainLooper ? count + 1 : count}, _capacity{std::max(_count, options.maxLoopers)},
+      _useMainLooper{addMainLooper}, _domain{domain}, _options{options}, _isStopped{false},
+      _taskQueue{new PriorityTaskQueue(options.queue, options.queueCapacity, options.starvationLimit)}, _idle{_capacity},
+      _spinners{options.idle.maxSpinners != 0 ? options.idle.maxSpinners : (_count + 3) / 4},
+      _topology{std::move(topology)} {
+    if (_count < 1) {
         throw std::runtime_error("Thread pool have to contain at least one thread");
     }
 
-    _pool = new std::thread[_count];
+    _pool = new std::thread[_useMainLooper ? _capacity - 1 : _capacity];
 
-    if (_useMainLooper) {
-        ++_count;
+    _loopers = new std::shared_ptr<Looper>[_capacity];
+    _running.reset(new std::atomic_bool[_capacity]);
+    for (size_t i = 0; i < _capacity; ++i) {
+        _loopers[i] = std::shared_ptr<Looper>(new Looper(static_cast<int>(i), _taskQueue.get(), _idle, _spinners, this,
+                                                            _options.scheduler, _options.idle));
+        if (i >= _count) {
+            _loopers[i]->setRetireTimeout(_options.retireAfter);
+        }
+        if (_options.reactor) {
+            _loopers[i]->enableReactor();
+            _loopers[i]->enableFileIo(_options.fileIo);
+        }
+        _running[i] = i < _count;
     }
+    _runningCount = _count;
+    _started = _count;
 
-    _loopers = new std::shared_ptr<Looper>[_count];
-    for (size_t i = 0; i < _count; ++i) {
-        _loopers[i] = std::shared_ptr<Looper>(new Looper(static_cast<int>(i), &_taskQueue, _watcher, this));
+    // Thieves try loopers sharing their L3, then their node, then the rest. Within a group they start from
+    // their neighbour, so thieves don't all hammer the same looper
+    _stealOrder.resize(_capacity);
+    for (size_t thief = 0; thief < _capacity; ++thief) {
+        auto &order = _stealOrder[thief];
+        for (size_t i = 1; i < _capacity; ++i) {
+            order.push_back((thief + i) % _capacity);
+        }
+        std::stable_sort(order.begin(), order.end(), [this, thief](size_t a, size_t b) {
+            return distance(thief, a) < distance(thief, b);
+        });
     }
 }
 
@@ -25,51 +67,329 @@ ThreadPool::~ThreadPool() {
     if (!_isStopped) {
         stop();
     }
+
+    // Loopers are freed only here: stop() is usually called from a looper which is still running
+    delete[] _loopers;
+    delete[] _pool;
 }
 
-std::shared_ptr<Task> ThreadPool::addTask(Task *task) {
-    return addTask(std::shared_ptr<Task>(task));
+TaskRef ThreadPool::addTask(Task *task) {
+    return addTask(TaskRef(task));
 }
 
-std::shared_ptr<Task> ThreadPool::addTask(const std::shared_ptr<Task> &task) {
+TaskRef ThreadPool::addTask(TaskRef task) {
+    if (!isOwn(task)) {
+        return domainPool(task->getPolicy().domain)->addTask(std::move(task));
+    }
+
+    // Canceled tasks are not revived
+    if (!task->makePending()) {
+        task->cancel();
+        return task;
+    }
+
     auto policy = task->getPolicy();
-    task->setState(TaskState::PENDING);
+    task->setEnqueueTime(TaskClock::now());
+    EVENTPP_TRACE(TraceEventType::SUBMIT, task->getId(), 0);
+    countSubmitted(1);
     switch (policy.policy) {
         case TaskBindingPolicy::UNBOUND:
-            _taskQueue.push(task);
+            // In work-stealing mode tasks spawned by a looper stay in its own deque.
+            // Tasks of other priority classes go to the global queue to be ordered with others
+            if (auto looper = localLooper(); looper && !policy.isPrioritized() &&
+                    _options.scheduler == SchedulerMode::WORK_STEALING) {
+                looper->pushWork(task);
+            }
+            else {
+                _taskQueue->push(task);
+            }
 
-            // Wake up an arbitary thread
-            _watcher.notifyOne();
+            // Wake up an arbitary sleeping thread. If all loopers are busy, one of them will take the task
+            wake();
             break;
         case TaskBindingPolicy::BOUND:
             _loopers[policy.boundLooper]->pushBack(task);
 
-            // Wake up all threads (loopers) to be sure that specified looper will execute new task
-            _watcher.notifyAll();
+            // Only specified looper can execute the task
+            ensureRunning(static_cast<size_t>(policy.boundLooper));
+            _loopers[policy.boundLooper]->unpark();
             break;
         case TaskBindingPolicy::UNBOUND_EXCEPT: {
-            size_t min = SIZE_MAX; //_loopers[0]->getQueueSize();
-            std::shared_ptr<Looper>* desired = nullptr;
-            for (size_t i = 0; i < _count; ++i) {
-                if (_loopers[i]->getQueueSize() < min && static_cast<int>(i) != policy.boundLooper) {
-                    desired = &_loopers[i];
-                    min = _loopers[i]->getQueueSize();
+            // Least loaded looper, loopers on other nodes than the submitter's one have to be noticeably less loaded
+            auto local = localLooper();
+            size_t min = SIZE_MAX;
+            size_t desired = SIZE_MAX;
+            auto started = _started.load();
+            for (size_t i = 0; i < started; ++i) {
+                if (static_cast<int>(i) == policy.boundLooper || !_running[i]) {
+                    continue;
+                }
+                auto cost = _loopers[i]->getQueueSize();
+                if (local && distance(static_cast<size_t>(local->getIndex()), i) == CpuDistance::REMOTE) {
+                    cost += REMOTE_PENALTY;
+                }
+                if (cost < min) {
+                    desired = i;
+                    min = cost;
                 }
             }
 
-            if (desired == nullptr) {
-                throw std::runtime_error("Can't assign the task to any looper");
-            }
-            else {
-                (*desired)->pushBack(task);
+            // Only the excluded looper runs, elastic pool can start another one
+            if (desired == SIZE_MAX) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                desired = freeSlot();
+                if (desired == SIZE_MAX || _isStopped) {
+                    throw std::runtime_error("Can't assign the task to any looper");
+                }
+                startLooper(desired);
             }
-            _watcher.notifyAll();
+
+            _loopers[desired]->pushBack(task);
+            ensureRunning(desired);
+            _loopers[desired]->unpark();
         }
             break;
     }
     return task;
 }
 
+void ThreadPool::addTasks(const TaskRef *tasks, size_t count) {
+    auto now = TaskClock::now();
+    size_t unbound = 0;
+    // Filled only once some task doesn't go to the unbound queues, until then they are a prefix of `tasks`
+    std::vector<TaskRef> batch;
+    for (size_t i = 0; i < count; ++i) {
+        auto isUnbound = tasks[i]->getPolicy().policy == TaskBindingPolicy::UNBOUND && isOwn(tasks[i]);
+        if (isUnbound && tasks[i]->makePending()) {
+            tasks[i]->setEnqueueTime(now);
+            EVENTPP_TRACE(TraceEventType::SUBMIT, tasks[i]->getId(), 0);
+            if (unbound != i) {
+                batch.push_back(tasks[i]);
+            }
+            ++unbound;
+            continue;
+        }
+
+        if (unbound == i) {
+            batch.reserve(count);
+            batch.assign(tasks, tasks + i);
+        }
+        if (isUnbound) {
+            tasks[i]->cancel();
+        }
+        else {
+            // Bound tasks are targeted to specific loopers anyway, other domains take theirs one by one
+            addTask(tasks[i]);
+        }
+    }
+
+    countSubmitted(unbound);
+    if (unbound == count) {
+        pushUnbound(tasks, count);
+    }
+    else if (unbound != 0) {
+        pushUnbound(batch.data(), batch.size());
+    }
+
+    wake(unbound);
+}
+
+void ThreadPool::addTasks(const std::vector<TaskRef> &tasks) {
+    addTasks(tasks.data(), tasks.size());
+}
+
+TaskRef ThreadPool::addTaskNext(TaskRef task) {
+    auto looper = localLooper();
+    auto policy = task->getPolicy();
+    // Slot is stealable once the task is pushed out of it, so only UNBOUND tasks can get there
+    if (!looper || policy.policy != TaskBindingPolicy::UNBOUND || policy.isPrioritized() || task->isCanceled() ||
+            !isOwn(task)) {
+        return addTask(std::move(task));
+    }
+
+    if (!task->makePending()) {
+        task->cancel();
+        return task;
+    }
+    task->setEnqueueTime(TaskClock::now());
+    EVENTPP_TRACE(TraceEventType::SUBMIT, task->getId(), 0);
+    looper->countSubmitted(1);
+    looper->pushNext(task);
+    return task;
+}
+
+TaskRef ThreadPool::addTaskAt(TaskRef task, TaskClock::time_point time) {
+    if (!isOwn(task)) {
+        return domainPool(task->getPolicy().domain)->addTaskAt(std::move(task), time);
+    }
+
+    if (!task->makePending()) {
+        task->cancel();
+        return task;
+    }
+    task->setDueTime(time);
+
+    auto policy = task->getPolicy();
+    Looper* looper = nullptr;
+    auto local = localLooper();
+    if (policy.policy == TaskBindingPolicy::BOUND) {
+        looper = _loopers[policy.boundLooper].get();
+    }
+    else if (local && static_cast<size_t>(local->getIndex()) < _count) {
+        // Loopers which may retire don't keep UNBOUND timers
+        looper = local;
+    }
+    else {
+        looper = _loopers[_nextTimerLooper.fetch_add(1, std::memory_order_relaxed) % _count].get();
+    }
+
+    // Wheel is owned by looper thread, others have to go through its inbox
+    if (looper == local) {
+        looper->addTimer(task);
+    }
+    else {
+        looper->postTimer(task);
+        ensureRunning(static_cast<size_t>(looper->getIndex()));
+    }
+    return task;
+}
+
+TaskRef ThreadPool::addTaskAfter(TaskRef task, TaskClock::duration delay) {
+    return addTaskAt(std::move(task), TaskClock::now() + delay);
+}
+
+TaskRef ThreadPool::addPeriodic(TaskRef task, TaskClock::duration interval) {
+    if (interval <= TaskClock::duration::zero()) {
+        throw std::runtime_error("Interval of periodic task has to be positive");
+    }
+    task->setPeriod(interval);
+    return addTaskAfter(std::move(task), interval);
+}
+
+TaskRef ThreadPool::stealTask(int thief) {
+    // Nearest loopers first, tasks taken from them find their data in a shared cache or local memory
+    auto started = _started.load(std::memory_order_relaxed);
+    for (auto victim : _stealOrder[static_cast<size_t>(thief)]) {
+        if (victim >= started) {
+            continue;
+        }
+        if (auto task = _loopers[victim]->stealWork()) {
+            return task;
+        }
+    }
+    return {nullptr};
+}
+
+bool ThreadPool::hasStealableTasks() const noexcept {
+    auto started = _started.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < started; ++i) {
+        if (_loopers[i]->getWorkSize() != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t ThreadPool::getLooperCount() const noexcept {
+    return _runningCount.load(std::memory_order_relaxed);
+}
+
+size_t ThreadPool::getLooperCapacity() const noexcept {
+    return _capacity;
+}
+
+void ThreadPool::purgeCanceled() {
+    std::vector<TaskRef> removed;
+    {
+        std::unique_lock<std::mutex> lock(_purgeMutex, std::try_to_lock);
+        if (!lock) {
+            return;
+        }
+        // Cleared before the counters are read, so cancellations from now on ask again
+        _purgeRequested.exchange(false, std::memory_order_acq_rel);
+        if (!_purgeTrigger.isDue(_taskQueue->size())) {
+            return;
+        }
+        _purgeTrigger.reset();
+        _taskQueue->purgeCanceled(removed);
+    }
+
+    // Cancellation reaches continuations of removed tasks, they are freed right here
+    for (auto &task : removed) {
+        task->cancel();
+    }
+}
+
+size_t ThreadPool::getIdleCount() const noexcept {
+    return _idle.count();
+}
+
+void ThreadPool::wakeToPurge() noexcept {
+    // Loopers park with empty local queues, their timers are dropped when they fire
+    if (!_taskQueue->empty()) {
+        requestPurge();
+        wakeParked(1);
+    }
+}
+
+const ThreadPoolOptions &ThreadPool::getOptions() const noexcept {
+    return _options;
+}
+
+DomainId ThreadPool::getDomain() const noexcept {
+    return _domain;
+}
+
+Looper *ThreadPool::getIoLooper() {
+    if (!_options.reactor) {
+        throw std::runtime_error("Thread pool has no I/O reactors");
+    }
+    if (auto looper = localLooper()) {
+        return looper;
+    }
+
+    // Sockets are long-lived, so they go only to loopers which never retire
+    return _loopers[_nextIoLooper.fetch_add(1, std::memory_order_relaxed) % _count].get();
+}
+
+Looper *ThreadPool::getCurrentLooper() noexcept {
+    return _thisLooper.get();
+}
+
+const Topology &ThreadPool::getTopology() const noexcept {
+    return _topology;
+}
+
+int ThreadPool::getLooperCpu(size_t index) const noexcept {
+    return _options.pinLoopers ? _topology.getLooperCpu(index).cpu : -1;
+}
+
+std::array<LatencyStats, TASK_PRIORITY_COUNT> ThreadPool::getQueueWaitStats() const {
+    std::array<LatencyStats, TASK_PRIORITY_COUNT> stats;
+    auto started = _started.load();
+    for (size_t i = 0; i < started; ++i) {
+        for (size_t priority = 0; priority < TASK_PRIORITY_COUNT; ++priority) {
+            stats[priority] += _loopers[i]->getQueueWaitStats(static_cast<TaskPriority>(priority));
+        }
+    }
+    return stats;
+}
+
+ThreadPoolMetrics ThreadPool::getMetrics() const {
+    ThreadPoolMetrics metrics;
+    metrics.time = TaskClock::now();
+    metrics.globalQueueSize = _taskQueue->size();
+    metrics.idleLoopers = _idle.count();
+    metrics.externalSubmitted = _externalSubmitted.load(std::memory_order_relaxed);
+    metrics.runningLoopers = _runningCount.load(std::memory_order_relaxed);
+    auto started = _started.load();
+    metrics.loopers.reserve(started);
+    for (size_t i = 0; i < started; ++i) {
+        metrics.loopers.push_back(_loopers[i]->getMetrics());
+    }
+    return metrics;
+}
+
 std::shared_ptr<Looper> ThreadPool::getThisLooper() const {
     if (_thisLooper) {
         return _thisLooper;
@@ -78,6 +398,10 @@ std::shared_ptr<Looper> ThreadPool::getThisLooper() const {
 }
 
 void ThreadPool::start() {
+    if (_capacity > _count) {
+        _supervisor = std::thread(&ThreadPool::supervise, this);
+    }
+
     if (_useMainLooper) {
         // Firstly, create _count - 1 threads and start loopers there, then start looper in current thread
         for (size_t i = 1; i < _count; ++i) {
@@ -93,35 +417,68 @@ void ThreadPool::start() {
 }
 
 void ThreadPool::stop() {
-    if (_isStopped)
-        return;
+    {
+        // Nobody starts loopers after this
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_isStopped)
+            return;
 
-    _isStopped = true;
+        _isStopped = true;
+    }
 
-    for (size_t i = 0; i < _count; ++i) {
+    _supervisorWake.notify_all();
+    if (_supervisor.joinable()) {
+        _supervisor.join();
+    }
+
+    for (size_t i = 0; i < _capacity; ++i) {
         _loopers[i]->stop();
     }
 
     // Wake up all loopers, so they can do deinit
-    _watcher.notifyAll();
+    for (size_t i = 0; i < _capacity; ++i) {
+        _loopers[i]->unpark();
+    }
 
-    auto threads = _count;
+    // Threads of retired loopers are joined as well
+    auto threads = _capacity;
     if (_useMainLooper) {
         --threads;
     }
 
     for (size_t i = 0; i < threads; ++i) {
-        _pool[i].join();
+        if (_pool[i].joinable()) {
+            _pool[i].join();
+        }
     }
+}
 
-    delete[] _loopers;
-    delete[] _pool;
+bool ThreadPool::retire(int looper) {
+    auto index = static_cast<size_t>(looper);
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_isStopped || index < _count) {
+        return false;
+    }
+
+    // Pairs with ensureRunning: submitter pushes and checks the flag after, looper clears the flag and checks
+    // its queues after, so a task can't be left to a looper which is gone
+    _running[index] = false;
+    if (_loopers[index]->hasOwnWork()) {
+        _running[index] = true;
+        return false;
+    }
+    _runningCount.fetch_sub(1, std::memory_order_relaxed);
+    return true;
 }
 
 void ThreadPool::loop(int id) {
     // Save current looper to thread-local variable
-
     _thisLooper = _loopers[id];
+
+    if (_options.pinLoopers) {
+        // Looper works without pinning, just with worse locality
+        Topology::pinThread(getLooperCpu(static_cast<size_t>(id)));
+    }
     bool reload = false;
     do {
         // Start current looper. If exception occurred while processing tasks - report and reload the looper
@@ -136,13 +493,192 @@ void ThreadPool::loop(int id) {
     } while(reload);
 }
 
+Looper *ThreadPool::localLooper() const noexcept {
+    if (_thisLooper && _thisLooper->getPool() == this) {
+        return _thisLooper.get();
+    }
+    return nullptr;
+}
+
+void ThreadPool::pushUnbound(const TaskRef *tasks, size_t count) {
+    if (auto looper = localLooper(); looper && _options.scheduler == SchedulerMode::WORK_STEALING) {
+        for (size_t i = 0; i < count; ++i) {
+            if (tasks[i]->getPolicy().isPrioritized()) {
+                _taskQueue->push(tasks[i]);
+            }
+            else {
+                looper->pushWork(tasks[i]);
+            }
+        }
+    }
+    else {
+        _taskQueue->pushBatch(tasks, count);
+    }
+}
+
+void ThreadPool::wake(size_t count) noexcept {
+    if (count == 0) {
+        return;
+    }
+
+    // Pairs with the fence in Looper::park: tasks are published before spinners and idle set are checked.
+    // Spinning loopers take the work themselves, one who stops spinning without it parks and rechecks queues
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto spinning = _spinners.count();
+    if (spinning >= count) {
+        return;
+    }
+    wakeParked(count - spinning);
+}
+
+void ThreadPool::wakeParked(size_t count) noexcept {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (size_t i = 0; i < count; ++i) {
+        auto index = _idle.take();
+        if (index < 0) {
+            break;
+        }
+        _loopers[index]->unpark();
+    }
+}
+
+CpuDistance ThreadPool::distance(size_t a, size_t b) const noexcept {
+    if (!_options.pinLoopers) {
+        return CpuDistance::SAME_CACHE;
+    }
+    return Topology::distance(_topology.getLooperCpu(a), _topology.getLooperCpu(b));
+}
+
+std::thread &ThreadPool::threadOf(size_t index) noexcept {
+    return _pool[_useMainLooper ? index - 1 : index];
+}
+
+void ThreadPool::ensureRunning(size_t index) {
+    if (index < _count) {
+        return;
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_running[index]) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_isStopped && !_running[index]) {
+        startLooper(index);
+    }
+}
+
+size_t ThreadPool::freeSlot() const noexcept {
+    for (size_t i = _count; i < _capacity; ++i) {
+        if (!_running[i]) {
+            return i;
+        }
+    }
+    return SIZE_MAX;
+}
+
+void ThreadPool::startLooper(size_t index) {
+    // Thread of the retired looper has left its loop or is about to
+    auto &thread = threadOf(index);
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+    _running[index] = true;
+    _runningCount.fetch_add(1, std::memory_order_relaxed);
+    if (_started.load() <= index) {
+        _started = index + 1;
+    }
+    thread = std::thread(&ThreadPool::loop, this, index);
+}
+
+void ThreadPool::supervise() {
+    auto tick = std::max<TaskClock::duration>(_options.growAfter / 2, std::chrono::milliseconds(1));
+    // Zero while every queued task has a looper free to take it
+    TaskClock::time_point backlogSince{};
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_supervisorWake.wait_for(lock, tick, [this]() { return _isStopped.load(); })) {
+        // Tasks which no looper is free to take
+        auto backlog = (!_taskQueue->empty() || hasStealableTasks()) && _idle.count() == 0 && _spinners.count() == 0;
+        if (!backlog) {
+            backlogSince = {};
+            continue;
+        }
+
+        auto now = TaskClock::now();
+        if (backlogSince == TaskClock::time_point{}) {
+            backlogSince = now;
+        }
+
+        // Looper stuck in a long task, e.g. a blocking call, won't get to the queue soon
+        auto blocked = false;
+        auto started = _started.load();
+        for (size_t i = 0; i < started && !blocked; ++i) {
+            blocked = _loopers[i]->getTaskRunTime(now) >= _options.growAfter;
+        }
+
+        // One looper per tick, the next tick sees whether it was enough
+        if (blocked || now - backlogSince >= _options.growAfter) {
+            if (auto slot = freeSlot(); slot != SIZE_MAX) {
+                startLooper(slot);
+            }
+            backlogSince = {};
+        }
+    }
+}
+
+bool ThreadPool::isOwn(const TaskRef &task) const noexcept {
+    return task->getPolicy().domain == _domain;
+}
+
+void ThreadPool::countSubmitted(size_t count) noexcept {
+    if (count == 0) {
+        return;
+    }
+    if (auto looper = localLooper()) {
+        looper->countSubmitted(count);
+    }
+    else {
+        _externalSubmitted.fetch_add(count, std::memory_order_relaxed);
+    }
+}
+
 void setMainThreadPool(const std::shared_ptr<ThreadPool> &pool) noexcept {
-    mainPool = pool;
+    domainPools[static_cast<size_t>(DomainId::MAIN)] = pool;
 }
 
 std::shared_ptr<ThreadPool> getMainThreadPool() {
-    if (mainPool) {
-        return mainPool;
+    if (auto &pool = domainPools[static_cast<size_t>(DomainId::MAIN)]) {
+        return pool;
     }
     throw std::runtime_error("Main thread pool is not available");
 }
+
+void setThreadPool(DomainId domain, const std::shared_ptr<ThreadPool> &pool) {
+    auto index = static_cast<size_t>(domain);
+    if (index >= MAX_DOMAINS) {
+        throw std::runtime_error("Too many domains");
+    }
+    domainPools[index] = pool;
+}
+
+std::shared_ptr<ThreadPool> getThreadPool(DomainId domain) {
+    return domainPool(domain);
+}
+
+void requestPurge(DomainId domain) noexcept {
+    auto index = static_cast<size_t>(domain);
+    if (index < MAX_DOMAINS && domainPools[index]) {
+        domainPools[index]->requestPurge();
+    }
+}
+
+void wakeThreadPoolsToPurge() noexcept {
+    for (auto &pool : domainPools) {
+        if (pool) {
+            pool->wakeToPurge();
+        }
+    }
+}
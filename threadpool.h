@@ -1,38 +1,199 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
+#include <array>
 #include <atomic>
 #include <functional>
 #include <mutex>
 #include <thread>
+#include <vector>
 #include <condition_variable>
 
 #include "looper.h"
 #include "task.h"
 #include "threadpoolbase.h"
+#include "topology.h"
+
+// Tunables of thread pool scheduling
+struct ThreadPoolOptions {
+    // Number of loopers created by Application, 0 means as many as the allowed CPUs and cgroup quota permit
+    size_t loopers {0};
+
+    // Pin every looper thread to its own CPU, see Topology::getLooperCpu. The thread passed to the pool
+    // as a looper stays pinned after the pool stops
+    bool pinLoopers {true};
+
+    // How UNBOUND tasks are distributed between loopers
+    SchedulerMode scheduler {SchedulerMode::GLOBAL_QUEUE};
+
+    // Implementation of the global task queue
+    QueueType queue {QueueType::MUTEX};
+
+    // Max number of tasks of one priority in the global queue, 0 means unbounded.
+    // Respected only by QueueType::LOCK_FREE
+    size_t queueCapacity {0};
+
+    // Non-empty priority class is served at least once per this many dequeues from more urgent classes
+    uint32_t starvationLimit {32};
+
+    // How loopers wait for work when they run out of it
+    IdleOptions idle;
+
+    // Elastic pool: total number of loopers the pool may grow to when tasks block. Loopers it starts get
+    // indices after the initial ones and can be used with TaskBindingPolicy::BOUND. 0, or not more than
+    // the initial count, keeps the pool fixed
+    size_t maxLoopers {0};
+
+    // Pool adds a looper when queued tasks wait this long with no looper free to take them,
+    // or when a looper runs one task this long while others wait
+    TaskClock::duration growAfter {std::chrono::milliseconds(10)};
+
+    // Added looper retires after sleeping this long
+    TaskClock::duration retireAfter {std::chrono::seconds(5)};
+
+    // Loopers wait in epoll instead of futex, so they can serve AsyncSocket, AsyncListener and AsyncFile
+    bool reactor {false};
+
+    // How loopers with a reactor perform AsyncFile operations
+    FileIoBackend fileIo {FileIoBackend::AUTO};
+};
 
 class ThreadPool : ThreadPoolBase {
+    // Loopers which run all the time: initial ones, including the thread passed to the pool
     size_t _count{0};
+
+    // Max loopers, those after `_count` are started under load and retire when idle
+    size_t _capacity{0};
     bool _useMainLooper{false};
+
+    // Tasks of other domains are passed to their pools
+    const DomainId _domain;
+    ThreadPoolOptions _options;
     std::thread *_pool{nullptr};
     std::shared_ptr<Looper> *_loopers{nullptr};
     std::atomic_bool _isStopped;
-    TaskQueue _taskQueue;
+    std::unique_ptr<PriorityTaskQueue> _taskQueue;
+    // Guards starting and retiring loopers
     std::mutex _mutex;
-    QueueWatcher _watcher;
+    IdleSet _idle;
+    SpinLimiter _spinners;
+    std::atomic_size_t _nextTimerLooper{0};
+    std::atomic_size_t _nextIoLooper{0};
+
+    // Loopers executed by a thread right now. Slots past `_started` were never used and are skipped
+    std::unique_ptr<std::atomic_bool[]> _running;
+    std::atomic_size_t _runningCount{0};
+    std::atomic_size_t _started{0};
+
+    // Watches queues and adds loopers to elastic pool
+    std::thread _supervisor;
+    std::condition_variable _supervisorWake;
+
+    // CPUs of the process and the order each looper visits others when stealing: nearest first
+    Topology _topology;
+    std::vector<std::vector<size_t>> _stealOrder;
+
+    // Extra queued tasks a looper on another node has to be ahead by to get an UNBOUND_EXCEPT task
+    static constexpr size_t REMOTE_PENALTY = 8;
+
+    // Submissions from threads outside the pool, loopers count their own ones
+    alignas(64) std::atomic_uint64_t _externalSubmitted{0};
+
+    // One looper purges the global queue at a time, others go on with their work
+    std::mutex _purgeMutex;
+    PurgeTrigger _purgeTrigger;
     static thread_local std::shared_ptr<Looper> _thisLooper;
 
 public:
-    ThreadPool(size_t count = 1, bool addThisThread = false);
+    ThreadPool(size_t count = 1, bool addThisThread = false, const ThreadPoolOptions& options = {},
+               DomainId domain = DomainId::MAIN);
+
+    // Pool whose loopers are pinned to CPUs of `topology` instead of all CPUs of the process
+    ThreadPool(size_t count, bool addThisThread, const ThreadPoolOptions& options, DomainId domain, Topology topology);
     virtual ~ThreadPool() override;
 
-    virtual std::shared_ptr<Task> addTask(Task *task) override;
+    virtual TaskRef addTask(Task *task) override;
+
+    virtual TaskRef addTask(TaskRef task) override;
+
+    // Adds `count` tasks with one queue synchronization and wakes up only as many loopers as needed.
+    // References stay in `tasks`
+    virtual void addTasks(const TaskRef *tasks, size_t count) override;
+
+    void addTasks(const std::vector<TaskRef> &tasks);
+
+    // Same for any range of TaskRef or Task*
+    template<class Range>
+    void addTasks(const Range &range) {
+        std::vector<TaskRef> tasks;
+        for (auto &&task : range) {
+            tasks.emplace_back(task);
+        }
+        addTasks(tasks.data(), tasks.size());
+    }
+
+    // Adds the task to the LIFO slot of current looper, so it is executed right after the current task.
+    // Falls back to `addTask()` outside of the pool and for bound or urgent tasks
+    TaskRef addTaskNext(TaskRef task);
+
+    // Adds the task when `time` comes. Timer is kept by the bound looper, by current looper
+    // or, if called from outside the pool, by the next looper in round-robin order
+    virtual TaskRef addTaskAt(TaskRef task, TaskClock::time_point time) override;
+
+    TaskRef addTaskAfter(TaskRef task, TaskClock::duration delay);
+
+    // Adds the task every `interval`, first time after one interval. Runs of the task never overlap,
+    // missed runs are skipped. Stops when the task is canceled
+    TaskRef addPeriodic(TaskRef task, TaskClock::duration interval);
+
+    virtual TaskRef stealTask(int thief) override;
 
-    virtual std::shared_ptr<Task> addTask(const std::shared_ptr<Task> &task) override;
+    virtual bool hasStealableTasks() const noexcept override;
+
+    virtual size_t getLooperCount() const noexcept override;
+
+    virtual void purgeCanceled() override;
+
+    virtual void wake(size_t count = 1) noexcept override;
+
+    virtual bool retire(int looper) override;
+
+    // Max number of loopers, the same as getLooperCount() unless the pool is elastic
+    size_t getLooperCapacity() const noexcept;
+
+    // Number of loopers sleeping because they have nothing to do
+    size_t getIdleCount() const noexcept;
+
+    using ThreadPoolBase::requestPurge;
+
+    // Wakes up one sleeping looper to purge canceled tasks, if the global queue has any tasks at all
+    void wakeToPurge() noexcept;
+
+    const ThreadPoolOptions& getOptions() const noexcept;
+
+    virtual DomainId getDomain() const noexcept override;
+
+    // Looper for a new socket: current one, or the next in round-robin order if called from outside the pool.
+    // Throws if the pool has no reactors, see ThreadPoolOptions::reactor
+    Looper *getIoLooper();
+
+    // Looper of the calling thread in any pool, nullptr outside of pools
+    static Looper *getCurrentLooper() noexcept;
+
+    const Topology& getTopology() const noexcept;
+
+    // CPU the looper is pinned to, -1 if loopers are not pinned
+    int getLooperCpu(size_t index) const noexcept;
 
     // Returns thread-local looper
     std::shared_ptr<Looper> getThisLooper() const;
 
+    // Time tasks spent in queues before execution, per priority class, summed over all loopers
+    std::array<LatencyStats, TASK_PRIORITY_COUNT> getQueueWaitStats() const;
+
+    // Counters of all loopers and queue sizes. Loopers are not paused, see LooperMetrics::consistent
+    ThreadPoolMetrics getMetrics() const;
+
     // Starts all loopers
     void start();
 
@@ -41,10 +202,55 @@ public:
 private:
     // Starts execution loop of specific looper
     void loop(int id);
+
+    // Returns thread-local looper if it belongs to this pool, nullptr otherwise
+    Looper* localLooper() const noexcept;
+
+    // Pushes UNBOUND tasks to the global queue or, in work-stealing mode, to the deque of current looper
+    void pushUnbound(const TaskRef *tasks, size_t count);
+
+    // Wakes up to `count` sleeping loopers regardless of spinning ones
+    void wakeParked(size_t count) noexcept;
+
+    // Distance between the CPUs of two loopers, all loopers are equally close when they are not pinned
+    CpuDistance distance(size_t a, size_t b) const noexcept;
+
+    // Counts submissions on current looper or as external ones
+    void countSubmitted(size_t count) noexcept;
+
+    // Thread running the looper, slot 0 has none when the pool got the caller's thread
+    std::thread &threadOf(size_t index) noexcept;
+
+    // Starts the looper added by elastic pool if it is not running, e.g. because a task is bound to it
+    void ensureRunning(size_t index);
+
+    // Index of a looper elastic pool can start, SIZE_MAX if all are running. Requires `_mutex`
+    size_t freeSlot() const noexcept;
+
+    // Starts a thread for the looper. Requires `_mutex`
+    void startLooper(size_t index);
+
+    // Body of the supervisor thread: adds a looper when work waits for too long
+    void supervise();
+
+    // Is the task for this pool and not for another domain
+    bool isOwn(const TaskRef &task) const noexcept;
 };
 
 void setMainThreadPool(const std::shared_ptr<ThreadPool> &pool) noexcept;
 
 std::shared_ptr<ThreadPool> getMainThreadPool();
 
+// Pools of Application domains, tasks are routed to them by TaskPolicy::domain
+void setThreadPool(DomainId domain, const std::shared_ptr<ThreadPool> &pool);
+
+// Throws if the domain has no pool
+std::shared_ptr<ThreadPool> getThreadPool(DomainId domain);
+
+// Lets the pool of `domain` know that one of its tasks was canceled, see ThreadPoolBase::requestPurge()
+void requestPurge(DomainId domain) noexcept;
+
+// Wakes up a sleeping looper in each domain which has queued tasks, to purge the canceled ones
+void wakeThreadPoolsToPurge() noexcept;
+
 #endif // THREADPOOL_H
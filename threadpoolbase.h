@@ -1,14 +1,64 @@
 #ifndef THREADPOOLBASE_H
 #define THREADPOOLBASE_H
 
+#include <atomic>
 #include <memory>
 
 #include "task.h"
 
+// Defines how UNBOUND tasks are distributed between loopers
+enum class SchedulerMode {
+    // All UNBOUND tasks go to one queue shared by every looper
+    GLOBAL_QUEUE,
+
+    // Every looper owns a work-stealing deque. Tasks submitted from a looper land in its own deque,
+    // idle loopers steal from others. Global queue is used only for submissions from outside the pool
+    WORK_STEALING
+};
+
 class ThreadPoolBase {
+protected:
+    // Some of the tasks passed to the pool were canceled since the last purge
+    std::atomic_bool _purgeRequested{false};
+
 public:
-    virtual std::shared_ptr<Task> addTask(Task *task) = 0;
-    virtual std::shared_ptr<Task> addTask(const std::shared_ptr<Task> &task) = 0;
+    virtual TaskRef addTask(Task *task) = 0;
+    virtual TaskRef addTask(TaskRef task) = 0;
+
+    // Adds `count` tasks at once, references stay in `tasks`
+    virtual void addTasks(const TaskRef *tasks, size_t count) = 0;
+
+    // Adds the task when `time` comes
+    virtual TaskRef addTaskAt(TaskRef task, TaskClock::time_point time) = 0;
+
+    // Tries to take a task from any looper except `thief`. Returns nullptr if nothing to steal
+    virtual TaskRef stealTask(int thief) = 0;
+
+    // Is there any task in looper work-stealing deques
+    virtual bool hasStealableTasks() const noexcept = 0;
+
+    virtual size_t getLooperCount() const noexcept = 0;
+
+    virtual DomainId getDomain() const noexcept = 0;
+
+    // Drops canceled tasks from the shared queues when enough of them could have piled up
+    virtual void purgeCanceled() = 0;
+
+    // Loopers call purgeCanceled() only after this, so a pool without cancellations costs them one load
+    void requestPurge() noexcept {
+        _purgeRequested.store(true, std::memory_order_release);
+    }
+
+    bool isPurgeRequested() const noexcept {
+        return _purgeRequested.load(std::memory_order_relaxed);
+    }
+
+    // Wakes up to `count` sleeping loopers, fewer if some loopers are spinning for work
+    virtual void wake(size_t count) noexcept = 0;
+
+    // Asked by a looper the pool started under load once it slept long enough with nothing to do.
+    // Returns true if the looper has to exit
+    virtual bool retire(int looper) = 0;
 
     virtual ~ThreadPoolBase();
 };
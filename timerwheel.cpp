@@ -0,0 +1,221 @@
+#include <algorithm>
+
+#include "timerwheel.h"
+
+TimerWheel::TimerWheel(TaskClock::time_point start) noexcept
+    : _start{start} {}
+
+TimerWheel::~TimerWheel() {
+    for (auto &level : _slots) {
+        for (auto list : level) {
+            releaseList(list);
+        }
+    }
+    releaseList(_ready);
+    releaseList(_posted.exchange(nullptr, std::memory_order_acquire));
+}
+
+void TimerWheel::add(TaskRef task) noexcept {
+    insert(task.detach());
+    ++_size;
+}
+
+void TimerWheel::post(TaskRef task) noexcept {
+    // Treiber stack push, the owner takes the whole stack at once
+    auto node = task.detach();
+    auto head = _posted.load(std::memory_order_relaxed);
+    do {
+        node->_timerNext = head;
+    } while (!_posted.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+}
+
+bool TimerWheel::hasPosted() const noexcept {
+    return _posted.load(std::memory_order_relaxed) != nullptr;
+}
+
+size_t TimerWheel::advance(TaskClock::time_point now, std::vector<TaskRef> &expired) {
+    takePosted();
+
+    auto target = currentTick(now);
+    auto before = expired.size();
+    while (true) {
+        while (_ready) {
+            auto task = TaskRef::adopt(_ready);
+            _ready = _ready->_timerNext;
+            --_size;
+            if (task->getState() != TaskState::CANCELED) {
+                expired.push_back(std::move(task));
+            }
+        }
+
+        auto next = nextTick();
+        if (!next || *next > target) {
+            break;
+        }
+        _now = *next;
+        processSlots();
+    }
+
+    // Nothing is scheduled before target, so the wheel can jump there
+    if (target > _now) {
+        _now = target;
+    }
+    return expired.size() - before;
+}
+
+std::optional<TaskClock::time_point> TimerWheel::nextExpiry() const noexcept {
+    if (_ready) {
+        return _start + RESOLUTION * _now;
+    }
+    if (auto tick = nextTick()) {
+        return _start + RESOLUTION * *tick;
+    }
+    return std::nullopt;
+}
+
+size_t TimerWheel::purgeCanceled(std::vector<TaskRef> &removed) {
+    takePosted();
+
+    size_t count = purgeList(_ready, removed);
+    for (size_t level = 0; level < LEVELS; ++level) {
+        for (size_t slot = 0; slot < SLOTS; ++slot) {
+            auto &list = _slots[level][slot];
+            if (list == nullptr) {
+                continue;
+            }
+            count += purgeList(list, removed);
+            if (list == nullptr) {
+                _occupied[level] &= ~(uint64_t{1} << slot);
+            }
+        }
+    }
+    _size -= count;
+    return count;
+}
+
+size_t TimerWheel::size() const noexcept {
+    return _size;
+}
+
+bool TimerWheel::empty() const noexcept {
+    return _size == 0 && !hasPosted();
+}
+
+void TimerWheel::insert(Task *task) noexcept {
+    auto due = dueTick(task->getDueTime());
+    if (due <= _now) {
+        task->_timerNext = _ready;
+        _ready = task;
+        return;
+    }
+
+    // Level is chosen by the highest bit where due tick differs from current one, so within a level
+    // the timer always lands in a slot after the current one. Only the top level wraps around
+    auto place = std::min(due, _now + MAX_SPAN);
+    auto level = std::min<size_t>(static_cast<size_t>(63 - __builtin_clzll(place ^ _now)) / LEVEL_BITS, LEVELS - 1);
+    auto slot = static_cast<size_t>(place >> (level * LEVEL_BITS)) & (SLOTS - 1);
+
+    task->_timerNext = _slots[level][slot];
+    _slots[level][slot] = task;
+    _occupied[level] |= uint64_t{1} << slot;
+}
+
+std::optional<TimerWheel::Tick> TimerWheel::nextTick() const noexcept {
+    std::optional<Tick> next;
+    for (size_t level = 0; level < LEVELS; ++level) {
+        if (_occupied[level] == 0) {
+            continue;
+        }
+
+        // Slots up to and including the current one are already processed
+        auto shift = level * LEVEL_BITS;
+        auto current = (_now >> shift) & (SLOTS - 1);
+        auto pending = current == SLOTS - 1 ? 0 : _occupied[level] & (~uint64_t{0} << (current + 1));
+        auto levelStart = _now & ~((Tick{1} << (shift + LEVEL_BITS)) - 1);
+        if (pending == 0) {
+            if (level != LEVELS - 1) {
+                continue;
+            }
+            // Top level slots before the current one belong to the next round
+            pending = _occupied[level];
+            levelStart += Tick{1} << (shift + LEVEL_BITS);
+        }
+
+        auto slot = static_cast<Tick>(__builtin_ctzll(pending));
+        auto tick = levelStart + (slot << shift);
+        if (!next || tick < *next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+void TimerWheel::processSlots() noexcept {
+    // Higher levels go first: their timers can only move to lower levels, never to the current slot
+    for (size_t level = LEVELS; level-- > 0;) {
+        auto slot = static_cast<size_t>(_now >> (level * LEVEL_BITS)) & (SLOTS - 1);
+        auto bit = uint64_t{1} << slot;
+        if ((_occupied[level] & bit) == 0) {
+            continue;
+        }
+
+        auto list = _slots[level][slot];
+        _slots[level][slot] = nullptr;
+        _occupied[level] &= ~bit;
+
+        while (list) {
+            auto task = list;
+            list = list->_timerNext;
+            insert(task);
+        }
+    }
+}
+
+void TimerWheel::takePosted() noexcept {
+    auto list = _posted.exchange(nullptr, std::memory_order_acquire);
+    while (list) {
+        auto task = list;
+        list = list->_timerNext;
+        insert(task);
+        ++_size;
+    }
+}
+
+TimerWheel::Tick TimerWheel::dueTick(TaskClock::time_point time) const noexcept {
+    if (time <= _start) {
+        return 0;
+    }
+    auto elapsed = time - _start;
+    return static_cast<Tick>((elapsed + RESOLUTION - TaskClock::duration{1}) / RESOLUTION);
+}
+
+TimerWheel::Tick TimerWheel::currentTick(TaskClock::time_point time) const noexcept {
+    if (time <= _start) {
+        return 0;
+    }
+    return static_cast<Tick>((time - _start) / RESOLUTION);
+}
+
+size_t TimerWheel::purgeList(Task *&list, std::vector<TaskRef> &removed) {
+    size_t count = 0;
+    auto link = &list;
+    while (*link) {
+        auto task = *link;
+        if (task->isCanceled()) {
+            *link = task->_timerNext;
+            removed.push_back(TaskRef::adopt(task));
+            ++count;
+        }
+        else {
+            link = &task->_timerNext;
+        }
+    }
+    return count;
+}
+
+void TimerWheel::releaseList(Task *list) noexcept {
+    while (list) {
+        auto task = TaskRef::adopt(list);
+        list = list->_timerNext;
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "task.h"
+
+// Hierarchical timer wheel of tasks waiting for their due time, see `Task::getDueTime()`.
+// Level N has 64 slots of 64^N ticks, six levels cover about two years with 1ms ticks.
+// Insertion and expiration are O(1), a timer is moved to a lower level at most five times.
+// Timers are linked through the tasks, the wheel itself never allocates.
+// Owner thread does everything except `post()`, which is safe from any thread
+class TimerWheel {
+public:
+    using Tick = uint64_t;
+
+    // Timers never fire before their due time, but can fire up to one tick later
+    static constexpr TaskClock::duration RESOLUTION = std::chrono::milliseconds(1);
+
+    static constexpr unsigned LEVEL_BITS = 6;
+    static constexpr size_t SLOTS = size_t{1} << LEVEL_BITS;
+    static constexpr size_t LEVELS = 6;
+
+private:
+    // Timers due later than this wait in the top level and are reinserted from there.
+    // Top level slots wrap around, the span keeps a timer out of the current top slot
+    static constexpr Tick MAX_SPAN = Tick{SLOTS - 1} << (LEVEL_BITS * (LEVELS - 1));
+
+    // Time of tick 0
+    const TaskClock::time_point _start;
+
+    // All ticks before and including this one are processed
+    Tick _now{0};
+
+    // Slot lists, tasks hold references detached from TaskRef
+    std::array<std::array<Task*, SLOTS>, LEVELS> _slots{};
+
+    // Bit per non-empty slot, so the next slot to process is found without scanning
+    std::array<uint64_t, LEVELS> _occupied{};
+
+    // Timers that were already due when added
+    Task *_ready{nullptr};
+
+    // Timers posted by other threads, moved to slots by `advance()`
+    std::atomic<Task*> _posted{nullptr};
+
+    // Number of timers in slots and ready list
+    size_t _size{0};
+
+public:
+    explicit TimerWheel(TaskClock::time_point start = TaskClock::now()) noexcept;
+
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    // Adds timer for the task due time. Owner only
+    void add(TaskRef task) noexcept;
+
+    // Adds timer from any thread. The owner picks it up on the next `advance()`, so it has to be woken up
+    void post(TaskRef task) noexcept;
+
+    // Were any timers posted and not picked up yet
+    bool hasPosted() const noexcept;
+
+    // Moves wheel to `now` and appends expired tasks to `expired`. Canceled tasks are dropped.
+    // Returns number of expired tasks. Owner only
+    size_t advance(TaskClock::time_point now, std::vector<TaskRef> &expired);
+
+    // Earliest time the wheel has to be advanced at. It can be a bit earlier than the nearest due time,
+    // when timers have to be moved to a lower level. Owner only
+    std::optional<TaskClock::time_point> nextExpiry() const noexcept;
+
+    // Moves canceled timers, including the posted ones, to `removed`. Returns their number. Owner only
+    size_t purgeCanceled(std::vector<TaskRef> &removed);
+
+    // Number of pending timers, except the posted ones. Owner only
+    size_t size() const noexcept;
+
+    // No pending and no posted timers
+    bool empty() const noexcept;
+
+private:
+    // Links detached task into slot or ready list
+    void insert(Task *task) noexcept;
+
+    // Tick of the next non-empty slot, nothing if slots are empty
+    std::optional<Tick> nextTick() const noexcept;
+
+    // Expires or moves down timers of all slots starting at current tick
+    void processSlots() noexcept;
+
+    // Drains posted timers into slots
+    void takePosted() noexcept;
+
+    // Ticks are rounded up for due times and down for the current time, so timers never fire early
+    Tick dueTick(TaskClock::time_point time) const noexcept;
+    Tick currentTick(TaskClock::time_point time) const noexcept;
+
+    // Unlinks canceled tasks of the list into `removed`. Returns number of them
+    static size_t purgeList(Task *&list, std::vector<TaskRef> &removed);
+
+    // Releases all tasks of the list
+    static void releaseList(Task *list) noexcept;
+};
+
+#endif // TIMERWHEEL_H
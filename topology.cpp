@@ -0,0 +1,229 @@
+#include <pthread.h>
+#include <sched.h>
+#include <sys/sysinfo.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include "topology.h"
+
+namespace {
+
+std::string readLine(const std::string &path) {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+// Parses kernel CPU lists like "0-3,8,10-11"
+std::vector<int> parseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    std::istringstream in(list);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        auto dash = range.find('-');
+        auto first = std::stoi(range.substr(0, dash));
+        auto last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (auto cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(static_cast<int>(cpu));
+            }
+        }
+    }
+    if (cpus.empty()) {
+        for (int cpu = 0; cpu < get_nprocs(); ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::map<int, int> cpuNodes() {
+    std::map<int, int> nodes;
+    for (auto node : parseCpuList(readLine("/sys/devices/system/node/online"))) {
+        for (auto cpu : parseCpuList(readLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"))) {
+            nodes[cpu] = node;
+        }
+    }
+    return nodes;
+}
+
+int cpuCache(int cpu) {
+    auto base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+    for (int index = 0; index < 8; ++index) {
+        if (readLine(base + std::to_string(index) + "/level") == "3") {
+            auto shared = parseCpuList(readLine(base + std::to_string(index) + "/shared_cpu_list"));
+            if (!shared.empty()) {
+                return shared.front();
+            }
+        }
+    }
+    return 0;
+}
+
+// Cgroup path of the process for the given v1 controller, or the v2 path for an empty controller
+std::string cgroupPath(const std::string &controller) {
+    std::ifstream file("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(file, line)) {
+        auto first = line.find(':');
+        auto second = line.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos) {
+            continue;
+        }
+        std::istringstream controllers(line.substr(first + 1, second - first - 1));
+        std::string name;
+        if (controller.empty() && line.substr(0, first) == "0") {
+            return line.substr(second + 1);
+        }
+        while (std::getline(controllers, name, ',')) {
+            if (name == controller) {
+                return line.substr(second + 1);
+            }
+        }
+    }
+    return "/";
+}
+
+// CPUs worth of quota, 0 if unlimited or unknown. Containers usually see their own cgroup at the mount root
+double cpuQuota() {
+    auto v2 = cgroupPath("");
+    for (auto &path : {"/sys/fs/cgroup" + v2 + "/cpu.max", std::string("/sys/fs/cgroup/cpu.max")}) {
+        std::istringstream in(readLine(path));
+        std::string quota;
+        double period = 0;
+        if (in >> quota >> period && quota != "max" && period > 0) {
+            return std::stod(quota) / period;
+        }
+    }
+
+    auto v1 = cgroupPath("cpu");
+    for (auto &dir : {"/sys/fs/cgroup/cpu" + v1, std::string("/sys/fs/cgroup/cpu"),
+                      "/sys/fs/cgroup/cpu,cpuacct" + v1, std::string("/sys/fs/cgroup/cpu,cpuacct")}) {
+        auto quota = readLine(dir + "/cpu.cfs_quota_us");
+        auto period = readLine(dir + "/cpu.cfs_period_us");
+        if (!quota.empty() && !period.empty()) {
+            auto value = std::stod(quota);
+            return value > 0 ? value / std::stod(period) : 0;
+        }
+    }
+    return 0;
+}
+
+}
+
+Topology::Topology(std::vector<CpuInfo> cpus, double quota)
+    : _cpus{std::move(cpus)}, _quota{quota} {
+    if (_cpus.empty()) {
+        _cpus.push_back(CpuInfo{});
+    }
+    // Keys are unique, so a stable sort gives the same order without the -Wstrict-overflow noise of std::sort
+    std::stable_sort(_cpus.begin(), _cpus.end(), [](const CpuInfo &a, const CpuInfo &b) {
+        if (a.node != b.node) {
+            return a.node < b.node;
+        }
+        if (a.cache != b.cache) {
+            return a.cache < b.cache;
+        }
+        return a.cpu < b.cpu;
+    });
+}
+
+Topology Topology::detect() {
+    std::vector<CpuInfo> cpus;
+    double quota = 0;
+
+    // Sysfs and procfs contents are not trusted to be well formed
+    try {
+        auto nodes = cpuNodes();
+        for (auto cpu : allowedCpus()) {
+            auto node = nodes.find(cpu);
+            cpus.push_back(CpuInfo{cpu, node == nodes.end() ? 0 : node->second, cpuCache(cpu)});
+        }
+        quota = cpuQuota();
+    }
+    catch (const std::exception &) {
+        cpus.clear();
+        for (auto cpu : allowedCpus()) {
+            cpus.push_back(CpuInfo{cpu, 0, 0});
+        }
+    }
+    return Topology(std::move(cpus), quota);
+}
+
+const std::vector<CpuInfo> &Topology::getCpus() const noexcept {
+    return _cpus;
+}
+
+double Topology::getCpuQuota() const noexcept {
+    return _quota;
+}
+
+size_t Topology::getNodeCount() const {
+    std::set<int> nodes;
+    for (auto &cpu : _cpus) {
+        nodes.insert(cpu.node);
+    }
+    return nodes.size();
+}
+
+size_t Topology::getRecommendedLooperCount() const noexcept {
+    auto count = _cpus.size();
+    if (_quota > 0) {
+        count = std::min(count, static_cast<size_t>(std::ceil(_quota)));
+    }
+    return std::max<size_t>(count, 1);
+}
+
+const CpuInfo &Topology::getLooperCpu(size_t index) const noexcept {
+    return _cpus[index % _cpus.size()];
+}
+
+CpuDistance Topology::distance(const CpuInfo &a, const CpuInfo &b) noexcept {
+    if (a.node != b.node) {
+        return CpuDistance::REMOTE;
+    }
+    return a.cache == b.cache ? CpuDistance::SAME_CACHE : CpuDistance::SAME_NODE;
+}
+
+bool Topology::pinThread(int cpu) noexcept {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(static_cast<size_t>(cpu), &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool Topology::pinThread(const std::vector<CpuInfo> &cpus) noexcept {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto &info : cpus) {
+        if (info.cpu >= 0 && info.cpu < CPU_SETSIZE) {
+            CPU_SET(static_cast<size_t>(info.cpu), &set);
+        }
+    }
+    return CPU_COUNT(&set) != 0 && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
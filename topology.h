@@ -0,0 +1,62 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <cstddef>
+#include <vector>
+
+// CPU the process may run on
+struct CpuInfo {
+    int cpu{0};
+
+    // NUMA node
+    int node{0};
+
+    // Id of the L3 cache, the lowest CPU sharing it
+    int cache{0};
+};
+
+// How far two CPUs are from each other, used to keep load balancing local
+enum class CpuDistance {
+    SAME_CACHE,
+    SAME_NODE,
+    REMOTE
+};
+
+// CPUs available to the process: affinity mask (which includes cgroup cpuset), cgroup CPU quota, NUMA nodes
+// and shared L3 caches, read from sysfs and procfs. Missing files are not errors, everything just looks
+// like one node then
+class Topology {
+    // Allowed CPUs ordered by node, L3 and id, so consecutive loopers share as much as possible
+    std::vector<CpuInfo> _cpus;
+
+    // CPUs worth of time granted by cgroup quota, 0 means unlimited
+    double _quota{0};
+
+public:
+    Topology(std::vector<CpuInfo> cpus, double quota = 0);
+
+    // Reads topology of the current process
+    static Topology detect();
+
+    const std::vector<CpuInfo> &getCpus() const noexcept;
+
+    double getCpuQuota() const noexcept;
+
+    size_t getNodeCount() const;
+
+    // Loopers which fit into both the allowed CPUs and the quota
+    size_t getRecommendedLooperCount() const noexcept;
+
+    // CPU assigned to looper `index`. Loopers fill an L3 cache, then a node before taking the next one
+    const CpuInfo &getLooperCpu(size_t index) const noexcept;
+
+    static CpuDistance distance(const CpuInfo &a, const CpuInfo &b) noexcept;
+
+    // Pins the current thread to `cpu`. Returns false if the OS refused
+    static bool pinThread(int cpu) noexcept;
+
+    // Lets the current thread run on any of `cpus`, e.g. to undo the pinning inherited from a looper
+    static bool pinThread(const std::vector<CpuInfo> &cpus) noexcept;
+};
+
+#endif // TOPOLOGY_H
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+#include "tracer.h"
+
+namespace {
+    // Registry grows past this many buffers only while more threads are alive
+    constexpr size_t MAX_BUFFERS = 64;
+
+    // Buffers of all threads which recorded, guarded by the mutex
+    std::mutex registryMutex;
+    std::vector<std::shared_ptr<TraceBuffer>> registry;
+    std::atomic_size_t capacity{Tracer::DEFAULT_CAPACITY};
+
+    // Buffers of exited threads, the oldest first. They stay in the registry until a new thread takes them
+    std::vector<std::shared_ptr<TraceBuffer>> released;
+
+    // Gives the buffer back when its thread exits
+    struct LocalBuffer {
+        std::shared_ptr<TraceBuffer> buffer;
+
+        ~LocalBuffer() {
+            if (buffer) {
+                std::lock_guard<std::mutex> lock(registryMutex);
+                released.push_back(std::move(buffer));
+            }
+        }
+    };
+
+    thread_local LocalBuffer localBuffer;
+
+    // Name given before the thread got its buffer
+    thread_local std::string localName;
+
+    const char *eventName(TraceEventType type) noexcept {
+        switch (type) {
+            case TraceEventType::SUBMIT:
+                return "submit";
+            case TraceEventType::DEQUEUE:
+                return "dequeue";
+            case TraceEventType::START:
+            case TraceEventType::END:
+                return "task";
+            case TraceEventType::RESCHEDULE:
+                return "reschedule";
+            case TraceEventType::STEAL:
+                return "steal";
+            case TraceEventType::PARK:
+            case TraceEventType::UNPARK:
+                return "park";
+            default:
+                return "unknown";
+        }
+    }
+
+    const char *sourceName(uint32_t source) noexcept {
+        switch (static_cast<TaskSource>(source)) {
+            case TaskSource::LOCAL_QUEUE:
+                return "local queue";
+            case TaskSource::NEXT_SLOT:
+                return "next slot";
+            case TaskSource::WORK_QUEUE:
+                return "work queue";
+            case TaskSource::GLOBAL_QUEUE:
+                return "global queue";
+            case TaskSource::STOLEN:
+                return "stolen";
+            default:
+                return "unknown";
+        }
+    }
+
+    // Chrome trace timestamps are microseconds
+    void writeTime(std::ostream &out, uint64_t timeNs) {
+        out << timeNs / 1000 << '.';
+        auto fraction = timeNs % 1000;
+        out << static_cast<char>('0' + fraction / 100) << static_cast<char>('0' + fraction / 10 % 10)
+            << static_cast<char>('0' + fraction % 10);
+    }
+
+    void writeString(std::ostream &out, const std::string &value) {
+        out << '"';
+        for (auto c : value) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            }
+            else if (static_cast<unsigned char>(c) >= 0x20) {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+}
+
+std::atomic_bool Tracer::_enabled{false};
+
+TraceBuffer::TraceBuffer(uint32_t index, size_t capacity)
+    : _mask{std::bit_ceil(std::max<size_t>(capacity, 2)) - 1},
+      _words{new std::atomic_uint64_t[(_mask + 1) * WORDS]}, _index{index} {}
+
+void TraceBuffer::push(TraceEventType type, uint64_t taskId, uint32_t arg) noexcept {
+    auto time = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+
+    auto index = _written.load(std::memory_order_relaxed);
+    _started.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto slot = &_words[(index & _mask) * WORDS];
+    slot[0].store(time, std::memory_order_relaxed);
+    slot[1].store(taskId, std::memory_order_relaxed);
+    slot[2].store(static_cast<uint64_t>(type) | (static_cast<uint64_t>(arg) << 8), std::memory_order_relaxed);
+
+    _written.store(index + 1, std::memory_order_release);
+}
+
+void TraceBuffer::collect(std::vector<TraceEvent> &events) const {
+    auto capacity = _mask + 1;
+    auto end = _written.load(std::memory_order_acquire);
+    auto begin = std::max(_begin.load(std::memory_order_relaxed), end > capacity ? end - capacity : 0);
+
+    auto first = events.size();
+    for (auto i = begin; i < end; ++i) {
+        auto slot = &_words[(i & _mask) * WORDS];
+        auto word = slot[2].load(std::memory_order_relaxed);
+        events.push_back({slot[0].load(std::memory_order_relaxed), slot[1].load(std::memory_order_relaxed),
+                          static_cast<uint32_t>(word >> 8), static_cast<TraceEventType>(word & 0xff), _index});
+    }
+
+    // Writer could lap the reader meanwhile, slots written since then may hold newer events
+    std::atomic_thread_fence(std::memory_order_acquire);
+    auto started = _started.load(std::memory_order_relaxed);
+    if (started > capacity && started - capacity > begin) {
+        auto overwritten = std::min(started - capacity, end) - begin;
+        events.erase(events.begin() + static_cast<std::ptrdiff_t>(first),
+                     events.begin() + static_cast<std::ptrdiff_t>(first + overwritten));
+    }
+}
+
+void TraceBuffer::clear() noexcept {
+    _begin.store(_written.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
+
+uint32_t TraceBuffer::getIndex() const noexcept {
+    return _index;
+}
+
+const std::string &TraceBuffer::getName() const noexcept {
+    return _name;
+}
+
+void TraceBuffer::setName(std::string name) {
+    _name = std::move(name);
+}
+
+void Tracer::enable(size_t size) {
+    capacity.store(size, std::memory_order_relaxed);
+    _enabled.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::disable() noexcept {
+    _enabled.store(false, std::memory_order_relaxed);
+}
+
+void Tracer::setThreadName(std::string name) {
+    // Names are read by exporters under the same lock
+    std::lock_guard<std::mutex> lock(registryMutex);
+    if (localBuffer.buffer) {
+        localBuffer.buffer->setName(std::move(name));
+    }
+    else {
+        localName = std::move(name);
+    }
+}
+
+std::vector<TraceEvent> Tracer::collect() {
+    std::vector<TraceEvent> events;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (auto &buffer : registry) {
+            buffer->collect(events);
+        }
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const TraceEvent &a, const TraceEvent &b) {
+        return a.timeNs < b.timeNs;
+    });
+    return events;
+}
+
+void Tracer::clear() noexcept {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto &buffer : registry) {
+        buffer->clear();
+    }
+}
+
+void Tracer::exportChromeTrace(std::ostream &out) {
+    auto events = collect();
+    auto origin = events.empty() ? 0 : events.front().timeNs;
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    auto separator = "\n";
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (auto &buffer : registry) {
+            auto name = buffer->getName().empty() ? "Thread #" + std::to_string(buffer->getIndex()) : buffer->getName();
+            out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->getIndex()
+                << ",\"args\":{\"name\":";
+            writeString(out, name);
+            out << "}}";
+            separator = ",\n";
+        }
+    }
+
+    for (auto &event : events) {
+        auto writeHeader = [&](const char *phase, const char *name) {
+            out << separator << "{\"ph\":\"" << phase << "\",\"name\":\"" << name << "\",\"pid\":1,\"tid\":"
+                << event.thread << ",\"ts\":";
+            writeTime(out, event.timeNs - origin);
+            separator = ",\n";
+        };
+
+        switch (event.type) {
+            case TraceEventType::START:
+                writeHeader("B", eventName(event.type));
+                out << ",\"args\":{\"task\":" << event.taskId << "}}";
+                // Arrow from the submission, binds to the enclosing slice
+                writeHeader("f", "flow");
+                out << ",\"cat\":\"task\",\"id\":" << event.taskId << ",\"bp\":\"e\"}";
+                break;
+            case TraceEventType::END:
+            case TraceEventType::UNPARK:
+                writeHeader("E", eventName(event.type));
+                out << "}";
+                break;
+            case TraceEventType::PARK:
+                writeHeader("B", eventName(event.type));
+                out << "}";
+                break;
+            case TraceEventType::SUBMIT:
+                writeHeader("i", eventName(event.type));
+                out << ",\"s\":\"t\",\"args\":{\"task\":" << event.taskId << "}}";
+                writeHeader("s", "flow");
+                out << ",\"cat\":\"task\",\"id\":" << event.taskId << "}";
+                break;
+            case TraceEventType::DEQUEUE:
+                writeHeader("i", eventName(event.type));
+                out << ",\"s\":\"t\",\"args\":{\"task\":" << event.taskId << ",\"source\":\""
+                    << sourceName(event.arg) << "\"}}";
+                break;
+            case TraceEventType::RESCHEDULE:
+            case TraceEventType::STEAL:
+            default:
+                writeHeader("i", eventName(event.type));
+                out << ",\"s\":\"t\",\"args\":{\"task\":" << event.taskId << "}}";
+                break;
+        }
+    }
+    out << "\n]}\n";
+}
+
+void Tracer::exportChromeTrace(const std::string &path) {
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("Can't open trace file " + path);
+    }
+    exportChromeTrace(out);
+    if (!out) {
+        throw std::runtime_error("Can't write trace file " + path);
+    }
+}
+
+void Tracer::push(TraceEventType type, uint64_t taskId, uint32_t arg) noexcept {
+    if (auto buffer = local()) {
+        buffer->push(type, taskId, arg);
+    }
+}
+
+TraceBuffer *Tracer::local() {
+    if (!localBuffer.buffer) {
+        // Tracing is best effort, a thread which can't get a buffer just doesn't record
+        try {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            std::shared_ptr<TraceBuffer> buffer;
+
+            // Looper started again goes on with the timeline of its predecessor
+            auto same = std::find_if(released.begin(), released.end(), [](const auto &candidate) {
+                return !localName.empty() && candidate->getName() == localName;
+            });
+            if (same != released.end()) {
+                buffer = std::move(*same);
+                released.erase(same);
+            }
+            else if (registry.size() >= MAX_BUFFERS && !released.empty()) {
+                // Events of the thread which exited first make room
+                buffer = std::move(released.front());
+                released.erase(released.begin());
+                buffer->clear();
+                buffer->setName(std::move(localName));
+            }
+            else {
+                auto index = static_cast<uint32_t>(registry.size());
+                buffer = std::make_shared<TraceBuffer>(index, capacity.load(std::memory_order_relaxed));
+                buffer->setName(std::move(localName));
+                registry.push_back(buffer);
+            }
+            localBuffer.buffer = std::move(buffer);
+        }
+        catch (...) {
+            return nullptr;
+        }
+    }
+    return localBuffer.buffer.get();
+}
@@ -0,0 +1,148 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Records scheduler events into binary per-thread ring buffers, see Tracer.
+// Building with EVENTPP_NO_TRACING (`qmake CONFIG+=notracing`) removes tracing from the hot paths completely,
+// otherwise it costs one relaxed load per event while disabled
+#ifdef EVENTPP_NO_TRACING
+#define EVENTPP_TRACE(type, taskId, arg) ((void)0)
+#else
+#define EVENTPP_TRACE(type, taskId, arg) Tracer::record(type, taskId, arg)
+#endif
+
+enum class TraceEventType : uint8_t {
+    // Task added to a queue, deque, slot or timer wheel
+    SUBMIT,
+    // Looper took the task, argument is TaskSource
+    DEQUEUE,
+    // Task body started and finished
+    START,
+    END,
+    // Task passed back to the pool by `rescheduleCurrentTask()`
+    RESCHEDULE,
+    // Looper took the task from another looper's deque
+    STEAL,
+    // Looper went to sleep and woke up
+    PARK,
+    UNPARK
+};
+
+// Where a looper took a task from
+enum class TaskSource : uint8_t {
+    LOCAL_QUEUE,
+    NEXT_SLOT,
+    WORK_QUEUE,
+    GLOBAL_QUEUE,
+    STOLEN
+};
+
+struct TraceEvent {
+    // Steady clock time since epoch
+    uint64_t timeNs;
+    uint64_t taskId;
+    uint32_t arg;
+    TraceEventType type;
+    // Index of the recording thread's buffer
+    uint32_t thread;
+};
+
+// Ring buffer of one thread. Only the owner thread writes, any thread can read. Old events are overwritten
+class TraceBuffer {
+    // Every event takes 3 words: time, task id, type and argument
+    static constexpr size_t WORDS = 3;
+
+    const size_t _mask;
+    std::unique_ptr<std::atomic_uint64_t[]> _words;
+
+    // Index of the next event to write. Started is bumped before the slot is written, written after.
+    // Reader drops slots which could be overwritten while it was copying them
+    std::atomic_uint64_t _started{0};
+    std::atomic_uint64_t _written{0};
+
+    // Events before this index are cleared
+    std::atomic_uint64_t _begin{0};
+
+    const uint32_t _index;
+    std::string _name;
+
+public:
+    // Capacity is rounded up to a power of two
+    TraceBuffer(uint32_t index, size_t capacity);
+
+    TraceBuffer(const TraceBuffer &) = delete;
+    TraceBuffer &operator=(const TraceBuffer &) = delete;
+
+    // Has to be called only from the owner thread
+    void push(TraceEventType type, uint64_t taskId, uint32_t arg) noexcept;
+
+    // Appends events still in the buffer
+    void collect(std::vector<TraceEvent> &events) const;
+
+    void clear() noexcept;
+
+    uint32_t getIndex() const noexcept;
+
+    // Thread name shown by trace viewers
+    const std::string &getName() const noexcept;
+    void setName(std::string name);
+};
+
+// Binary task tracing. Disabled at start, `enable()` makes every thread record scheduler events into its own
+// ring buffer, so recording never locks or allocates after the first event of a thread.
+// Buffers outlive their threads and can be exported to Chrome trace JSON, which chrome://tracing and
+// Perfetto open. A thread starting later takes the buffer of an exited thread of the same name, e.g. a
+// restarted looper, and once there are 64 buffers, the one of the thread which exited first
+class Tracer {
+    static std::atomic_bool _enabled;
+
+public:
+    // Events kept per thread by default
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 16;
+
+    // Capacity applies to buffers of threads which haven't recorded anything yet
+    static void enable(size_t capacity = DEFAULT_CAPACITY);
+
+    static void disable() noexcept;
+
+    static bool isEnabled() noexcept {
+        return _enabled.load(std::memory_order_relaxed);
+    }
+
+    static void record(TraceEventType type, uint64_t taskId, uint32_t arg = 0) noexcept {
+        if (isEnabled()) {
+            push(type, taskId, arg);
+        }
+    }
+
+    // Names current thread in exported traces, doesn't allocate a buffer until the thread records
+    static void setThreadName(std::string name);
+
+    // Events of all threads ordered by time
+    static std::vector<TraceEvent> collect();
+
+    // Drops recorded events, buffers are kept
+    static void clear() noexcept;
+
+    // Writes recorded events as Chrome trace event JSON. Task executions become slices, sleeps become
+    // "park" slices, flow arrows connect submissions with executions
+    static void exportChromeTrace(std::ostream &out);
+
+    // Same to a file, throws if it can't be written
+    static void exportChromeTrace(const std::string &path);
+
+private:
+    static void push(TraceEventType type, uint64_t taskId, uint32_t arg) noexcept;
+
+    // Buffer of current thread, registered on first use
+    static TraceBuffer *local();
+};
+
+#endif // TRACER_H
@@ -0,0 +1,303 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "uring.h"
+
+namespace {
+
+int ringSetup(uint32_t entries, io_uring_params *params) noexcept {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ringEnter(int ring, uint32_t submit, uint32_t minComplete, uint32_t flags) noexcept {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring, submit, minComplete, flags, nullptr, 0));
+}
+
+int ringRegister(int ring, uint32_t opcode, const void *arg, uint32_t count) noexcept {
+    return static_cast<int>(syscall(__NR_io_uring_register, ring, opcode, arg, count));
+}
+
+template<class T>
+T *at(void *memory, uint32_t offset) noexcept {
+    return reinterpret_cast<T*>(static_cast<char*>(memory) + offset);
+}
+
+std::runtime_error ringError(const std::string &what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+}
+
+IoBuffer::IoBuffer(size_t size)
+    : _data{new char[size]}, _size{size} {}
+
+IoBuffer::IoBuffer(IoRing *ring, int index, char *data, size_t size) noexcept
+    : _ring{ring}, _index{index}, _data{data}, _size{size} {}
+
+IoBuffer::IoBuffer(IoBuffer &&other) noexcept
+    : _ring{other._ring}, _index{other._index}, _data{other._data}, _size{other._size} {
+    other._ring = nullptr;
+    other._index = -1;
+    other._data = nullptr;
+    other._size = 0;
+}
+
+IoBuffer &IoBuffer::operator=(IoBuffer &&other) noexcept {
+    if (this != &other) {
+        release();
+        std::swap(_ring, other._ring);
+        std::swap(_index, other._index);
+        std::swap(_data, other._data);
+        std::swap(_size, other._size);
+    }
+    return *this;
+}
+
+IoBuffer::~IoBuffer() {
+    release();
+}
+
+char *IoBuffer::data() const noexcept {
+    return _data;
+}
+
+size_t IoBuffer::size() const noexcept {
+    return _size;
+}
+
+bool IoBuffer::isValid() const noexcept {
+    return _data != nullptr;
+}
+
+IoRing *IoBuffer::getRing() const noexcept {
+    return _ring;
+}
+
+int IoBuffer::getIndex() const noexcept {
+    return _index;
+}
+
+void IoBuffer::release() noexcept {
+    if (_ring) {
+        _ring->releaseBuffer(_index);
+    }
+    else {
+        delete[] _data;
+    }
+    _ring = nullptr;
+    _index = -1;
+    _data = nullptr;
+    _size = 0;
+}
+
+IoRing::IoRing(uint32_t entries, uint32_t bufferCount, size_t bufferSize)
+    : IoWatch{&IoRing::onReady} {
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CLAMP;
+    _ring = ringSetup(entries, &params);
+    if (_ring < 0) {
+        throw ringError("Can't set up io_uring");
+    }
+
+    _sqMemorySize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    _cqMemorySize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    auto singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMapping) {
+        _sqMemorySize = _cqMemorySize = std::max(_sqMemorySize, _cqMemorySize);
+    }
+
+    _sqMemory = map(_sqMemorySize, IORING_OFF_SQ_RING);
+    _cqMemory = singleMapping ? _sqMemory : map(_cqMemorySize, IORING_OFF_CQ_RING);
+    _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes = static_cast<io_uring_sqe*>(map(_sqesSize, IORING_OFF_SQES));
+    if (!_sqMemory || !_cqMemory || !_sqes) {
+        auto error = ringError("Can't map io_uring");
+        release();
+        throw error;
+    }
+
+    _sqHead = at<std::atomic_uint32_t>(_sqMemory, params.sq_off.head);
+    _sqTail = at<std::atomic_uint32_t>(_sqMemory, params.sq_off.tail);
+    _sqArray = at<uint32_t>(_sqMemory, params.sq_off.array);
+    _sqMask = *at<uint32_t>(_sqMemory, params.sq_off.ring_mask);
+    _sqEntries = params.sq_entries;
+    _sqLocalTail = _sqTail->load(std::memory_order_relaxed);
+
+    _cqes = at<io_uring_cqe>(_cqMemory, params.cq_off.cqes);
+    _cqHead = at<std::atomic_uint32_t>(_cqMemory, params.cq_off.head);
+    _cqTail = at<std::atomic_uint32_t>(_cqMemory, params.cq_off.tail);
+    _cqMask = *at<uint32_t>(_cqMemory, params.cq_off.ring_mask);
+    _cqEntries = params.cq_entries;
+
+    _event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_event < 0 || ringRegister(_ring, IORING_REGISTER_EVENTFD, &_event, 1) != 0) {
+        auto error = ringError("Can't register io_uring eventfd");
+        release();
+        throw error;
+    }
+
+    // Pages stay pinned for the life of the ring. RLIMIT_MEMLOCK may not allow that, buffers work anyway
+    _bufferCount = std::min<uint32_t>(bufferCount, 64);
+    _bufferSize = bufferSize;
+    if (_bufferCount != 0 && _bufferSize != 0) {
+        auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        _bufferSize = (_bufferSize + page - 1) / page * page;
+        _buffers = static_cast<char*>(std::aligned_alloc(page, _bufferSize * _bufferCount));
+        if (_buffers == nullptr) {
+            _bufferCount = 0;
+        }
+
+        std::vector<iovec> vectors(_bufferCount);
+        for (uint32_t i = 0; i < _bufferCount; ++i) {
+            vectors[i].iov_base = _buffers + i * _bufferSize;
+            vectors[i].iov_len = _bufferSize;
+        }
+        _buffersRegistered = _bufferCount != 0 &&
+            ringRegister(_ring, IORING_REGISTER_BUFFERS, vectors.data(), _bufferCount) == 0;
+        _freeBuffers = _bufferCount == 64 ? ~uint64_t{0} : (uint64_t{1} << _bufferCount) - 1;
+    }
+}
+
+IoRing::~IoRing() {
+    release();
+}
+
+void *IoRing::map(size_t size, uint64_t offset) noexcept {
+    auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring,
+                       static_cast<off_t>(offset));
+    return memory == MAP_FAILED ? nullptr : memory;
+}
+
+void IoRing::release() noexcept {
+    if (_event >= 0) {
+        close(_event);
+        _event = -1;
+    }
+    if (_sqes) {
+        munmap(_sqes, _sqesSize);
+        _sqes = nullptr;
+    }
+    if (_cqMemory && _cqMemory != _sqMemory) {
+        munmap(_cqMemory, _cqMemorySize);
+    }
+    _cqMemory = nullptr;
+    if (_sqMemory) {
+        munmap(_sqMemory, _sqMemorySize);
+        _sqMemory = nullptr;
+    }
+    if (_ring >= 0) {
+        close(_ring);
+        _ring = -1;
+    }
+    std::free(_buffers);
+    _buffers = nullptr;
+}
+
+void IoRing::watch(Reactor &reactor) {
+    reactor.add(_event, EPOLLIN, this);
+}
+
+io_uring_sqe *IoRing::prepare(IoCompletion *completion) noexcept {
+    // Completion queue never overflows: no more operations in flight than it holds
+    if (_inflight >= _cqEntries) {
+        return nullptr;
+    }
+    if (_sqLocalTail - _sqHead->load(std::memory_order_acquire) >= _sqEntries) {
+        submit();
+        if (_sqLocalTail - _sqHead->load(std::memory_order_acquire) >= _sqEntries) {
+            return nullptr;
+        }
+    }
+
+    auto index = _sqLocalTail & _sqMask;
+    auto sqe = &_sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = reinterpret_cast<uint64_t>(completion);
+    _sqArray[index] = index;
+    ++_sqLocalTail;
+    ++_pending;
+    ++_inflight;
+    return sqe;
+}
+
+void IoRing::submit() noexcept {
+    if (_pending == 0) {
+        return;
+    }
+
+    _sqTail->store(_sqLocalTail, std::memory_order_release);
+    while (_pending != 0) {
+        auto submitted = ringEnter(_ring, _pending, 0, 0);
+        if (submitted > 0) {
+            _pending -= static_cast<uint32_t>(submitted);
+        }
+        else if (submitted == 0 || errno != EINTR) {
+            // Kernel is short of memory: the rest goes with the next call
+            break;
+        }
+    }
+}
+
+size_t IoRing::reap() {
+    size_t count = 0;
+    auto head = _cqHead->load(std::memory_order_relaxed);
+    while (head != _cqTail->load(std::memory_order_acquire)) {
+        auto &cqe = _cqes[head & _cqMask];
+        auto completion = reinterpret_cast<IoCompletion*>(cqe.user_data);
+        auto result = cqe.res;
+
+        // Entry is given back before the completion runs, it may queue new operations
+        _cqHead->store(++head, std::memory_order_release);
+        --_inflight;
+        completion->complete(completion, result);
+        ++count;
+    }
+    return count;
+}
+
+bool IoRing::hasCompletions() const noexcept {
+    return _cqHead->load(std::memory_order_relaxed) != _cqTail->load(std::memory_order_acquire);
+}
+
+size_t IoRing::getInflight() const noexcept {
+    return _inflight;
+}
+
+IoBuffer IoRing::getBuffer() noexcept {
+    auto free = _freeBuffers.load(std::memory_order_relaxed);
+    while (free != 0) {
+        auto index = __builtin_ctzll(free);
+        if (_freeBuffers.compare_exchange_weak(free, free & (free - 1), std::memory_order_acquire,
+                                               std::memory_order_relaxed)) {
+            return IoBuffer(this, index, _buffers + static_cast<size_t>(index) * _bufferSize, _bufferSize);
+        }
+    }
+    return {};
+}
+
+bool IoRing::isRegistered(const IoBuffer &buffer) const noexcept {
+    return _buffersRegistered && buffer.getRing() == this;
+}
+
+void IoRing::releaseBuffer(int index) noexcept {
+    _freeBuffers.fetch_or(uint64_t{1} << index, std::memory_order_release);
+}
+
+void IoRing::onReady(IoWatch *watch, uint32_t) {
+    auto ring = static_cast<IoRing*>(watch);
+    uint64_t value;
+    [[maybe_unused]] auto read = ::read(ring->_event, &value, sizeof(value));
+    ring->reap();
+}
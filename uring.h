@@ -0,0 +1,164 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "reactor.h"
+
+// How AsyncFile performs I/O on loopers with a reactor
+enum class FileIoBackend {
+    // io_uring when the kernel provides it, offload threads otherwise
+    AUTO,
+    // io_uring, the pool fails to start without it
+    URING,
+    // Blocking calls on offload threads
+    THREADS
+};
+
+// Operation submitted to IoRing. Ring calls it on the looper thread with the result: non-negative value
+// on success, -errno on failure. Intrusive, the owner frees it in `complete`
+struct IoCompletion {
+    void (*complete)(IoCompletion *completion, int32_t result);
+};
+
+class IoRing;
+
+// Memory for file I/O. Taken from the registered set of a looper's ring, so reads and writes on that looper
+// skip pinning the pages for every operation, or allocated on the heap when the set is used up. Move-only,
+// returns the memory when destroyed. Can be passed between threads, but has to be destroyed before the pool
+class IoBuffer {
+    IoRing *_ring{nullptr};
+    int _index{-1};
+    char *_data{nullptr};
+    size_t _size{0};
+
+public:
+    IoBuffer() noexcept = default;
+
+    // Heap buffer
+    explicit IoBuffer(size_t size);
+
+    // Registered buffer `index` of `ring`
+    IoBuffer(IoRing *ring, int index, char *data, size_t size) noexcept;
+
+    IoBuffer(IoBuffer &&other) noexcept;
+    IoBuffer &operator=(IoBuffer &&other) noexcept;
+
+    IoBuffer(const IoBuffer &) = delete;
+    IoBuffer &operator=(const IoBuffer &) = delete;
+
+    ~IoBuffer();
+
+    char *data() const noexcept;
+    size_t size() const noexcept;
+
+    bool isValid() const noexcept;
+
+    // Ring the buffer is registered with, nullptr for heap buffer
+    IoRing *getRing() const noexcept;
+
+    // Index among registered buffers of the ring, -1 for heap buffer
+    int getIndex() const noexcept;
+
+private:
+    void release() noexcept;
+};
+
+// io_uring instance of a looper, driven by raw syscalls. Operations queued during a loop iteration are
+// submitted together by one `submit()`, completions are reaped by the looper and wake it up through an
+// eventfd watched by its reactor. Everything but buffer release has to be called from the looper thread
+class IoRing : public IoWatch {
+    int _ring{-1};
+    int _event{-1};
+
+    // Mapped submission queue
+    void *_sqMemory{nullptr};
+    size_t _sqMemorySize{0};
+    io_uring_sqe *_sqes{nullptr};
+    size_t _sqesSize{0};
+    std::atomic_uint32_t *_sqHead{nullptr};
+    std::atomic_uint32_t *_sqTail{nullptr};
+    uint32_t *_sqArray{nullptr};
+    uint32_t _sqMask{0};
+    uint32_t _sqEntries{0};
+
+    // Mapped completion queue, may share the mapping with the submission queue
+    void *_cqMemory{nullptr};
+    size_t _cqMemorySize{0};
+    io_uring_cqe *_cqes{nullptr};
+    std::atomic_uint32_t *_cqHead{nullptr};
+    std::atomic_uint32_t *_cqTail{nullptr};
+    uint32_t _cqMask{0};
+    uint32_t _cqEntries{0};
+
+    // Queued entries not passed to the kernel yet and operations waiting for completion
+    uint32_t _sqLocalTail{0};
+    uint32_t _pending{0};
+    size_t _inflight{0};
+
+    // Registered buffers, a set bit is a free one
+    char *_buffers{nullptr};
+    size_t _bufferSize{0};
+    uint32_t _bufferCount{0};
+    bool _buffersRegistered{false};
+    std::atomic_uint64_t _freeBuffers{0};
+
+public:
+    static constexpr uint32_t DEFAULT_ENTRIES = 256;
+    static constexpr uint32_t DEFAULT_BUFFER_COUNT = 16;
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+    // Sets up the ring and registers up to 64 buffers. Throws std::runtime_error if the kernel has no
+    // io_uring. Buffers the kernel refuses to register are still given out, as plain memory
+    explicit IoRing(uint32_t entries = DEFAULT_ENTRIES, uint32_t bufferCount = DEFAULT_BUFFER_COUNT,
+                    size_t bufferSize = DEFAULT_BUFFER_SIZE);
+
+    // Operations still in flight are abandoned
+    ~IoRing();
+
+    IoRing(const IoRing &) = delete;
+    IoRing &operator=(const IoRing &) = delete;
+
+    // Delivers completions through `reactor`
+    void watch(Reactor &reactor);
+
+    // Free submission entry, cleared, or nullptr when the ring is full. Entry is submitted with the next
+    // `submit()`, `completion` gets its result
+    io_uring_sqe *prepare(IoCompletion *completion) noexcept;
+
+    // Passes queued entries to the kernel with one call
+    void submit() noexcept;
+
+    // Calls completions of finished operations. Returns their number
+    size_t reap();
+
+    bool hasCompletions() const noexcept;
+
+    // Operations submitted or queued and not completed yet
+    size_t getInflight() const noexcept;
+
+    // Free registered buffer, or invalid buffer when all are taken. Can be called from any thread
+    IoBuffer getBuffer() noexcept;
+
+    // Is `buffer` registered with this ring, so fixed reads and writes can use it
+    bool isRegistered(const IoBuffer &buffer) const noexcept;
+
+private:
+    friend class IoBuffer;
+
+    void releaseBuffer(int index) noexcept;
+
+    // Maps a region of the ring, nullptr on failure
+    void *map(size_t size, uint64_t offset) noexcept;
+
+    // Unmaps and closes whatever was set up
+    void release() noexcept;
+
+    static void onReady(IoWatch *watch, uint32_t events);
+};
+
+#endif // URING_H
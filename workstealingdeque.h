@@ -0,0 +1,127 @@
+#ifndef WORKSTEALINGDEQUE_H
+#define WORKSTEALINGDEQUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Chase-Lev work-stealing deque (weak memory model version by Le et al.).
+// Owner thread pushes and pops at the bottom, any other thread can steal from the top.
+// T has to be a pointer-like trivially copyable type, nullptr is used as "nothing"
+template<class T>
+class WorkStealingDeque {
+    // Capacity and mask are unsigned, signed index math makes GCC assume no overflow when inlined
+    struct Buffer {
+        const size_t capacity;
+        const size_t mask;
+        std::unique_ptr<std::atomic<T>[]> slots;
+
+        explicit Buffer(size_t cap)
+            : capacity{cap}, mask{cap - 1}, slots{new std::atomic<T>[cap]} {}
+
+        T get(int64_t index) const noexcept {
+            return slots[static_cast<size_t>(index) & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t index, T item) noexcept {
+            slots[static_cast<size_t>(index) & mask].store(item, std::memory_order_relaxed);
+        }
+    };
+
+    alignas(64) std::atomic<int64_t> _top{0};
+    alignas(64) std::atomic<int64_t> _bottom{0};
+    std::atomic<Buffer*> _buffer;
+
+    // Buffers replaced by growth. Thieves may still read them, so they live until the deque dies
+    std::vector<std::unique_ptr<Buffer>> _buffers;
+
+public:
+    explicit WorkStealingDeque(size_t capacity = 256) {
+        // Capacity has to be a power of two, so indices can be masked
+        size_t cap = 1;
+        while (cap < capacity)
+            cap <<= 1;
+        _buffers.emplace_back(new Buffer(cap));
+        _buffer.store(_buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    // Owner only
+    void push(T item) {
+        int64_t b = _bottom.load(std::memory_order_relaxed);
+        int64_t t = _top.load(std::memory_order_acquire);
+        Buffer* buffer = _buffer.load(std::memory_order_relaxed);
+        if (static_cast<size_t>(b - t) >= buffer->capacity) {
+            buffer = grow(buffer, b, t);
+        }
+        buffer->put(b, item);
+        _bottom.store(b + 1, std::memory_order_release);
+    }
+
+    // Owner only. Returns the most recently pushed item or nullptr
+    T pop() noexcept {
+        int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* buffer = _buffer.load(std::memory_order_relaxed);
+        _bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = _top.load(std::memory_order_relaxed);
+
+        T item = nullptr;
+        if (t <= b) {
+            item = buffer->get(b);
+            if (t == b) {
+                // The last item, race with thieves for it
+                if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    item = nullptr;
+                }
+                _bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        }
+        else {
+            _bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread. Returns the oldest item or nullptr if deque is empty or steal lost a race
+    T steal() noexcept {
+        int64_t t = _top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = _bottom.load(std::memory_order_acquire);
+
+        if (t < b) {
+            Buffer* buffer = _buffer.load(std::memory_order_acquire);
+            T item = buffer->get(t);
+            if (_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return item;
+            }
+        }
+        return nullptr;
+    }
+
+    size_t size() const noexcept {
+        int64_t b = _bottom.load(std::memory_order_relaxed);
+        int64_t t = _top.load(std::memory_order_relaxed);
+        return b > t ? static_cast<size_t>(b - t) : 0;
+    }
+
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+private:
+    Buffer* grow(Buffer* old, int64_t bottom, int64_t top) {
+        _buffers.emplace_back(new Buffer(old->capacity * 2));
+        Buffer* buffer = _buffers.back().get();
+        for (int64_t i = top; i < bottom; ++i) {
+            buffer->put(i, old->get(i));
+        }
+        _buffer.store(buffer, std::memory_order_release);
+        return buffer;
+    }
+};
+
+#endif // WORKSTEALINGDEQUE_H